@@ -0,0 +1,204 @@
+/*
+ * Hybrid polling for synchronous I/O completions.
+ *
+ * A task waiting for a synchronous read normally sleeps until the
+ * completion interrupt wakes it. On devices that complete in a few tens
+ * of microseconds the interrupt, softirq and wakeup are a large part of
+ * the latency seen by the task.
+ *
+ * For queues with QUEUE_FLAG_POLL set and a poll_fn registered through
+ * blk_queue_poll(), a waiter instead sleeps for half the mean completion
+ * time it has seen so far on the queue (or a fixed io_poll_delay), and
+ * then calls poll_fn until its I/O is done. If that takes much longer than
+ * expected it falls back to waiting for the interrupt. The mean is learned
+ * from what the waiters see, so a sleep that overshoots only pulls it down
+ * towards the real completion time.
+ *
+ * Only tasks in the realtime I/O class poll, everything else keeps
+ * sleeping: spinning is a waste of cpu for I/O nobody is waiting on
+ * urgently.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/hrtimer.h>
+#include <linux/ioprio.h>
+#include <linux/iocontext.h>
+#include <linux/sched.h>
+
+#include "blk.h"
+
+/* how much longer than the mean a poller spins before giving up */
+#define BLK_POLL_SLACK_NSEC	(50 * NSEC_PER_USEC)
+
+static u64 blk_poll_mean(struct request_queue *q)
+{
+	unsigned long flags;
+	u64 mean;
+
+	spin_lock_irqsave(&q->poll_stat.lock, flags);
+	mean = q->poll_stat.mean_ns;
+	spin_unlock_irqrestore(&q->poll_stat.lock, flags);
+
+	return mean;
+}
+
+static s64 blk_poll_elapsed(ktime_t start)
+{
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/**
+ * blk_poll_wanted - should the current task poll for its I/O on @q
+ * @q:	the queue the I/O was submitted to
+ **/
+bool blk_poll_wanted(struct request_queue *q)
+{
+	struct io_context *ioc = current->io_context;
+	int class;
+
+	if (!q->poll_fn || !blk_queue_io_poll(q))
+		return false;
+
+	if (ioc && ioprio_valid(ioc->ioprio))
+		class = IOPRIO_PRIO_CLASS(ioc->ioprio);
+	else
+		class = task_nice_ioclass(current);
+
+	return class == IOPRIO_CLASS_RT;
+}
+EXPORT_SYMBOL_GPL(blk_poll_wanted);
+
+/*
+ * Sleep until the I/O submitted at @start is expected to be half done.
+ * The caller must make sure a completion wakes the task up.
+ */
+static bool blk_poll_sleep(struct request_queue *q, ktime_t start,
+			   bool (*done)(void *), void *data)
+{
+	struct hrtimer_sleeper hs;
+	s64 nsec;
+
+	if (q->poll_delay < 0)
+		return false;
+
+	if (q->poll_delay)
+		nsec = (s64)q->poll_delay * NSEC_PER_USEC;
+	else
+		nsec = blk_poll_mean(q) / 2;
+
+	nsec -= blk_poll_elapsed(start);
+	if (nsec <= 0)
+		return false;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&hs, current);
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	hrtimer_start(&hs.timer, ns_to_ktime(nsec), HRTIMER_MODE_REL);
+	if (hs.task && !done(data))
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+
+	return true;
+}
+
+/**
+ * blk_poll - wait for an I/O by polling the queue
+ * @q:		the queue the I/O was submitted to
+ * @start:	when the I/O was submitted
+ * @done:	returns true once the I/O has completed
+ * @data:	argument to @done
+ *
+ * Description:
+ *     Must be called in process context, in TASK_RUNNING state. Returns
+ *     true if the I/O completed, false if the caller should go back to
+ *     waiting for the completion to wake it up.
+ **/
+bool blk_poll(struct request_queue *q, ktime_t start,
+	      bool (*done)(void *), void *data)
+{
+	struct blk_poll_stat *stat = &q->poll_stat;
+	unsigned long flags;
+	bool slept, hit = false;
+	s64 budget;
+
+	/* the I/O may still sit on our plug list */
+	blk_flush_plug(current);
+
+	slept = blk_poll_sleep(q, start, done, data);
+	budget = 2 * blk_poll_mean(q) + BLK_POLL_SLACK_NSEC;
+
+	while (!(hit = done(data))) {
+		if (q->poll_fn(q) > 0)
+			continue;
+		if (need_resched() || blk_poll_elapsed(start) > budget)
+			break;
+		cpu_relax();
+	}
+
+	spin_lock_irqsave(&stat->lock, flags);
+	stat->polls++;
+	stat->hits += hit;
+	stat->sleeps += slept;
+	spin_unlock_irqrestore(&stat->lock, flags);
+
+	return hit;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
+/**
+ * blk_poll_account - record the completion time of a polled I/O
+ * @q:		the queue the I/O was submitted to
+ * @start:	when the I/O was submitted
+ *
+ * Description:
+ *     Called once the waiter has seen its I/O complete, whether it found
+ *     it by polling or was woken up.
+ **/
+void blk_poll_account(struct request_queue *q, ktime_t start)
+{
+	struct blk_poll_stat *stat = &q->poll_stat;
+	s64 nsec = blk_poll_elapsed(start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&stat->lock, flags);
+	if (!stat->samples++)
+		stat->mean_ns = nsec;
+	else
+		stat->mean_ns = (stat->mean_ns * 7 + nsec) >> 3;
+	spin_unlock_irqrestore(&stat->lock, flags);
+}
+EXPORT_SYMBOL_GPL(blk_poll_account);
+
+ssize_t blk_poll_stat_show(struct request_queue *q, char *page)
+{
+	struct blk_poll_stat *stat = &q->poll_stat;
+	unsigned long flags;
+	ssize_t ret;
+
+	spin_lock_irqsave(&stat->lock, flags);
+	ret = sprintf(page, "mean_ns %llu\nsamples %lu\npolls %lu\n"
+		      "hits %lu\nsleeps %lu\n",
+		      (unsigned long long)stat->mean_ns, stat->samples,
+		      stat->polls, stat->hits, stat->sleeps);
+	spin_unlock_irqrestore(&stat->lock, flags);
+
+	return ret;
+}
+
+void blk_poll_stat_reset(struct request_queue *q)
+{
+	struct blk_poll_stat *stat = &q->poll_stat;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stat->lock, flags);
+	stat->mean_ns = 0;
+	stat->samples = 0;
+	stat->polls = 0;
+	stat->hits = 0;
+	stat->sleeps = 0;
+	spin_unlock_irqrestore(&stat->lock, flags);
+}
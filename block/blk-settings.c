@@ -99,6 +99,20 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll - set the completion poll function of a queue
+ * @q:		queue
+ * @fn:		function that reaps completed I/O, returns how many it found
+ *
+ * Polling itself is off until enabled through the queue's io_poll
+ * attribute. See block/blk-poll.c.
+ */
+void blk_queue_poll(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll);
+
 /**
  * blk_urgent_request() - Set an urgent_request handler function for queue
  * @q:		queue
@@ -0,0 +1,477 @@
+/*
+ * Per-cpu software queues for bio based drivers.
+ *
+ * A request based driver gets every request through the single
+ * request_queue, its queue_lock and the elevator. For fast devices that do
+ * not need an elevator this serialization costs more than the I/O itself.
+ * Drivers registering their own make_request_fn avoid it, but then have
+ * to pass bios to their worker through a list and lock of their own.
+ *
+ * blk_swq gives such drivers per-cpu staging lists that map onto
+ * nr_hw_queues dispatch contexts, each run from a work item on the cpu
+ * that submitted the bio, plus an optional per context tag space of
+ * queue_depth tags. The driver's queue_bio is called for each bio in
+ * process context, and may sleep. A task waiting for its bio can also
+ * dispatch from its own context through blk_swq_poll(), or just kick and
+ * wait for the run work through blk_swq_poll_work().
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/delay.h>
+#include <linux/blk-swq.h>
+
+static int blk_swq_get_tag(struct blk_swq_hw_ctx *hctx)
+{
+	int tag;
+
+	do {
+		tag = find_first_zero_bit(hctx->tag_map, hctx->queue_depth);
+		if (tag >= hctx->queue_depth)
+			return -1;
+	} while (test_and_set_bit(tag, hctx->tag_map));
+
+	return tag;
+}
+
+static void blk_swq_put_tag(struct blk_swq_hw_ctx *hctx, int tag)
+{
+	hctx->tag_bios[tag] = NULL;
+	clear_bit(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+
+	if (test_and_clear_bit(BLK_SWQ_S_TAG_WAIT, &hctx->state))
+		blk_swq_run_hw_queue(hctx);
+}
+
+/*
+ * Get a tag for @bio, or arrange for the hctx to be run again once one is
+ * freed. Checking again after setting TAG_WAIT closes the window against
+ * a blk_swq_put_tag() that did not see it yet.
+ */
+static int blk_swq_start_tag(struct blk_swq_hw_ctx *hctx, struct bio *bio)
+{
+	int tag = blk_swq_get_tag(hctx);
+
+	if (tag < 0) {
+		set_bit(BLK_SWQ_S_TAG_WAIT, &hctx->state);
+		smp_mb__after_set_bit();
+		tag = blk_swq_get_tag(hctx);
+		if (tag < 0)
+			return -1;
+		clear_bit(BLK_SWQ_S_TAG_WAIT, &hctx->state);
+	}
+
+	hctx->tag_bios[tag] = bio;
+	return tag;
+}
+
+static bool blk_swq_staged(struct blk_swq_hw_ctx *hctx)
+{
+	struct blk_swq *swq = hctx->swq;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (blk_swq_cpu_to_hctx(swq, cpu) == hctx &&
+		    !bio_list_empty(&per_cpu_ptr(swq->ctx, cpu)->bios))
+			return true;
+	return false;
+}
+
+/*
+ * Called with BLK_SWQ_S_RUNNING held, returns the number of bios passed
+ * to the driver.
+ */
+static int __blk_swq_dispatch(struct blk_swq_hw_ctx *hctx)
+{
+	struct blk_swq *swq = hctx->swq;
+	struct bio_list list;
+	struct bio *bio;
+	int cpu, tag, nr = 0;
+
+	list = hctx->dispatch;
+	bio_list_init(&hctx->dispatch);
+
+	for_each_possible_cpu(cpu) {
+		struct blk_swq_ctx *ctx = per_cpu_ptr(swq->ctx, cpu);
+
+		if (blk_swq_cpu_to_hctx(swq, cpu) != hctx ||
+		    bio_list_empty(&ctx->bios))
+			continue;
+
+		spin_lock_irq(&ctx->lock);
+		bio_list_merge(&list, &ctx->bios);
+		bio_list_init(&ctx->bios);
+		spin_unlock_irq(&ctx->lock);
+	}
+
+	while ((bio = bio_list_pop(&list))) {
+		if (test_bit(BLK_SWQ_S_QUIESCED, &swq->state))
+			goto requeue;
+
+		tag = -1;
+		if (hctx->queue_depth) {
+			tag = blk_swq_start_tag(hctx, bio);
+			if (tag < 0)
+				goto requeue;
+		}
+
+		if (swq->ops->queue_bio(hctx, bio, tag) == BLK_SWQ_BUSY) {
+			if (tag >= 0)
+				blk_swq_put_tag(hctx, tag);
+			goto requeue;
+		}
+		nr++;
+	}
+	hctx->nr_dispatched += nr;
+	return nr;
+
+requeue:
+	bio_list_add_head(&list, bio);
+	hctx->dispatch = list;
+	hctx->nr_dispatched += nr;
+	return nr;
+}
+
+/*
+ * The run work and pollers take turns through BLK_SWQ_S_RUNNING. Whoever
+ * loses the race leaves its bios to the winner, who checks for newly
+ * staged bios once it is done.
+ */
+static int blk_swq_dispatch(struct blk_swq_hw_ctx *hctx)
+{
+	int nr;
+
+	if (test_and_set_bit(BLK_SWQ_S_RUNNING, &hctx->state))
+		return 0;
+
+	nr = __blk_swq_dispatch(hctx);
+
+	clear_bit_unlock(BLK_SWQ_S_RUNNING, &hctx->state);
+	smp_mb__after_clear_bit();
+	if (blk_swq_staged(hctx))
+		blk_swq_run_hw_queue(hctx);
+
+	return nr;
+}
+
+static void blk_swq_run_work(struct work_struct *work)
+{
+	blk_swq_dispatch(container_of(work, struct blk_swq_hw_ctx, run_work));
+}
+
+/**
+ * blk_swq_run_hw_queue - Dispatch the bios staged for a hardware context
+ * @hctx:	the hardware context
+ *
+ * Description:
+ *     Drivers call this when resources freed up after queue_bio returned
+ *     BLK_SWQ_BUSY. Running out of tags is handled by the core.
+ **/
+void blk_swq_run_hw_queue(struct blk_swq_hw_ctx *hctx)
+{
+	if (!test_bit(BLK_SWQ_S_QUIESCED, &hctx->swq->state))
+		queue_work(hctx->swq->wq, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_swq_run_hw_queue);
+
+/**
+ * blk_swq_poll - Dispatch the current cpu's staged bios from the caller
+ * @swq:	the software queue set
+ *
+ * Description:
+ *     Meant to be called from the driver's poll_fn (see blk_queue_poll()),
+ *     so that a task waiting for its bio runs queue_bio itself instead of
+ *     waiting for the run work to be scheduled. The bios of other tasks
+ *     staged on the same cpu are dispatched as well, so this is only for
+ *     drivers whose queue_bio does not depend on the task it runs in.
+ *     Must be called from process context. Returns the number of bios
+ *     dispatched, which for a driver that ends its bios from queue_bio is
+ *     the number completed.
+ **/
+int blk_swq_poll(struct blk_swq *swq)
+{
+	struct blk_swq_hw_ctx *hctx;
+
+	hctx = blk_swq_cpu_to_hctx(swq, raw_smp_processor_id());
+	if (test_bit(BLK_SWQ_S_QUIESCED, &swq->state) ||
+	    atomic_read(&swq->flushing))
+		return 0;
+
+	return blk_swq_dispatch(hctx);
+}
+EXPORT_SYMBOL(blk_swq_poll);
+
+/**
+ * blk_swq_poll_work - Wait for the current cpu's run work to dispatch
+ * @swq:	the software queue set
+ *
+ * Description:
+ *     A poll_fn for drivers whose queue_bio must run in the run work, e.g.
+ *     because it does file I/O that would otherwise be charged to, and
+ *     limited by, whichever task happens to poll. The run work is kicked
+ *     and waited for instead of dispatching from the caller. Must be called
+ *     from process context. Returns the number of bios the run work
+ *     dispatched meanwhile.
+ **/
+int blk_swq_poll_work(struct blk_swq *swq)
+{
+	struct blk_swq_hw_ctx *hctx;
+	unsigned long nr;
+
+	hctx = blk_swq_cpu_to_hctx(swq, raw_smp_processor_id());
+	if (test_bit(BLK_SWQ_S_QUIESCED, &swq->state))
+		return 0;
+
+	nr = ACCESS_ONCE(hctx->nr_dispatched);
+	if (blk_swq_staged(hctx))
+		blk_swq_run_hw_queue(hctx);
+	flush_work(&hctx->run_work);
+
+	return ACCESS_ONCE(hctx->nr_dispatched) - nr;
+}
+EXPORT_SYMBOL(blk_swq_poll_work);
+
+/**
+ * blk_swq_queue_bio - Stage a bio on the current cpu's software queue
+ * @swq:	the software queue set
+ * @bio:	the bio
+ *
+ * Description:
+ *     Meant to be called from the driver's make_request_fn. Does not sleep.
+ **/
+void blk_swq_queue_bio(struct blk_swq *swq, struct bio *bio)
+{
+	struct blk_swq_hw_ctx *hctx;
+	struct blk_swq_ctx *ctx;
+	unsigned long flags;
+	int cpu;
+
+	cpu = get_cpu();
+	ctx = per_cpu_ptr(swq->ctx, cpu);
+	hctx = blk_swq_cpu_to_hctx(swq, cpu);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	bio_list_add(&ctx->bios, bio);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	blk_swq_run_hw_queue(hctx);
+	put_cpu();
+}
+EXPORT_SYMBOL(blk_swq_queue_bio);
+
+/**
+ * blk_swq_end_bio - End a bio started by queue_bio
+ * @hctx:	the hardware context the bio was started on
+ * @bio:	the bio
+ * @tag:	the tag queue_bio was given
+ * @error:	0 or a negative error code
+ *
+ * Description:
+ *     May be called from any context.
+ **/
+void blk_swq_end_bio(struct blk_swq_hw_ctx *hctx, struct bio *bio, int tag,
+		     int error)
+{
+	if (tag >= 0)
+		blk_swq_put_tag(hctx, tag);
+	bio_endio(bio, error);
+}
+EXPORT_SYMBOL(blk_swq_end_bio);
+
+static void blk_swq_wait_running(struct blk_swq_hw_ctx *hctx)
+{
+	while (test_bit(BLK_SWQ_S_RUNNING, &hctx->state))
+		msleep(1);
+}
+
+/*
+ * Wait for the run work and any poller to leave queue_bio.
+ */
+static void blk_swq_wait_hw_ctx(struct blk_swq_hw_ctx *hctx)
+{
+	flush_work(&hctx->run_work);
+	blk_swq_wait_running(hctx);
+}
+
+/**
+ * blk_swq_flush - Dispatch all staged bios and wait for queue_bio to return
+ * @swq:	the software queue set
+ *
+ * Description:
+ *     For a driver that ends its bios from queue_bio this waits for all
+ *     bios submitted before the call to be done. Bios that are waiting for
+ *     a tag or were refused with BLK_SWQ_BUSY are not waited for, and
+ *     neither are bios staged after the call.
+ *
+ *     Pollers are kept out meanwhile, so that the run work queued here
+ *     cannot lose the dispatch to a poller that started before the flush
+ *     and grabbed the staged bios too early. Once such a poller is gone,
+ *     the run work picks up everything staged before the call in one go.
+ **/
+void blk_swq_flush(struct blk_swq *swq)
+{
+	struct blk_swq_hw_ctx *hctx;
+	unsigned int i;
+
+	atomic_inc(&swq->flushing);
+	smp_mb__after_atomic_inc();
+
+	for (i = 0; i < swq->nr_hw_queues; i++) {
+		hctx = &swq->hw_ctx[i];
+		blk_swq_wait_running(hctx);
+		blk_swq_run_hw_queue(hctx);
+		blk_swq_wait_hw_ctx(hctx);
+	}
+
+	atomic_dec(&swq->flushing);
+}
+EXPORT_SYMBOL(blk_swq_flush);
+
+/**
+ * blk_swq_quiesce - Stop dispatching bios
+ * @swq:	the software queue set
+ *
+ * Description:
+ *     Waits for running queue_bio calls to return. Bios can still be
+ *     staged, they are dispatched after blk_swq_resume().
+ **/
+void blk_swq_quiesce(struct blk_swq *swq)
+{
+	unsigned int i;
+
+	set_bit(BLK_SWQ_S_QUIESCED, &swq->state);
+	smp_mb__after_set_bit();
+	for (i = 0; i < swq->nr_hw_queues; i++)
+		blk_swq_wait_hw_ctx(&swq->hw_ctx[i]);
+}
+EXPORT_SYMBOL(blk_swq_quiesce);
+
+/**
+ * blk_swq_resume - Restart dispatching after blk_swq_quiesce()
+ * @swq:	the software queue set
+ **/
+void blk_swq_resume(struct blk_swq *swq)
+{
+	unsigned int i;
+
+	clear_bit(BLK_SWQ_S_QUIESCED, &swq->state);
+	for (i = 0; i < swq->nr_hw_queues; i++)
+		blk_swq_run_hw_queue(&swq->hw_ctx[i]);
+}
+EXPORT_SYMBOL(blk_swq_resume);
+
+static void blk_swq_free_hw_ctx(struct blk_swq *swq)
+{
+	unsigned int i;
+
+	for (i = 0; i < swq->nr_hw_queues; i++) {
+		kfree(swq->hw_ctx[i].tag_map);
+		kfree(swq->hw_ctx[i].tag_bios);
+	}
+	kfree(swq->hw_ctx);
+}
+
+/**
+ * blk_swq_init - Set up software queues for a bio based driver
+ * @ops:		driver callbacks
+ * @nr_hw_queues:	number of hardware dispatch contexts, capped at the
+ *			number of possible cpus
+ * @queue_depth:	tags per hardware context, 0 to run without tags
+ * @name:		name of the dispatch workqueue
+ * @driver_data:	driver private data
+ *
+ * Description:
+ *     Returns NULL on failure.
+ **/
+struct blk_swq *blk_swq_init(const struct blk_swq_ops *ops,
+			     unsigned int nr_hw_queues,
+			     unsigned int queue_depth,
+			     const char *name, void *driver_data)
+{
+	struct blk_swq *swq;
+	unsigned int i;
+	int cpu;
+
+	swq = kzalloc(sizeof(*swq), GFP_KERNEL);
+	if (!swq)
+		return NULL;
+
+	swq->ops = ops;
+	swq->driver_data = driver_data;
+	atomic_set(&swq->flushing, 0);
+	swq->nr_hw_queues = clamp_t(unsigned int, nr_hw_queues, 1,
+				    num_possible_cpus());
+
+	swq->ctx = alloc_percpu(struct blk_swq_ctx);
+	if (!swq->ctx)
+		goto err_free;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_swq_ctx *ctx = per_cpu_ptr(swq->ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		bio_list_init(&ctx->bios);
+	}
+
+	swq->hw_ctx = kcalloc(swq->nr_hw_queues, sizeof(*swq->hw_ctx),
+			      GFP_KERNEL);
+	if (!swq->hw_ctx)
+		goto err_percpu;
+
+	for (i = 0; i < swq->nr_hw_queues; i++) {
+		struct blk_swq_hw_ctx *hctx = &swq->hw_ctx[i];
+
+		hctx->swq = swq;
+		hctx->index = i;
+		INIT_WORK(&hctx->run_work, blk_swq_run_work);
+		bio_list_init(&hctx->dispatch);
+
+		if (!queue_depth)
+			continue;
+
+		hctx->queue_depth = queue_depth;
+		hctx->tag_map = kcalloc(BITS_TO_LONGS(queue_depth),
+					sizeof(unsigned long), GFP_KERNEL);
+		hctx->tag_bios = kcalloc(queue_depth, sizeof(struct bio *),
+					 GFP_KERNEL);
+		if (!hctx->tag_map || !hctx->tag_bios)
+			goto err_hw_ctx;
+	}
+
+	swq->wq = alloc_workqueue("%s", WQ_NON_REENTRANT | WQ_MEM_RECLAIM |
+				  WQ_HIGHPRI, swq->nr_hw_queues, name);
+	if (!swq->wq)
+		goto err_hw_ctx;
+
+	return swq;
+
+err_hw_ctx:
+	blk_swq_free_hw_ctx(swq);
+err_percpu:
+	free_percpu(swq->ctx);
+err_free:
+	kfree(swq);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_swq_init);
+
+/**
+ * blk_swq_free - Tear down software queues
+ * @swq:	the software queue set
+ *
+ * Description:
+ *     No bios may be staged or in flight any more.
+ **/
+void blk_swq_free(struct blk_swq *swq)
+{
+	destroy_workqueue(swq->wq);
+	blk_swq_free_hw_ctx(swq);
+	free_percpu(swq->ctx);
+	kfree(swq);
+}
+EXPORT_SYMBOL(blk_swq_free);
@@ -144,6 +144,9 @@ void blk_queue_congestion_threshold(struct request_queue *q);
 
 int blk_dev_init(void);
 
+ssize_t blk_poll_stat_show(struct request_queue *q, char *page);
+void blk_poll_stat_reset(struct request_queue *q);
+
 void elv_quiesce_start(struct request_queue *q);
 void elv_quiesce_end(struct request_queue *q);
 
@@ -26,6 +26,8 @@
 #include <linux/compiler.h>
 #include <linux/blktrace_api.h>
 #include <linux/hrtimer.h>
+#include <linux/rcupdate.h>
+#include "blk-cgroup.h"
 
 /*
  * enum row_queue_prio - Priorities of the ROW queues
@@ -99,6 +101,28 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 5
 
+/*
+ * Read queues whose average wait for dispatch exceeds the target get their
+ * quantum doubled at the end of a dispatch cycle, up to
+ * 2^ROW_MAX_QUANTUM_BOOST times the configured value. The boost is undone
+ * again once the wait drops below half the target.
+ */
+#define ROW_READ_LAT_TARGET_USEC	20000
+#define ROW_MAX_QUANTUM_BOOST		3
+
+/*
+ * Requests from blkio cgroups with a weight at or below this value are
+ * served from the LOW priority queues. See row_cgroup_ioprio_class().
+ */
+#define ROW_CGROUP_BG_WEIGHT		100
+
+/*
+ * Completion latency histogram: bucket i counts requests that took less than
+ * ROW_LAT_BUCKET_USEC << i usec, the last bucket counts all the slower ones.
+ */
+#define ROW_LAT_BUCKETS			10
+#define ROW_LAT_BUCKET_USEC		250
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -121,6 +145,12 @@ struct rowq_idling_data {
  * @nr_req:		number of requests in queue
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
+ * @quantum_boost:	log2 of the factor @disp_quantum is currently
+ *			scaled by, see row_adapt_quantum()
+ * @wait_ewma_us:	moving average of the time READ requests waited
+ *			in this queue before being dispatched (usec)
+ * @lat_hist:		histogram of the insert to completion latency
+ *			of the requests served from this queue
  * @idle_data:		data for idling on queues
  *
  */
@@ -134,6 +164,10 @@ struct row_queue {
 	unsigned int		nr_req;
 	int			disp_quantum;
 
+	unsigned int		quantum_boost;
+	unsigned int		wait_ewma_us;
+	unsigned int		lat_hist[ROW_LAT_BUCKETS];
+
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
 };
@@ -187,6 +221,12 @@ struct starvation_data {
  * @reg_prio_starvation: starvation data for REGULAR priority queues
  * @low_prio_starvation: starvation data for LOW priority queues
  * @cycle_flags:	used for marking unserved queueus
+ * @read_lat_target_us:	READ dispatch wait the read queue quanta are
+ *			adapted to (usec). 0 disables the adaptation
+ * @cgroup_bg_weight:	blkio cgroup weight at or below which requests are
+ *			served as LOW priority. 0 disables the mapping
+ * @cgroup_fg_weight:	blkio cgroup weight at or above which requests are
+ *			served as HIGH priority. 0 disables the mapping
  *
  */
 struct row_data {
@@ -206,9 +246,16 @@ struct row_data {
 	struct starvation_data		low_prio_starvation;
 
 	unsigned int			cycle_flags;
+
+	int				read_lat_target_us;
+	int				cgroup_bg_weight;
+	int				cgroup_fg_weight;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elv.priv[0]))
+/* Time (usec, truncated to 32 bits) the request was added to the scheduler */
+#define RQ_ROW_TIME(rq) ((u32)(unsigned long)((rq)->elv.priv[1]))
+#define RQ_SET_ROW_TIME(rq, t) ((rq)->elv.priv[1] = (void *)(unsigned long)(t))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -234,6 +281,19 @@ static inline int row_rowq_unserved(struct row_data *rd,
 	return rd->cycle_flags & (1 << qnum);
 }
 
+static inline u32 row_now_us(void)
+{
+	return (u32)ktime_to_us(ktime_get());
+}
+
+/* Number of requests @rqueue may dispatch in the current cycle */
+static inline int row_rowq_quantum(struct row_queue *rqueue)
+{
+	if (rqueue->disp_quantum > (INT_MAX >> rqueue->quantum_boost))
+		return INT_MAX;
+	return rqueue->disp_quantum << rqueue->quantum_boost;
+}
+
 static inline void __maybe_unused row_dump_queues_stat(struct row_data *rd)
 {
 	int i;
@@ -336,6 +396,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	RQ_SET_ROW_TIME(rq, row_now_us());
 
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(1);
@@ -449,10 +510,32 @@ static int row_reinsert_req(struct request_queue *q,
 	return 0;
 }
 
+/*
+ * row_account_latency() - Account the insert to completion latency of @rq
+ *			    in the histogram of the queue it was served from
+ */
+static void row_account_latency(struct request *rq)
+{
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	u32 lat_us;
+	int bucket;
+
+	if (!rqueue)
+		return;
+
+	lat_us = row_now_us() - RQ_ROW_TIME(rq);
+	bucket = fls(lat_us / ROW_LAT_BUCKET_USEC);
+	if (bucket >= ROW_LAT_BUCKETS)
+		bucket = ROW_LAT_BUCKETS - 1;
+	rqueue->lat_hist[bucket]++;
+}
+
 static void row_completed_req(struct request_queue *q, struct request *rq)
 {
 	struct row_data *rd = q->elevator->elevator_data;
 
+	row_account_latency(rq);
+
 	 if (rq->cmd_flags & REQ_URGENT) {
 		if (!rd->urgent_in_flight) {
 			WARN_ON(1);
@@ -523,6 +606,13 @@ static void row_dispatch_insert(struct row_data *rd, struct request *rq)
 {
 	struct row_queue *rqueue = RQ_ROWQ(rq);
 
+	if (rq_data_dir(rq) == READ) {
+		u32 wait_us = min_t(u32, row_now_us() - RQ_ROW_TIME(rq),
+				    USEC_PER_SEC);
+
+		rqueue->wait_ewma_us = (rqueue->wait_ewma_us * 7 + wait_us) / 8;
+	}
+
 	row_remove_request(rd, rq);
 	elv_dispatch_sort(rd->dispatch_queue, rq);
 	if (rq->cmd_flags & REQ_URGENT) {
@@ -654,6 +744,36 @@ done:
 	return ret;
 }
 
+/*
+ * row_adapt_quantum() - Scale the quantum of @rqueue by its dispatch wait
+ * @rd:		pointer to struct row_data
+ * @rqueue:	queue whose dispatch cycle ended
+ *
+ * Only READ requests feed wait_ewma_us, so write queues always stay at
+ * their configured quantum.
+ */
+static void row_adapt_quantum(struct row_data *rd, struct row_queue *rqueue)
+{
+	unsigned int target = rd->read_lat_target_us;
+
+	if (!target) {
+		rqueue->quantum_boost = 0;
+		return;
+	}
+
+	if (rqueue->wait_ewma_us > target &&
+	    rqueue->quantum_boost < ROW_MAX_QUANTUM_BOOST) {
+		rqueue->quantum_boost++;
+		row_log_rowq(rd, rqueue->prio, "wait %uus, quantum up to %d",
+			rqueue->wait_ewma_us, row_rowq_quantum(rqueue));
+	} else if (rqueue->wait_ewma_us < target / 2 &&
+		   rqueue->quantum_boost) {
+		rqueue->quantum_boost--;
+		row_log_rowq(rd, rqueue->prio, "wait %uus, quantum down to %d",
+			rqueue->wait_ewma_us, row_rowq_quantum(rqueue));
+	}
+}
+
 static void row_restart_cycle(struct row_data *rd,
 				int start_idx, int end_idx)
 {
@@ -662,9 +782,10 @@ static void row_restart_cycle(struct row_data *rd,
 	row_dump_queues_stat(rd);
 	for (i = start_idx; i < end_idx; i++) {
 		if (rd->row_queues[i].nr_dispatched <
-		    rd->row_queues[i].disp_quantum)
+		    row_rowq_quantum(&rd->row_queues[i]))
 			row_mark_rowq_unserved(rd, i);
 		rd->row_queues[i].nr_dispatched = 0;
+		row_adapt_quantum(rd, &rd->row_queues[i]);
 	}
 	row_log(rd->dispatch_queue, "Restarting cycle for class @ %d-%d",
 		start_idx, end_idx);
@@ -690,7 +811,7 @@ static int row_get_next_queue(struct request_queue *q, struct row_data *rd,
 	do {
 		if (list_empty(&rd->row_queues[i].fifo) ||
 		    rd->row_queues[i].nr_dispatched >=
-		    rd->row_queues[i].disp_quantum) {
+		    row_rowq_quantum(&rd->row_queues[i])) {
 			i++;
 			if (i == end_idx && restart) {
 				/* Restart cycle for this priority class */
@@ -808,6 +929,8 @@ static void *row_init_queue(struct request_queue *q)
 			ROW_REG_STARVATION_TOLLERANCE;
 	rdata->low_prio_starvation.starvation_limit =
 			ROW_LOW_STARVATION_TOLLERANCE;
+	rdata->read_lat_target_us = ROW_READ_LAT_TARGET_USEC;
+	rdata->cgroup_bg_weight = ROW_CGROUP_BG_WEIGHT;
 	/*
 	 * Currently idling is enabled only for READ queues. If we want to
 	 * enable it for write queues also, note that idling frequency will
@@ -858,6 +981,9 @@ static void row_merged_requests(struct request_queue *q, struct request *rq,
 
 	list_del_init(&next->queuelist);
 	rqueue->nr_req--;
+	/* Account the merged request from the older of the two */
+	if ((s32)(RQ_ROW_TIME(next) - RQ_ROW_TIME(rq)) < 0)
+		RQ_SET_ROW_TIME(rq, RQ_ROW_TIME(next));
 	if (rqueue->rdata->pending_urgent_rq == next) {
 		pr_err("\n\nROW_WARNING: merging pending urgent!");
 		rqueue->rdata->pending_urgent_rq = rq;
@@ -868,6 +994,43 @@ static void row_merged_requests(struct request_queue *q, struct request *rq,
 	rqueue->rdata->nr_reqs[rq_data_dir(rq)]--;
 }
 
+#ifdef CONFIG_BLK_CGROUP
+/*
+ * row_cgroup_ioprio_class() - Map the submitter's blkio cgroup to an I/O
+ *				priority class
+ * @rd:			pointer to struct row_data
+ * @ioprio_class:	class to use if the cgroup is not mapped
+ *
+ * Lets a background cgroup (low blkio.weight) be served after foreground
+ * requests of the same kind instead of competing with them in the REGULAR
+ * queues, and a foreground cgroup (high blkio.weight) be served before them.
+ * Called in the context of the submitting task.
+ */
+static int row_cgroup_ioprio_class(struct row_data *rd, int ioprio_class)
+{
+	unsigned int weight;
+
+	if (!rd->cgroup_bg_weight && !rd->cgroup_fg_weight)
+		return ioprio_class;
+
+	rcu_read_lock();
+	weight = task_blkio_cgroup(current)->weight;
+	rcu_read_unlock();
+
+	if (rd->cgroup_bg_weight && weight <= rd->cgroup_bg_weight)
+		return IOPRIO_CLASS_IDLE;
+	if (rd->cgroup_fg_weight && weight >= rd->cgroup_fg_weight)
+		return IOPRIO_CLASS_RT;
+	return ioprio_class;
+}
+#else
+static inline int row_cgroup_ioprio_class(struct row_data *rd,
+					  int ioprio_class)
+{
+	return ioprio_class;
+}
+#endif
+
 /*
  * row_get_queue_prio() - Get queue priority for a given request
  *
@@ -884,6 +1047,15 @@ static enum row_queue_prio row_get_queue_prio(struct request *rq,
 	enum row_queue_prio q_type = ROWQ_MAX_PRIO;
 	int ioprio_class = IOPRIO_PRIO_CLASS(rq->elv.icq->ioc->ioprio);
 
+	/*
+	 * An explicit RT/IDLE ioprio wins over the cgroup. Async writes are
+	 * issued by the flusher on behalf of everyone, so they stay REGULAR.
+	 */
+	if ((ioprio_class == IOPRIO_CLASS_NONE ||
+	     ioprio_class == IOPRIO_CLASS_BE) &&
+	    (data_dir == READ || is_sync))
+		ioprio_class = row_cgroup_ioprio_class(rd, ioprio_class);
+
 	switch (ioprio_class) {
 	case IOPRIO_CLASS_RT:
 		if (data_dir == READ)
@@ -984,6 +1156,9 @@ SHOW_FUNCTION(row_reg_starv_limit_show,
 	rowd->reg_prio_starvation.starvation_limit);
 SHOW_FUNCTION(row_low_starv_limit_show,
 	rowd->low_prio_starvation.starvation_limit);
+SHOW_FUNCTION(row_read_lat_target_show, rowd->read_lat_target_us);
+SHOW_FUNCTION(row_cgroup_bg_weight_show, rowd->cgroup_bg_weight);
+SHOW_FUNCTION(row_cgroup_fg_weight_show, rowd->cgroup_fg_weight);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)			\
@@ -1030,9 +1205,67 @@ STORE_FUNCTION(row_reg_starv_limit_store,
 STORE_FUNCTION(row_low_starv_limit_store,
 			&rowd->low_prio_starvation.starvation_limit,
 			1, INT_MAX);
+STORE_FUNCTION(row_read_lat_target_store, &rowd->read_lat_target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_cgroup_bg_weight_store, &rowd->cgroup_bg_weight,
+			0, INT_MAX);
+STORE_FUNCTION(row_cgroup_fg_weight_store, &rowd->cgroup_fg_weight,
+			0, INT_MAX);
 
 #undef STORE_FUNCTION
 
+static const char * const row_queue_names[ROWQ_MAX_PRIO] = {
+	"hp_read", "hp_swrite", "rp_read", "rp_swrite", "rp_write",
+	"lp_read", "lp_swrite",
+};
+
+/*
+ * lat_hist: one line per queue with its completion latency histogram, the
+ * quantum currently in effect and the average READ dispatch wait. The
+ * header holds the upper bound of each bucket in usec.
+ * Writing anything clears the histograms.
+ */
+static ssize_t row_lat_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	ssize_t len;
+	int i, j;
+
+	len = scnprintf(page, PAGE_SIZE, "queue");
+	for (j = 0; j < ROW_LAT_BUCKETS - 1; j++)
+		len += scnprintf(page + len, PAGE_SIZE - len, " %u",
+				 ROW_LAT_BUCKET_USEC << j);
+	len += scnprintf(page + len, PAGE_SIZE - len, " inf quantum wait_us\n");
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		struct row_queue *rqueue = &rowd->row_queues[i];
+
+		len += scnprintf(page + len, PAGE_SIZE - len, "%s",
+				 row_queue_names[i]);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			len += scnprintf(page + len, PAGE_SIZE - len, " %u",
+					 rqueue->lat_hist[j]);
+		len += scnprintf(page + len, PAGE_SIZE - len, " %d %u\n",
+				 row_rowq_quantum(rqueue),
+				 rqueue->wait_ewma_us);
+	}
+
+	return len;
+}
+
+static ssize_t row_lat_hist_store(struct elevator_queue *e,
+		const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		memset(rowd->row_queues[i].lat_hist, 0,
+		       sizeof(rowd->row_queues[i].lat_hist));
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -1049,6 +1282,10 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(rd_idle_data_freq),
 	ROW_ATTR(reg_starv_limit),
 	ROW_ATTR(low_starv_limit),
+	ROW_ATTR(read_lat_target),
+	ROW_ATTR(cgroup_bg_weight),
+	ROW_ATTR(cgroup_fg_weight),
+	ROW_ATTR(lat_hist),
 	__ATTR_NULL
 };
 
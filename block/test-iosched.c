@@ -144,10 +144,34 @@ static void end_test_req(struct request *rq, int err)
 
 	test_rq->req_completed = true;
 	test_rq->req_result = err;
+	test_iosched_account_latency(test_rq);
 
 	check_test_completion();
 }
 
+/**
+ * test_iosched_account_latency() - Account the dispatch to
+ * completion latency of a test request in the latency
+ * histogram. Called by the default completion callback; tests
+ * using their own callback should call it as well.
+ * @test_rq:		the completed test request
+ */
+void test_iosched_account_latency(struct test_request *test_rq)
+{
+	u32 lat_us;
+	int bucket;
+
+	if (!ptd || !test_rq->dispatch_time.tv64)
+		return;
+
+	lat_us = ktime_to_us(ktime_sub(ktime_get(), test_rq->dispatch_time));
+	bucket = fls(lat_us / TEST_LAT_BUCKET_USEC);
+	if (bucket >= TEST_LAT_BUCKETS)
+		bucket = TEST_LAT_BUCKETS - 1;
+	ptd->lat_hist[test_rq->lat_class][bucket]++;
+}
+EXPORT_SYMBOL(test_iosched_account_latency);
+
 /**
  * test_iosched_add_unique_test_req() - Create and queue a non
  * read/write request (such as FLUSH/DISCRAD/SANITIZE).
@@ -913,6 +937,66 @@ struct dentry *test_iosched_get_debugfs_utils_root(void)
 }
 EXPORT_SYMBOL(test_iosched_get_debugfs_utils_root);
 
+static const char * const test_lat_class_names[TEST_LAT_CLASSES] = {
+	"urgent", "read", "write",
+};
+
+/*
+ * lat_hist: one line per latency class, the header holds the upper bound of
+ * each bucket in usec. Writing anything clears the histogram.
+ */
+static ssize_t test_lat_hist_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *offp)
+{
+	char *page;
+	ssize_t len;
+	int i, j;
+
+	if (!ptd)
+		return -ENODEV;
+
+	page = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	len = scnprintf(page, PAGE_SIZE, "class");
+	for (j = 0; j < TEST_LAT_BUCKETS - 1; j++)
+		len += scnprintf(page + len, PAGE_SIZE - len, " %u",
+				 TEST_LAT_BUCKET_USEC << j);
+	len += scnprintf(page + len, PAGE_SIZE - len, " inf\n");
+
+	for (i = 0; i < TEST_LAT_CLASSES; i++) {
+		len += scnprintf(page + len, PAGE_SIZE - len, "%s",
+				 test_lat_class_names[i]);
+		for (j = 0; j < TEST_LAT_BUCKETS; j++)
+			len += scnprintf(page + len, PAGE_SIZE - len, " %u",
+					 ptd->lat_hist[i][j]);
+		len += scnprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+
+	len = simple_read_from_buffer(buf, count, offp, page, len);
+	kfree(page);
+
+	return len;
+}
+
+static ssize_t test_lat_hist_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	if (!ptd)
+		return -ENODEV;
+
+	memset(ptd->lat_hist, 0, sizeof(ptd->lat_hist));
+
+	return count;
+}
+
+static const struct file_operations test_lat_hist_ops = {
+	.open = simple_open,
+	.read = test_lat_hist_read,
+	.write = test_lat_hist_write,
+};
+
 static int test_debugfs_init(struct test_data *td)
 {
 	td->debug.debug_root = debugfs_create_dir("test-iosched", NULL);
@@ -945,6 +1029,14 @@ static int test_debugfs_init(struct test_data *td)
 	if (!td->debug.start_sector)
 		goto err;
 
+	td->debug.lat_hist = debugfs_create_file("lat_hist",
+					S_IRUGO | S_IWUGO,
+					td->debug.debug_utils_root,
+					NULL,
+					&test_lat_hist_ops);
+	if (!td->debug.lat_hist)
+		goto err;
+
 	return 0;
 
 err:
@@ -1018,6 +1110,14 @@ static int test_dispatch_from(struct request_queue *q,
 		(*count)--;
 		spin_unlock_irq(&ptd->lock);
 
+		test_rq->dispatch_time = ktime_get();
+		if (rq->cmd_flags & REQ_URGENT)
+			test_rq->lat_class = TEST_LAT_URGENT;
+		else if (rq_data_dir(rq) == READ)
+			test_rq->lat_class = TEST_LAT_READ;
+		else
+			test_rq->lat_class = TEST_LAT_WRITE;
+
 		print_req(rq);
 		elv_dispatch_sort(q, rq);
 		ptd->test_info.test_byte_count += test_rq->buf_size;
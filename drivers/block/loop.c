@@ -59,6 +59,7 @@
 #include <linux/major.h>
 #include <linux/wait.h>
 #include <linux/blkdev.h>
+#include <linux/blk-swq.h>
 #include <linux/blkpg.h>
 #include <linux/init.h>
 #include <linux/swap.h>
@@ -71,11 +72,11 @@
 #include <linux/writeback.h>
 #include <linux/completion.h>
 #include <linux/highmem.h>
-#include <linux/kthread.h>
 #include <linux/splice.h>
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
+#include <linux/rcupdate.h>
 
 #include <asm/uaccess.h>
 
@@ -84,6 +85,7 @@ static DEFINE_MUTEX(loop_index_mutex);
 
 static int max_part;
 static int part_shift;
+static unsigned int hw_queues = 1;
 
 /*
  * Transfer functions
@@ -459,21 +461,15 @@ out:
 }
 
 /*
- * Add bio to back of pending list
- */
-static void loop_add_bio(struct loop_device *lo, struct bio *bio)
-{
-	bio_list_add(&lo->lo_bio_list, bio);
-}
-
-/*
- * Grab first pending buffer
+ * Bios are staged on per-cpu software queues and handled by the loop%d
+ * workqueue, to avoid blocking in our make_request_fn. The worker also does
+ * loop decrypting on reads for block backed loop, as that is too heavy to do
+ * from b_end_io context where irqs may be disabled.
+ *
+ * loop_clr_fd() sets lo_state to Lo_rundown and waits for an RCU grace
+ * period, so once that returns make_request will not stage any more bios
+ * and flushing the software queues finishes the loop.
  */
-static struct bio *loop_get_bio(struct loop_device *lo)
-{
-	return bio_list_pop(&lo->lo_bio_list);
-}
-
 static void loop_make_request(struct request_queue *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
@@ -484,131 +480,86 @@ static void loop_make_request(struct request_queue *q, struct bio *old_bio)
 
 	BUG_ON(!lo || (rw != READ && rw != WRITE));
 
-	spin_lock_irq(&lo->lo_lock);
+	rcu_read_lock();
 	if (lo->lo_state != Lo_bound)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
-	loop_add_bio(lo, old_bio);
-	wake_up(&lo->lo_event);
-	spin_unlock_irq(&lo->lo_lock);
+	blk_swq_queue_bio(lo->lo_swq, old_bio);
+	rcu_read_unlock();
 	return;
 
 out:
-	spin_unlock_irq(&lo->lo_lock);
+	rcu_read_unlock();
 	bio_io_error(old_bio);
 }
 
-struct switch_request {
-	struct file *file;
-	struct completion wait;
-};
-
-static void do_loop_switch(struct loop_device *, struct switch_request *);
-
-static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
+static int loop_queue_bio(struct blk_swq_hw_ctx *hctx, struct bio *bio,
+			  int tag)
 {
-	if (unlikely(!bio->bi_bdev)) {
-		do_loop_switch(lo, bio->bi_private);
-		bio_put(bio);
-	} else {
-		int ret = do_bio_filebacked(lo, bio);
-		bio_endio(bio, ret);
-	}
+	struct loop_device *lo = hctx->swq->driver_data;
+
+	blk_swq_end_bio(hctx, bio, tag, do_bio_filebacked(lo, bio));
+	return BLK_SWQ_OK;
 }
 
+static const struct blk_swq_ops loop_swq_ops = {
+	.queue_bio	= loop_queue_bio,
+};
+
 /*
- * worker thread that handles reads/writes to file backed loop devices,
- * to avoid blocking in our make_request_fn. it also does loop decrypting
- * on reads for block backed loop, as that is too heavy to do from
- * b_end_io context where irqs may be disabled.
- *
- * Loop explanation:  loop_clr_fd() sets lo_state to Lo_rundown before
- * calling kthread_stop().  Therefore once kthread_should_stop() is
- * true, make_request will not place any more requests.  Therefore
- * once kthread_should_stop() is true and lo_bio is NULL, we are
- * done with the loop.
+ * Let a task polling for its bio kick the dispatch work and wait for it.
+ * The file I/O itself stays in the work, so that it is not done with the
+ * credentials and limits of whichever task polls. Only called with a bio
+ * in flight, so the device cannot be torn down under us.
  */
-static int loop_thread(void *data)
+static int loop_poll(struct request_queue *q)
 {
-	struct loop_device *lo = data;
-	struct bio *bio;
-
-	set_user_nice(current, -20);
-
-	while (!kthread_should_stop() || !bio_list_empty(&lo->lo_bio_list)) {
-
-		wait_event_interruptible(lo->lo_event,
-				!bio_list_empty(&lo->lo_bio_list) ||
-				kthread_should_stop());
+	struct loop_device *lo = q->queuedata;
 
-		if (bio_list_empty(&lo->lo_bio_list))
-			continue;
-		spin_lock_irq(&lo->lo_lock);
-		bio = loop_get_bio(lo);
-		spin_unlock_irq(&lo->lo_lock);
+	return blk_swq_poll_work(lo->lo_swq);
+}
 
-		BUG_ON(!bio);
-		loop_handle_bio(lo, bio);
-	}
+/*
+ * Do the actual switch; called with the software queues quiesced
+ */
+static void do_loop_switch(struct loop_device *lo, struct file *file)
+{
+	struct file *old_file = lo->lo_backing_file;
+	struct address_space *mapping = file->f_mapping;
 
-	return 0;
+	mapping_set_gfp_mask(old_file->f_mapping, lo->old_gfp_mask);
+	lo->lo_backing_file = file;
+	lo->lo_blocksize = S_ISBLK(mapping->host->i_mode) ?
+		mapping->host->i_bdev->bd_block_size : PAGE_SIZE;
+	lo->old_gfp_mask = mapping_gfp_mask(mapping);
+	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 }
 
 /*
  * loop_switch performs the hard work of switching a backing store.
- * First it needs to flush existing IO, it does this by sending a magic
- * BIO down the pipe. The completion of this BIO does the actual switch.
+ * Dispatching is stopped while the file is swapped; bios arriving
+ * meanwhile stay staged and go to the new file.
  */
 static int loop_switch(struct loop_device *lo, struct file *file)
 {
-	struct switch_request w;
-	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
-	if (!bio)
-		return -ENOMEM;
-	init_completion(&w.wait);
-	w.file = file;
-	bio->bi_private = &w;
-	bio->bi_bdev = NULL;
-	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
+	blk_swq_quiesce(lo->lo_swq);
+	do_loop_switch(lo, file);
+	blk_swq_resume(lo->lo_swq);
 	return 0;
 }
 
 /*
- * Helper to flush the IOs in loop, but keeping loop thread running
+ * Helper to flush the IOs in loop, but keeping the loop workqueue running
  */
 static int loop_flush(struct loop_device *lo)
 {
-	/* loop not yet configured, no running thread, nothing to flush */
-	if (!lo->lo_thread)
+	/* loop not yet configured, no software queues, nothing to flush */
+	if (!lo->lo_swq)
 		return 0;
 
-	return loop_switch(lo, NULL);
-}
-
-/*
- * Do the actual switch; called from the BIO completion routine
- */
-static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
-{
-	struct file *file = p->file;
-	struct file *old_file = lo->lo_backing_file;
-	struct address_space *mapping;
-
-	/* if no new file, only flush of queued bios requested */
-	if (!file)
-		goto out;
-
-	mapping = file->f_mapping;
-	mapping_set_gfp_mask(old_file->f_mapping, lo->old_gfp_mask);
-	lo->lo_backing_file = file;
-	lo->lo_blocksize = S_ISBLK(mapping->host->i_mode) ?
-		mapping->host->i_bdev->bd_block_size : PAGE_SIZE;
-	lo->old_gfp_mask = mapping_gfp_mask(mapping);
-	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
-out:
-	complete(&p->wait);
+	blk_swq_flush(lo->lo_swq);
+	return 0;
 }
 
 
@@ -814,6 +765,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	int		lo_flags = 0;
 	int		error;
 	loff_t		size;
+	char		name[16];
 
 	/* This is safe, since we have a reference from open(). */
 	__module_get(THIS_MODULE);
@@ -876,13 +828,12 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 
-	bio_list_init(&lo->lo_bio_list);
-
 	/*
 	 * set queue make_request_fn, and add limits based on lower level
 	 * device
 	 */
 	blk_queue_make_request(lo->lo_queue, loop_make_request);
+	blk_queue_poll(lo->lo_queue, loop_poll);
 	lo->lo_queue->queuedata = lo;
 
 	if (!(lo_flags & LO_FLAGS_READ_ONLY) && file->f_op->fsync)
@@ -896,14 +847,13 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 	set_blocksize(bdev, lo_blocksize);
 
-	lo->lo_thread = kthread_create(loop_thread, lo, "loop%d",
-						lo->lo_number);
-	if (IS_ERR(lo->lo_thread)) {
-		error = PTR_ERR(lo->lo_thread);
+	snprintf(name, sizeof(name), "loop%d", lo->lo_number);
+	lo->lo_swq = blk_swq_init(&loop_swq_ops, hw_queues, 0, name, lo);
+	if (!lo->lo_swq) {
+		error = -ENOMEM;
 		goto out_clr;
 	}
 	lo->lo_state = Lo_bound;
-	wake_up_process(lo->lo_thread);
 	if (part_shift)
 		lo->lo_flags |= LO_FLAGS_PARTSCAN;
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
@@ -917,7 +867,6 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 out_clr:
 	loop_sysfs_exit(lo);
-	lo->lo_thread = NULL;
 	lo->lo_device = NULL;
 	lo->lo_backing_file = NULL;
 	lo->lo_flags = 0;
@@ -991,7 +940,10 @@ static int loop_clr_fd(struct loop_device *lo)
 	lo->lo_state = Lo_rundown;
 	spin_unlock_irq(&lo->lo_lock);
 
-	kthread_stop(lo->lo_thread);
+	synchronize_rcu();
+	blk_swq_flush(lo->lo_swq);
+	blk_swq_free(lo->lo_swq);
+	lo->lo_swq = NULL;
 
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_backing_file = NULL;
@@ -1005,7 +957,6 @@ static int loop_clr_fd(struct loop_device *lo)
 	lo->lo_offset = 0;
 	lo->lo_sizelimit = 0;
 	lo->lo_encrypt_key_size = 0;
-	lo->lo_thread = NULL;
 	memset(lo->lo_encrypt_key, 0, LO_KEY_SIZE);
 	memset(lo->lo_crypt_name, 0, LO_NAME_SIZE);
 	memset(lo->lo_file_name, 0, LO_NAME_SIZE);
@@ -1517,7 +1468,7 @@ static int lo_release(struct gendisk *disk, fmode_t mode)
 
 	if (lo->lo_flags & LO_FLAGS_AUTOCLEAR) {
 		/*
-		 * In autoclear mode, stop the loop thread
+		 * In autoclear mode, stop the loop workqueue
 		 * and remove configuration after last close.
 		 */
 		err = loop_clr_fd(lo);
@@ -1525,8 +1476,8 @@ static int lo_release(struct gendisk *disk, fmode_t mode)
 			goto out_unlocked;
 	} else {
 		/*
-		 * Otherwise keep thread (if running) and config,
-		 * but flush possible ongoing bios in thread.
+		 * Otherwise keep the workqueue (if running) and
+		 * config, but flush possible ongoing bios.
 		 */
 		loop_flush(lo);
 	}
@@ -1555,6 +1506,8 @@ module_param(max_loop, int, S_IRUGO);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(hw_queues, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(hw_queues, "Number of dispatch contexts of a loop device");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1665,8 +1618,7 @@ static int loop_add(struct loop_device **l, int i)
 	disk->flags |= GENHD_FL_EXT_DEVT;
 	mutex_init(&lo->lo_ctl_mutex);
 	lo->lo_number		= i;
-	lo->lo_thread		= NULL;
-	init_waitqueue_head(&lo->lo_event);
+	lo->lo_swq		= NULL;
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
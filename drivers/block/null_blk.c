@@ -0,0 +1,267 @@
+/*
+ * Null block device driver.
+ *
+ * Completes every bio or request without touching any data, so that the
+ * overhead of the block layer submission paths can be measured on its own:
+ *
+ *   queue_mode=0	bio based, bios are ended from make_request
+ *   queue_mode=1	request based, through the elevator and queue_lock
+ *   queue_mode=2	bio based on per-cpu software queues (blk_swq) with
+ *			submit_queues dispatch contexts of hw_queue_depth
+ *			tags each
+ *
+ * For example, compare
+ *   fio --name=iops --filename=/dev/nullb0 --direct=1 --rw=randread \
+ *	--bs=4k --ioengine=libaio --iodepth=32 --numjobs=<nr cpus> \
+ *	--group_reporting --time_based --runtime=30
+ * across the three modes.
+ *
+ * In queue_mode=2 the device also supports completion polling. Enable it
+ * with
+ *   echo 1 > /sys/block/nullb0/queue/io_poll
+ * and compare the completion latency percentiles of
+ *   ionice -c1 fio --name=lat --filename=/dev/nullb0 --direct=1 \
+ *	--rw=randread --bs=4k --ioengine=psync --runtime=30 --time_based
+ * with io_poll at 0 and 1, and io_poll_delay at -1 (spin) and 0 (hybrid).
+ * io_poll_stats shows what the pollers saw.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/blk-swq.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
+
+enum {
+	NULL_Q_BIO	= 0,
+	NULL_Q_RQ	= 1,
+	NULL_Q_SWQ	= 2,
+};
+
+struct nullb {
+	struct list_head	list;
+	unsigned int		index;
+	struct request_queue	*q;
+	struct gendisk		*disk;
+	struct blk_swq		*swq;
+	spinlock_t		lock;
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+static int queue_mode = NULL_Q_SWQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "0: bio based, 1: request based, 2: software queues");
+
+static unsigned int submit_queues;
+module_param(submit_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Dispatch contexts in queue_mode=2, default one per cpu");
+
+static unsigned int hw_queue_depth = 64;
+module_param(hw_queue_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Tags per dispatch context in queue_mode=2");
+
+static unsigned int nr_devices = 1;
+module_param(nr_devices, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static unsigned int gb = 250;
+module_param(gb, uint, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static unsigned int bs = 512;
+module_param(bs, uint, S_IRUGO);
+MODULE_PARM_DESC(bs, "Logical block size in bytes");
+
+static void null_make_request(struct request_queue *q, struct bio *bio)
+{
+	bio_endio(bio, 0);
+}
+
+static void null_swq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct nullb *nullb = q->queuedata;
+
+	blk_swq_queue_bio(nullb->swq, bio);
+}
+
+static int null_queue_bio(struct blk_swq_hw_ctx *hctx, struct bio *bio,
+			  int tag)
+{
+	blk_swq_end_bio(hctx, bio, tag, 0);
+	return BLK_SWQ_OK;
+}
+
+static const struct blk_swq_ops null_swq_ops = {
+	.queue_bio	= null_queue_bio,
+};
+
+static int null_poll(struct request_queue *q)
+{
+	struct nullb *nullb = q->queuedata;
+
+	return blk_swq_poll(nullb->swq);
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL)
+		__blk_end_request_all(rq, 0);
+}
+
+static int null_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static int null_release(struct gendisk *disk, fmode_t mode)
+{
+	return 0;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+	.open		= null_open,
+	.release	= null_release,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	if (nullb->swq)
+		blk_swq_free(nullb->swq);
+	put_disk(nullb->disk);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	char name[16];
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+
+	switch (queue_mode) {
+	case NULL_Q_RQ:
+		nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+		break;
+	case NULL_Q_SWQ:
+		snprintf(name, sizeof(name), "nullb%u", index);
+		nullb->swq = blk_swq_init(&null_swq_ops,
+					  submit_queues ?: nr_cpu_ids,
+					  hw_queue_depth, name, nullb);
+		if (!nullb->swq)
+			goto out_free;
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (nullb->q) {
+			blk_queue_make_request(nullb->q,
+					       null_swq_make_request);
+			blk_queue_poll(nullb->q, null_poll);
+		}
+		break;
+	default:
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_make_request);
+		break;
+	}
+	if (!nullb->q)
+		goto out_free_swq;
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup_queue;
+
+	disk->flags |= GENHD_FL_EXT_DEVT;
+	disk->major		= null_major;
+	disk->first_minor	= index;
+	disk->fops		= &null_fops;
+	disk->private_data	= nullb;
+	disk->queue		= nullb->q;
+	sprintf(disk->disk_name, "nullb%u", index);
+	set_capacity(disk, (sector_t)gb * 1024 * 1024 * 1024 >> 9);
+
+	list_add_tail(&nullb->list, &nullb_list);
+	add_disk(disk);
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(nullb->q);
+out_free_swq:
+	if (nullb->swq)
+		blk_swq_free(nullb->swq);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_SWQ) {
+		pr_warn("null_blk: invalid queue_mode %d, using bio mode\n",
+			queue_mode);
+		queue_mode = NULL_Q_BIO;
+	}
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs))
+		bs = 512;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		ret = null_add_dev(i);
+		if (ret) {
+			struct nullb *nullb, *next;
+
+			list_for_each_entry_safe(nullb, next, &nullb_list, list)
+				null_del_dev(nullb);
+			unregister_blkdev(null_major, "nullb");
+			return ret;
+		}
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb, *next;
+
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Null block device driver");
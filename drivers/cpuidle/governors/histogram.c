@@ -0,0 +1,312 @@
+/*
+ * histogram.c - the wakeup histogram idle governor
+ *
+ * This code is licenced under the GPL version 2 as described
+ * in the COPYING file that acompanies the Linux Kernel.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/tick.h>
+#include <linux/sched.h>
+#include <linux/kernel_stat.h>
+#include <linux/module.h>
+
+#define HIST_BUCKETS	20	/* log2 buckets of microseconds, up to ~1s */
+#define HIST_MAX_TOTAL	1024	/* halve all counts once this many samples */
+#define TIMER_SLACK_US	20
+
+/*
+ * Concepts behind the histogram governor
+ *
+ * The next timer event gives a hard upper bound on the idle duration;
+ * anything that ends the idle period earlier is an interrupt of some
+ * kind. Rather than scaling the timer horizon with a correction factor
+ * (as menu does), this governor keeps a per-cpu histogram of observed
+ * idle durations, split by what woke the cpu up:
+ *
+ *  - TIMER: the cpu slept until (about) the programmed timer event.
+ *  - IRQ:   the cpu woke earlier and a device interrupt was serviced.
+ *  - IPI:   the cpu woke earlier without a device interrupt, which on
+ *           this architecture means an inter-processor interrupt.
+ *
+ * At selection time the early (IRQ and IPI) wakeups that fall below the
+ * current timer horizon form the distribution of short idle periods;
+ * the remaining probability mass sleeps until the timer. Every allowed
+ * state is then scored by its expected energy over that distribution,
+ * using a break-even model derived from the state's power_usage and
+ * target_residency:
+ *
+ *   E(s, d) = P0 * Ts                     if d <  Ts
+ *   E(s, d) = Ps * d + (P0 - Ps) * Ts     if d >= Ts
+ *
+ * where P0 is the power of the shallowest state. A deep state only wins
+ * if enough of the distribution lies beyond its target residency, so a
+ * bursty IRQ source pulls the choice towards shallow states, while a
+ * quiet cpu with a distant timer goes deep even if the last few
+ * intervals were short.
+ */
+
+enum hist_source {
+	HIST_TIMER,
+	HIST_IRQ,
+	HIST_IPI,
+	HIST_SOURCES,
+};
+
+struct hist_device {
+	int		last_state_idx;
+	int		needs_update;
+
+	unsigned int	expected_us;
+	unsigned int	exit_us;
+	unsigned int	irqs_at_entry;
+	unsigned int	irqs_at_exit;
+	unsigned int	total;
+	unsigned int	count[HIST_SOURCES][HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct hist_device, hist_devices);
+
+static void hist_update(struct cpuidle_driver *drv, struct cpuidle_device *dev);
+
+static inline int hist_bucket(unsigned int duration_us)
+{
+	int bucket = fls(duration_us);
+
+	return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+/* Representative duration of a bucket: the middle of [2^(b-1), 2^b) */
+static inline unsigned int hist_bucket_us(int bucket)
+{
+	if (bucket == 0)
+		return 0;
+
+	return (3U << bucket) >> 2;
+}
+
+static inline int performance_multiplier(void)
+{
+	return 1 + 10 * nr_iowait_cpu(smp_processor_id());
+}
+
+/*
+ * Expected energy, in arbitrary units, of entering state @s for the
+ * given idle durations. @p0 and @ps are the relative powers of the
+ * shallowest state and of @s.
+ */
+static u64 hist_energy(u64 ps, u64 p0, unsigned int target_us,
+		       unsigned int duration_us)
+{
+	if (duration_us < target_us)
+		return p0 * target_us;
+
+	return ps * duration_us + (p0 - ps) * target_us;
+}
+
+static u64 hist_expected_energy(struct hist_device *data,
+				struct cpuidle_state *s, u64 ps, u64 p0)
+{
+	unsigned int timer_weight = data->total ? : 1;
+	u64 energy = 0;
+	int src, b;
+
+	for (src = HIST_IRQ; src < HIST_SOURCES; src++) {
+		for (b = 0; b < HIST_BUCKETS; b++) {
+			unsigned int n = data->count[src][b];
+			unsigned int d = hist_bucket_us(b);
+
+			if (!n || d >= data->expected_us)
+				continue;
+
+			energy += n *
+				hist_energy(ps, p0, s->target_residency, d);
+			timer_weight -= n;
+		}
+	}
+
+	/* everything else is expected to sleep until the next timer */
+	energy += (u64)timer_weight *
+		hist_energy(ps, p0, s->target_residency, data->expected_us);
+
+	return energy;
+}
+
+/**
+ * hist_select - selects the next idle state to enter
+ * @drv: cpuidle driver containing state data
+ * @dev: the CPU
+ */
+static int hist_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct hist_device *data = &__get_cpu_var(hist_devices);
+	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	int min_power = INT_MAX;
+	u64 best = ULLONG_MAX;
+	u64 p0;
+	int multiplier;
+	int i;
+	struct timespec t;
+
+	if (data->needs_update) {
+		hist_update(drv, dev);
+		data->needs_update = 0;
+	}
+
+	data->last_state_idx = 0;
+	data->exit_us = 0;
+
+	/* Special case when user has set very strict latency requirement */
+	if (unlikely(latency_req == 0))
+		return 0;
+
+	t = ktime_to_timespec(tick_nohz_get_sleep_length());
+	data->expected_us =
+		t.tv_sec * USEC_PER_SEC + t.tv_nsec / NSEC_PER_USEC;
+	data->irqs_at_entry = kstat_cpu_irqs_sum(dev->cpu);
+
+	if (data->expected_us > 5 &&
+		drv->states[CPUIDLE_DRIVER_STATE_START].disable == 0)
+		data->last_state_idx = CPUIDLE_DRIVER_STATE_START;
+
+	multiplier = performance_multiplier();
+
+	for (i = CPUIDLE_DRIVER_STATE_START; i < drv->state_count; i++)
+		min_power = min(min_power, drv->states[i].power_usage);
+	p0 = drv->states[CPUIDLE_DRIVER_STATE_START].power_usage - min_power + 1;
+
+	for (i = CPUIDLE_DRIVER_STATE_START; i < drv->state_count; i++) {
+		struct cpuidle_state *s = &drv->states[i];
+		u64 ps, energy;
+
+		if (s->disable)
+			continue;
+		if (s->exit_latency > latency_req)
+			continue;
+		if (s->exit_latency * multiplier > data->expected_us)
+			continue;
+
+		ps = s->power_usage - min_power + 1;
+		if (ps > p0)
+			continue;
+
+		energy = hist_expected_energy(data, s, ps, p0);
+		if (energy <= best) {
+			best = energy;
+			data->last_state_idx = i;
+			data->exit_us = s->exit_latency;
+		}
+	}
+
+	return data->last_state_idx;
+}
+
+/**
+ * hist_reflect - records that data structures need update
+ * @dev: the CPU
+ * @index: the index of actual entered state
+ *
+ * Interrupts have been re-enabled by the time we get here, so the
+ * interrupt that ended the idle period has already been accounted.
+ */
+static void hist_reflect(struct cpuidle_device *dev, int index)
+{
+	struct hist_device *data = &__get_cpu_var(hist_devices);
+
+	data->last_state_idx = index;
+	if (index >= 0) {
+		data->irqs_at_exit = kstat_cpu_irqs_sum(dev->cpu);
+		data->needs_update = 1;
+	}
+}
+
+/**
+ * hist_update - classifies the last wakeup and records its duration
+ * @drv: cpuidle driver containing state data
+ * @dev: the CPU
+ */
+static void hist_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct hist_device *data = &__get_cpu_var(hist_devices);
+	struct cpuidle_state *target = &drv->states[data->last_state_idx];
+	unsigned int measured_us = cpuidle_get_last_residency(dev);
+	enum hist_source src;
+	int s, b;
+
+	/* without residency measurements assume the timer woke us */
+	if (unlikely(!(target->flags & CPUIDLE_FLAG_TIME_VALID)))
+		measured_us = data->expected_us;
+
+	if (measured_us > data->exit_us)
+		measured_us -= data->exit_us;
+
+	if (measured_us + TIMER_SLACK_US + (data->expected_us >> 3) >=
+	    data->expected_us)
+		src = HIST_TIMER;
+	else if (data->irqs_at_exit != data->irqs_at_entry)
+		src = HIST_IRQ;
+	else
+		src = HIST_IPI;
+
+	data->count[src][hist_bucket(measured_us)]++;
+
+	/* age the history so that it follows changes in behaviour */
+	if (++data->total >= HIST_MAX_TOTAL) {
+		data->total = 0;
+		for (s = 0; s < HIST_SOURCES; s++) {
+			for (b = 0; b < HIST_BUCKETS; b++) {
+				data->count[s][b] >>= 1;
+				data->total += data->count[s][b];
+			}
+		}
+	}
+}
+
+/**
+ * hist_enable_device - scans a CPU's states and does setup
+ * @drv: cpuidle driver
+ * @dev: the CPU
+ */
+static int hist_enable_device(struct cpuidle_driver *drv,
+				struct cpuidle_device *dev)
+{
+	struct hist_device *data = &per_cpu(hist_devices, dev->cpu);
+
+	memset(data, 0, sizeof(struct hist_device));
+
+	return 0;
+}
+
+static struct cpuidle_governor hist_governor = {
+	.name =		"histogram",
+	.rating =	15,
+	.enable =	hist_enable_device,
+	.select =	hist_select,
+	.reflect =	hist_reflect,
+	.owner =	THIS_MODULE,
+};
+
+/**
+ * init_hist - initializes the governor
+ */
+static int __init init_hist(void)
+{
+	return cpuidle_register_governor(&hist_governor);
+}
+
+/**
+ * exit_hist - exits the governor
+ */
+static void __exit exit_hist(void)
+{
+	cpuidle_unregister_governor(&hist_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_hist);
+module_exit(exit_hist);
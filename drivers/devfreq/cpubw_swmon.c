@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Software bandwidth monitor for the cpubw_hwmon governor. It does not
+ * need the Krait L2 PM counters, so the governor can run on targets (or
+ * emulators) without them.
+ *
+ * When use_perf is set and the perf core can provide a hardware cache
+ * miss counter on a cpu, bandwidth is derived from the misses times
+ * line_bytes. Otherwise it is estimated from each cpu's busy time and
+ * current frequency: a cpu that is busy all of a sample at 1 GHz is
+ * assumed to use mbps_per_ghz MBps.
+ *
+ * There is no overrun interrupt; the vote is only re-evaluated at the
+ * governor's polling interval.
+ */
+
+#define pr_fmt(fmt) "cpubw-swmon: " fmt
+
+#include <linux/kernel.h>
+#include <asm/sizes.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/time.h>
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/tick.h>
+#include <linux/percpu.h>
+#include <linux/perf_event.h>
+#include <linux/math64.h>
+#include "governor_bw_hwmon.h"
+
+static bool use_perf = true;
+module_param(use_perf, bool, 0644);
+
+static unsigned int line_bytes = 64;
+module_param(line_bytes, uint, 0644);
+
+static unsigned int mbps_per_ghz = 400;
+module_param(mbps_per_ghz, uint, 0644);
+
+struct swmon_cpu {
+	struct perf_event *ev;
+	u64 prev_count;
+	u64 prev_idle_us;
+	u64 prev_wall_us;
+};
+
+static DEFINE_PER_CPU(struct swmon_cpu, swmon_cpus);
+static ktime_t prev_ts;
+
+static struct perf_event_attr miss_attr = {
+	.type		= PERF_TYPE_HARDWARE,
+	.config		= PERF_COUNT_HW_CACHE_MISSES,
+	.size		= sizeof(struct perf_event_attr),
+	.pinned		= 1,
+};
+
+static u64 read_misses(struct swmon_cpu *c)
+{
+	u64 enabled, running;
+
+	return perf_event_read_value(c->ev, &enabled, &running);
+}
+
+/* Bytes transferred by @cpu since the previous sample, from perf */
+static u64 perf_bytes(struct swmon_cpu *c)
+{
+	u64 count = read_misses(c);
+	u64 delta = count - c->prev_count;
+
+	c->prev_count = count;
+	return delta * line_bytes;
+}
+
+/* Bytes estimated from busy time and frequency since the previous sample */
+static u64 busy_bytes(int cpu, struct swmon_cpu *c)
+{
+	u64 wall_us, idle_us, busy_us, mb;
+	unsigned int khz;
+
+	idle_us = get_cpu_idle_time_us(cpu, &wall_us);
+	if (idle_us == -1ULL) {
+		/* no idle accounting: treat an online cpu as fully busy */
+		wall_us = ktime_to_us(ktime_get());
+		idle_us = c->prev_idle_us;
+	}
+
+	busy_us = wall_us - c->prev_wall_us;
+	if (idle_us - c->prev_idle_us < busy_us)
+		busy_us -= idle_us - c->prev_idle_us;
+	else
+		busy_us = 0;
+
+	c->prev_wall_us = wall_us;
+	c->prev_idle_us = idle_us;
+
+	khz = cpufreq_quick_get(cpu);
+	if (!khz)
+		khz = 1000000;	/* assume 1 GHz if cpufreq is absent */
+
+	/* MB = busy_s * GHz * mbps_per_ghz, computed in millionths of MB */
+	mb = div_u64(busy_us * khz * mbps_per_ghz, USEC_PER_SEC);
+	return div_u64(mb * SZ_1M, USEC_PER_SEC);
+}
+
+static unsigned long meas_bw_and_set_irq(struct bw_hwmon *hw,
+					 unsigned int tol,
+					 unsigned int sample_ms)
+{
+	ktime_t ts;
+	unsigned int us;
+	u64 bytes = 0;
+	int cpu;
+
+	ts = ktime_get();
+	us = ktime_to_us(ktime_sub(ts, prev_ts));
+	if (!us)
+		us = 1;
+	prev_ts = ts;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct swmon_cpu *c = &per_cpu(swmon_cpus, cpu);
+
+		if (c->ev)
+			bytes += perf_bytes(c);
+		else
+			bytes += busy_bytes(cpu, c);
+	}
+	put_online_cpus();
+
+	bytes *= USEC_PER_SEC;
+	do_div(bytes, us);
+
+	return DIV_ROUND_UP_ULL(bytes, SZ_1M);
+}
+
+static int start_hwmon(struct bw_hwmon *hw, unsigned long mbps)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_possible_cpu(cpu) {
+		struct swmon_cpu *c = &per_cpu(swmon_cpus, cpu);
+		struct perf_event *ev;
+
+		c->ev = NULL;
+		c->prev_idle_us = get_cpu_idle_time_us(cpu, &c->prev_wall_us);
+		if (c->prev_idle_us == -1ULL) {
+			c->prev_idle_us = 0;
+			c->prev_wall_us = ktime_to_us(ktime_get());
+		}
+
+		if (!use_perf || !cpu_online(cpu))
+			continue;
+
+		ev = perf_event_create_kernel_counter(&miss_attr, cpu, NULL,
+						      NULL, NULL);
+		if (IS_ERR(ev)) {
+			pr_debug("no cache miss counter on cpu%d: %ld\n",
+				 cpu, PTR_ERR(ev));
+			continue;
+		}
+
+		c->ev = ev;
+		c->prev_count = read_misses(c);
+	}
+	put_online_cpus();
+
+	prev_ts = ktime_get();
+
+	return 0;
+}
+
+static void stop_hwmon(struct bw_hwmon *hw)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swmon_cpu *c = &per_cpu(swmon_cpus, cpu);
+
+		if (c->ev) {
+			perf_event_release_kernel(c->ev);
+			c->ev = NULL;
+		}
+	}
+}
+
+static struct bw_hwmon sw_hwmon = {
+	.start_hwmon = start_hwmon,
+	.stop_hwmon = stop_hwmon,
+	.meas_bw_and_set_irq = meas_bw_and_set_irq,
+	.name = "software",
+};
+
+/*
+ * Registered late so that a hardware monitor probed from the device tree
+ * takes precedence.
+ */
+static int __init cpubw_swmon_init(void)
+{
+	return register_bw_hwmon(NULL, &sw_hwmon);
+}
+late_initcall(cpubw_swmon_init);
+
+static void __exit cpubw_swmon_exit(void)
+{
+	unregister_bw_hwmon(&sw_hwmon);
+}
+module_exit(cpubw_swmon_exit);
+
+MODULE_DESCRIPTION("Software CPU DDR bandwidth monitor for cpubw_hwmon");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GOVERNOR_BW_HWMON_H
+#define _GOVERNOR_BW_HWMON_H
+
+#include <linux/kernel.h>
+#include <linux/devfreq.h>
+
+/**
+ * struct bw_hwmon - bandwidth measurement backend of the cpubw_hwmon governor
+ * @start_hwmon:		Start measuring. @mbps is the current bandwidth
+ *				vote, which backends with an overrun interrupt
+ *				use to arm their first limit.
+ * @stop_hwmon:			Stop measuring.
+ * @meas_bw_and_set_irq:	Return the MBps used since the previous call.
+ *				Backends with an overrun interrupt also arm it
+ *				to fire once @tol percent more than that is
+ *				used within @sample_ms.
+ * @name:			Backend name, for messages only.
+ * @df:				devfreq device, set by the governor while the
+ *				backend is started.
+ *
+ * A backend with an overrun interrupt calls update_bw_hwmon() from its
+ * (threaded) interrupt handler to get the vote re-evaluated right away.
+ */
+struct bw_hwmon {
+	int (*start_hwmon)(struct bw_hwmon *hw, unsigned long mbps);
+	void (*stop_hwmon)(struct bw_hwmon *hw);
+	unsigned long (*meas_bw_and_set_irq)(struct bw_hwmon *hw,
+					unsigned int tol,
+					unsigned int sample_ms);
+	const char *name;
+	struct devfreq *df;
+};
+
+extern int register_bw_hwmon(struct device *dev, struct bw_hwmon *hw);
+extern void unregister_bw_hwmon(struct bw_hwmon *hw);
+extern int update_bw_hwmon(struct bw_hwmon *hw);
+
+#endif /* _GOVERNOR_BW_HWMON_H */
@@ -14,37 +14,16 @@
 #define pr_fmt(fmt) "cpubw-hwmon: " fmt
 
 #include <linux/kernel.h>
-#include <asm/sizes.h>
 #include <linux/module.h>
 #include <linux/init.h>
-#include <linux/io.h>
-#include <linux/delay.h>
 #include <linux/ktime.h>
 #include <linux/time.h>
 #include <linux/err.h>
 #include <linux/errno.h>
 #include <linux/mutex.h>
-#include <linux/interrupt.h>
-#include <linux/platform_device.h>
-#include <linux/of.h>
 #include <linux/devfreq.h>
 #include "governor.h"
-
-#include <mach/msm-krait-l2-accessors.h>
-
-#define L2PMRESR2		0x412
-#define L2PMCR			0x400
-#define L2PMCNTENCLR		0x402
-#define L2PMCNTENSET		0x403
-#define L2PMINTENCLR		0x404
-#define L2PMINTENSET		0x405
-#define L2PMOVSR		0x406
-#define L2PMOVSSET		0x407
-#define L2PMnEVCNTCR(n)		(0x420 + n * 0x10)
-#define L2PMnEVCNTR(n)		(0x421 + n * 0x10)
-#define L2PMnEVCNTSR(n)		(0x422 + n * 0x10)
-#define L2PMnEVFILTER(n)	(0x423 + n * 0x10)
-#define L2PMnEVTYPER(n)		(0x424 + n * 0x10)
+#include "governor_bw_hwmon.h"
 
 #define show_attr(name) \
 static ssize_t show_##name(struct device *dev,				\
@@ -75,175 +54,65 @@ store_attr(__attr, min, max)		\
 static DEVICE_ATTR(__attr, 0644, show_##__attr, store_##__attr)
 
 
-static int l2pm_irq;
-static unsigned int bytes_per_beat;
 static unsigned int tolerance_percent = 10;
 static unsigned int guard_band_mbps = 70;
 static unsigned int decay_rate = 90;
 static unsigned int io_percent = 16;
 static unsigned int bw_step = 190;
+static unsigned int up_scale = 25;
+static unsigned int hist_memory = 4;
 
 #define MIN_MS	10U
 #define MAX_MS	500U
 static unsigned int sample_ms = 50;
-static u32 prev_r_start_val;
-static u32 prev_w_start_val;
 static unsigned long prev_ab;
-static ktime_t prev_ts;
-
-#define RD_MON	0
-#define WR_MON	1
-static void mon_init(void)
-{
-	/* Set up counters 0/1 to count write/read beats */
-	set_l2_indirect_reg(L2PMRESR2, 0x8B0B0000);
-	set_l2_indirect_reg(L2PMnEVCNTCR(RD_MON), 0x0);
-	set_l2_indirect_reg(L2PMnEVCNTCR(WR_MON), 0x0);
-	set_l2_indirect_reg(L2PMnEVCNTR(RD_MON), 0xFFFFFFFF);
-	set_l2_indirect_reg(L2PMnEVCNTR(WR_MON), 0xFFFFFFFF);
-	set_l2_indirect_reg(L2PMnEVFILTER(RD_MON), 0xF003F);
-	set_l2_indirect_reg(L2PMnEVFILTER(WR_MON), 0xF003F);
-	set_l2_indirect_reg(L2PMnEVTYPER(RD_MON), 0xA);
-	set_l2_indirect_reg(L2PMnEVTYPER(WR_MON), 0xB);
-}
-
-static void global_mon_enable(bool en)
-{
-	u32 regval;
-
-	/* Global counter enable */
-	regval = get_l2_indirect_reg(L2PMCR);
-	if (en)
-		regval |= BIT(0);
-	else
-		regval &= ~BIT(0);
-	set_l2_indirect_reg(L2PMCR, regval);
-}
 
-static void mon_enable(int n)
-{
-	/* Clear previous overflow state for event counter n */
-	set_l2_indirect_reg(L2PMOVSR, BIT(n));
+#define MAX_HIST	20U
+static unsigned long hist[MAX_HIST];
+static unsigned int hist_idx;
 
-	/* Enable event counter n */
-	set_l2_indirect_reg(L2PMCNTENSET, BIT(n));
-}
+static DEFINE_MUTEX(hwmon_lock);
+static struct bw_hwmon *hwmon;
 
-static void mon_disable(int n)
+/* Highest bandwidth measured over the last hist_memory samples */
+static unsigned long hist_peak(unsigned long mbps)
 {
-	/* Disable event counter n */
-	set_l2_indirect_reg(L2PMCNTENCLR, BIT(n));
-}
-
-static void mon_irq_enable(int n, bool en)
-{
-	if (en)
-		set_l2_indirect_reg(L2PMINTENSET, BIT(n));
-	else
-		set_l2_indirect_reg(L2PMINTENCLR, BIT(n));
-}
-
-/* Returns start counter value to be used with mon_get_mbps() */
-static u32 mon_set_limit_mbyte(int n, unsigned int mbytes)
-{
-	u32 regval, beats;
-
-	beats = mult_frac(mbytes, SZ_1M, bytes_per_beat);
-	regval = 0xFFFFFFFF - beats;
-	set_l2_indirect_reg(L2PMnEVCNTR(n), regval);
-	pr_debug("EV%d MB: %d, start val: %x\n", n, mbytes, regval);
-
-	return regval;
-}
-
-long mon_get_count(int n, u32 start_val)
-{
-	u32 overflow, count;
-
-	count = get_l2_indirect_reg(L2PMnEVCNTR(n));
-	overflow = get_l2_indirect_reg(L2PMOVSR);
-
-	pr_debug("EV%d ov: %x, cnt: %x\n", n, overflow, count);
-
-	if (overflow & BIT(n))
-		return 0xFFFFFFFF - start_val + count;
-	else
-		return count - start_val;
-}
-
-/* Returns MBps of read/writes for the sampling window. */
-unsigned int beats_to_mbps(long long beats, unsigned int us)
-{
-	beats *= USEC_PER_SEC;
-	beats *= bytes_per_beat;
-	do_div(beats, us);
-	beats = DIV_ROUND_UP_ULL(beats, SZ_1M);
-
-	return beats;
-}
-
-static int to_limit(int mbps)
-{
-	mbps *= (100 + tolerance_percent) * sample_ms;
-	mbps /= 100;
-	mbps = DIV_ROUND_UP(mbps, MSEC_PER_SEC);
-	return mbps;
-}
-
-unsigned long measure_bw_and_set_irq(void)
-{
-	long r_mbps, w_mbps, mbps;
-	ktime_t ts;
-	unsigned int us;
-
-	/*
-	 * Since we are stopping the counters, we don't want this short work
-	 * to be interrupted by other tasks and cause the measurements to be
-	 * wrong. Not blocking interrupts to avoid affecting interrupt
-	 * latency and since they should be short anyway because they run in
-	 * atomic context.
-	 */
-	preempt_disable();
-
-	ts = ktime_get();
-	us = ktime_to_us(ktime_sub(ts, prev_ts));
-	if (!us)
-		us = 1;
+	unsigned long peak = 0;
+	unsigned int i, n = min(hist_memory, MAX_HIST);
 
-	mon_disable(RD_MON);
-	mon_disable(WR_MON);
+	if (!n)
+		return 0;
 
-	r_mbps = mon_get_count(RD_MON, prev_r_start_val);
-	r_mbps = beats_to_mbps(r_mbps, us);
-	w_mbps = mon_get_count(WR_MON, prev_w_start_val);
-	w_mbps = beats_to_mbps(w_mbps, us);
+	hist[hist_idx] = mbps;
+	hist_idx = (hist_idx + 1) % n;
 
-	prev_r_start_val = mon_set_limit_mbyte(RD_MON, to_limit(r_mbps));
-	prev_w_start_val = mon_set_limit_mbyte(WR_MON, to_limit(w_mbps));
-	prev_ts = ts;
+	for (i = 0; i < n; i++)
+		peak = max(peak, hist[i]);
 
-	mon_enable(RD_MON);
-	mon_enable(WR_MON);
-
-	preempt_enable();
-
-	mbps = r_mbps + w_mbps;
-	pr_debug("R/W/BW/us = %ld/%ld/%ld/%d\n", r_mbps, w_mbps, mbps, us);
-
-	return mbps;
+	return peak;
 }
 
+/*
+ * Ramp up fast: when the measured bandwidth goes up, vote for it plus
+ * up_scale percent of the increase, anticipating that the trend goes on.
+ * Decay slowly: when it goes down, decay towards it at decay_rate but
+ * never below the peak of the recent history, so that periodic bursts
+ * don't have to ramp up from scratch every time.
+ */
 static void compute_bw(int mbps, unsigned long *freq, unsigned long *ab)
 {
+	unsigned long peak;
 	int new_bw;
 
 	mbps += guard_band_mbps;
+	peak = hist_peak(mbps);
 
 	if (mbps > prev_ab) {
-		new_bw = mbps;
+		new_bw = mbps + (mbps - prev_ab) * up_scale / 100;
 	} else {
 		new_bw = mbps * decay_rate + prev_ab * (100 - decay_rate);
 		new_bw /= 100;
+		new_bw = max_t(unsigned long, new_bw, peak);
 	}
 
 	prev_ab = new_bw;
@@ -251,86 +120,67 @@ static void compute_bw(int mbps, unsigned long *freq, unsigned long *ab)
 	*freq = (new_bw * 100) / io_percent;
 }
 
-#define TOO_SOON_US	(1 * USEC_PER_MSEC)
-static irqreturn_t mon_intr_handler(int irq, void *dev)
+/**
+ * update_bw_hwmon - re-evaluate the vote right away
+ * @hw: backend that saw its bandwidth limit exceeded
+ *
+ * Called by backends from their (threaded) overrun interrupt handler.
+ */
+int update_bw_hwmon(struct bw_hwmon *hw)
 {
-	struct devfreq *df = dev;
-	ktime_t ts;
-	unsigned int us;
-	u32 regval;
+	struct devfreq *df = hw->df;
 	int ret;
 
-	regval = get_l2_indirect_reg(L2PMOVSR);
-	pr_debug("Got interrupt: %x\n", regval);
+	if (!df)
+		return -ENODEV;
 
 	devfreq_monitor_stop(df);
 
-	/*
-	 * Don't recalc bandwidth if the interrupt comes right after a
-	 * previous bandwidth calculation.  This is done for two reasons:
-	 *
-	 * 1. Sampling the BW during a very short duration can result in a
-	 *    very inaccurate measurement due to very short bursts.
-	 * 2. This can only happen if the limit was hit very close to the end
-	 *    of the previous sample period. Which means the current BW
-	 *    estimate is not very off and doesn't need to be readjusted.
-	 */
-	ts = ktime_get();
-	us = ktime_to_us(ktime_sub(ts, prev_ts));
-	if (us > TOO_SOON_US) {
-		mutex_lock(&df->lock);
-		ret = update_devfreq(df);
-		if (ret)
-			pr_err("Unable to update freq on IRQ!\n");
-		mutex_unlock(&df->lock);
-	}
+	mutex_lock(&df->lock);
+	ret = update_devfreq(df);
+	mutex_unlock(&df->lock);
 
 	devfreq_monitor_start(df);
 
-	return IRQ_HANDLED;
+	return ret;
 }
+EXPORT_SYMBOL_GPL(update_bw_hwmon);
 
 static int start_monitoring(struct devfreq *df)
 {
-	int ret, mbyte;
+	unsigned long mbps;
+	int ret;
 
-	ret = request_threaded_irq(l2pm_irq, NULL, mon_intr_handler,
-			  IRQF_ONESHOT | IRQF_SHARED,
-			  "cpubw_hwmon", df);
-	if (ret) {
-		pr_err("Unable to register interrupt handler\n");
-		return ret;
+	mutex_lock(&hwmon_lock);
+	if (!hwmon) {
+		mutex_unlock(&hwmon_lock);
+		return -ENODEV;
 	}
 
-	mon_init();
-	mon_disable(RD_MON);
-	mon_disable(WR_MON);
+	mbps = (df->previous_freq * io_percent) / 100;
+	hwmon->df = df;
+	ret = hwmon->start_hwmon(hwmon, mbps);
+	if (ret) {
+		pr_err("Unable to start %s monitor\n", hwmon->name);
+		hwmon->df = NULL;
+	}
+	mutex_unlock(&hwmon_lock);
 
-	mbyte = (df->previous_freq * io_percent) / (2 * 100);
-	prev_r_start_val = mon_set_limit_mbyte(RD_MON, mbyte);
-	prev_w_start_val = mon_set_limit_mbyte(WR_MON, mbyte);
-	prev_ts = ktime_get();
 	prev_ab = 0;
+	memset(hist, 0, sizeof(hist));
+	hist_idx = 0;
 
-	mon_irq_enable(RD_MON, true);
-	mon_irq_enable(WR_MON, true);
-	mon_enable(RD_MON);
-	mon_enable(WR_MON);
-	global_mon_enable(true);
-
-	return 0;
+	return ret;
 }
 
 static void stop_monitoring(struct devfreq *df)
 {
-	global_mon_enable(false);
-	mon_disable(RD_MON);
-	mon_disable(WR_MON);
-	mon_irq_enable(RD_MON, false);
-	mon_irq_enable(WR_MON, false);
-
-	disable_irq(l2pm_irq);
-	free_irq(l2pm_irq, df);
+	mutex_lock(&hwmon_lock);
+	if (hwmon) {
+		hwmon->stop_hwmon(hwmon);
+		hwmon->df = NULL;
+	}
+	mutex_unlock(&hwmon_lock);
 }
 
 static int devfreq_cpubw_hwmon_get_freq(struct devfreq *df,
@@ -339,7 +189,7 @@ static int devfreq_cpubw_hwmon_get_freq(struct devfreq *df,
 {
 	unsigned long mbps;
 
-	mbps = measure_bw_and_set_irq();
+	mbps = hwmon->meas_bw_and_set_irq(hwmon, tolerance_percent, sample_ms);
 	compute_bw(mbps, freq, df->data);
 
 	return 0;
@@ -350,6 +200,8 @@ gov_attr(guard_band_mbps, 0U, 2000U);
 gov_attr(decay_rate, 0U, 100U);
 gov_attr(io_percent, 1U, 100U);
 gov_attr(bw_step, 50U, 1000U);
+gov_attr(up_scale, 0U, 100U);
+gov_attr(hist_memory, 0U, MAX_HIST);
 
 static struct attribute *dev_attr[] = {
 	&dev_attr_tolerance_percent.attr,
@@ -357,6 +209,8 @@ static struct attribute *dev_attr[] = {
 	&dev_attr_decay_rate.attr,
 	&dev_attr_io_percent.attr,
 	&dev_attr_bw_step.attr,
+	&dev_attr_up_scale.attr,
+	&dev_attr_hist_memory.attr,
 	NULL,
 };
 
@@ -413,58 +267,68 @@ static struct devfreq_governor devfreq_cpubw_hwmon = {
 	.event_handler = devfreq_cpubw_hwmon_ev_handler,
 };
 
-static int cpubw_hwmon_driver_probe(struct platform_device *pdev)
+/**
+ * register_bw_hwmon - register a bandwidth measurement backend
+ * @dev: device of the backend, may be NULL
+ * @hw: backend operations
+ *
+ * Only one backend can be in use at a time; the first one to register
+ * wins. The governor is added to devfreq with the first backend.
+ */
+int register_bw_hwmon(struct device *dev, struct bw_hwmon *hw)
 {
-	struct device *dev = &pdev->dev;
 	int ret;
 
-	l2pm_irq = platform_get_irq(pdev, 0);
-	if (l2pm_irq < 0) {
-		pr_err("Unable to get IRQ number\n");
-		return l2pm_irq;
-	}
-
-	ret = of_property_read_u32(dev->of_node, "qcom,bytes-per-beat",
-			     &bytes_per_beat);
-	if (ret) {
-		pr_err("Unable to read bytes per beat\n");
-		return ret;
+	mutex_lock(&hwmon_lock);
+	if (hwmon) {
+		pr_info("%s already in use, not using %s\n",
+			hwmon->name, hw->name);
+		mutex_unlock(&hwmon_lock);
+		return -EBUSY;
 	}
+	hw->df = NULL;
+	hwmon = hw;
+	mutex_unlock(&hwmon_lock);
 
+	/*
+	 * Adding the governor can start it right away, and GOV_START takes
+	 * hwmon_lock in start_monitoring(), so it must not be held here.
+	 */
 	ret = devfreq_add_governor(&devfreq_cpubw_hwmon);
 	if (ret) {
 		pr_err("devfreq governor registration failed\n");
+		mutex_lock(&hwmon_lock);
+		hwmon = NULL;
+		mutex_unlock(&hwmon_lock);
 		return ret;
 	}
 
+	pr_info("using %s bandwidth monitor\n", hw->name);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(register_bw_hwmon);
 
-static struct of_device_id match_table[] = {
-	{ .compatible = "qcom,kraitbw-l2pm" },
-	{}
-};
-
-static struct platform_driver cpubw_hwmon_driver = {
-	.probe = cpubw_hwmon_driver_probe,
-	.driver = {
-		.name = "kraitbw-l2pm",
-		.of_match_table = match_table,
-		.owner = THIS_MODULE,
-	},
-};
-
-static int __init cpubw_hwmon_init(void)
+/**
+ * unregister_bw_hwmon - remove a backend added with register_bw_hwmon()
+ * @hw: backend operations
+ */
+void unregister_bw_hwmon(struct bw_hwmon *hw)
 {
-	return platform_driver_register(&cpubw_hwmon_driver);
-}
-module_init(cpubw_hwmon_init);
+	mutex_lock(&hwmon_lock);
+	if (hwmon != hw) {
+		mutex_unlock(&hwmon_lock);
+		return;
+	}
+	mutex_unlock(&hwmon_lock);
 
-static void __exit cpubw_hwmon_exit(void)
-{
-	platform_driver_unregister(&cpubw_hwmon_driver);
+	/* GOV_STOP takes hwmon_lock in stop_monitoring() */
+	devfreq_remove_governor(&devfreq_cpubw_hwmon);
+
+	mutex_lock(&hwmon_lock);
+	hwmon = NULL;
+	mutex_unlock(&hwmon_lock);
 }
-module_exit(cpubw_hwmon_exit);
+EXPORT_SYMBOL_GPL(unregister_bw_hwmon);
 
-MODULE_DESCRIPTION("HW monitor based CPU DDR bandwidth voting driver");
+MODULE_DESCRIPTION("HW monitor based CPU DDR bandwidth voting governor");
 MODULE_LICENSE("GPL v2");
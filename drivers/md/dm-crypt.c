@@ -19,6 +19,7 @@
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
 #include <linux/atomic.h>
+#include <linux/hardirq.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
 #include <asm/unaligned.h>
@@ -102,7 +103,8 @@ struct iv_lmk_private {
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
  */
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_SYNC_CIPHER, DM_CRYPT_INLINE_READ };
 
 /*
  * The fields in here must be read only after initialization,
@@ -164,10 +166,19 @@ struct crypt_config {
 #define MIN_IOS        16
 #define MIN_POOL_PAGES 32
 
+/*
+ * Largest read (in bytes) that "inline_read" targets decrypt directly in
+ * the bio completion context instead of handing it to kcryptd.
+ */
+static unsigned inline_read_max = 8192;
+module_param(inline_read_max, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(inline_read_max, "Largest read decrypted in completion context");
+
 static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
+static int kcryptd_crypt_read_inline(struct dm_crypt_io *io);
 static u8 *iv_of_dmreq(struct crypt_config *cc, struct dm_crypt_request *dmreq);
 
 /*
@@ -719,7 +730,7 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
 
 static void crypt_alloc_req(struct crypt_config *cc,
-			    struct convert_context *ctx)
+			    struct convert_context *ctx, int atomic)
 {
 	unsigned key_index = ctx->sector & (cc->tfms_count - 1);
 
@@ -728,15 +739,19 @@ static void crypt_alloc_req(struct crypt_config *cc,
 
 	ablkcipher_request_set_tfm(ctx->req, cc->tfms[key_index]);
 	ablkcipher_request_set_callback(ctx->req,
-	    CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+	    CRYPTO_TFM_REQ_MAY_BACKLOG |
+	    (atomic ? 0 : CRYPTO_TFM_REQ_MAY_SLEEP),
 	    kcryptd_async_done, dmreq_of_req(cc, ctx->req));
 }
 
 /*
  * Encrypt / decrypt data from one bio to another one (can be the same one)
+ *
+ * With @atomic set the caller must not sleep: ctx->req has to be
+ * preallocated and the cipher must be synchronous.
  */
 static int crypt_convert(struct crypt_config *cc,
-			 struct convert_context *ctx)
+			 struct convert_context *ctx, int atomic)
 {
 	int r;
 
@@ -745,7 +760,7 @@ static int crypt_convert(struct crypt_config *cc,
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
-		crypt_alloc_req(cc, ctx);
+		crypt_alloc_req(cc, ctx, atomic);
 
 		atomic_inc(&ctx->pending);
 
@@ -765,7 +780,8 @@ static int crypt_convert(struct crypt_config *cc,
 		case 0:
 			atomic_dec(&ctx->pending);
 			ctx->sector++;
-			cond_resched();
+			if (!atomic)
+				cond_resched();
 			continue;
 
 		/* error */
@@ -919,6 +935,9 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
  * starved by new requests which can block in the first stages due
  * to memory allocation.
  *
+ * Targets with "inline_read" and a synchronous cipher skip kcryptd for
+ * small reads and decrypt them right here, see kcryptd_crypt_read_inline().
+ *
  * The work is done per CPU global for all dm-crypt instances.
  * They should not depend on each other and do not block.
  */
@@ -940,7 +959,8 @@ static void crypt_endio(struct bio *clone, int error)
 	bio_put(clone);
 
 	if (rw == READ && !error) {
-		kcryptd_queue_crypt(io);
+		if (!kcryptd_crypt_read_inline(io))
+			kcryptd_queue_crypt(io);
 		return;
 	}
 
@@ -1076,7 +1096,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		crypt_inc_pending(io);
 
-		r = crypt_convert(cc, &io->ctx);
+		r = crypt_convert(cc, &io->ctx, 0);
 		if (r < 0)
 			io->error = -EIO;
 
@@ -1140,7 +1160,7 @@ static void kcryptd_crypt_read_done(struct dm_crypt_io *io)
 	crypt_dec_pending(io);
 }
 
-static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
+static void kcryptd_crypt_read_convert(struct dm_crypt_io *io, int atomic)
 {
 	struct crypt_config *cc = io->target->private;
 	int r = 0;
@@ -1150,7 +1170,7 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
 			   io->sector);
 
-	r = crypt_convert(cc, &io->ctx);
+	r = crypt_convert(cc, &io->ctx, atomic);
 	if (r < 0)
 		io->error = -EIO;
 
@@ -1160,6 +1180,35 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	crypt_dec_pending(io);
 }
 
+/*
+ * Decrypt a small read in the context its clone completed in, saving the
+ * switch to kcryptd and back. Nothing may sleep here, so this is only done
+ * for synchronous ciphers, never from hard interrupt context, and only if
+ * the crypto request can be had without waiting on the mempool.
+ * Returns 0 if the caller has to queue the io to kcryptd instead.
+ */
+static int kcryptd_crypt_read_inline(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+
+	if (!test_bit(DM_CRYPT_INLINE_READ, &cc->flags) ||
+	    !test_bit(DM_CRYPT_SYNC_CIPHER, &cc->flags))
+		return 0;
+
+	if (io->base_bio->bi_size > inline_read_max ||
+	    in_irq() || irqs_disabled())
+		return 0;
+
+	if (!io->ctx.req) {
+		io->ctx.req = mempool_alloc(cc->req_pool, GFP_ATOMIC);
+		if (!io->ctx.req)
+			return 0;
+	}
+
+	kcryptd_crypt_read_convert(io, 1);
+	return 1;
+}
+
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error)
 {
@@ -1196,7 +1245,7 @@ static void kcryptd_crypt(struct work_struct *work)
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
 	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_crypt_read_convert(io);
+		kcryptd_crypt_read_convert(io, 0);
 	else
 		kcryptd_crypt_write_convert(io);
 }
@@ -1443,6 +1492,10 @@ static int crypt_ctr_cipher(struct dm_target *ti,
 		goto bad;
 	}
 
+	if (!(crypto_ablkcipher_tfm(any_tfm(cc))->__crt_alg->cra_flags &
+	      CRYPTO_ALG_ASYNC))
+		set_bit(DM_CRYPT_SYNC_CIPHER, &cc->flags);
+
 	/* Initialize and set key */
 	ret = crypt_set_key(cc, key);
 	if (ret < 0) {
@@ -1532,7 +1585,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 1, "Invalid number of feature args"},
+		{0, 2, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1627,15 +1680,23 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		if (ret)
 			goto bad;
 
-		opt_string = dm_shift_arg(&as);
+		while (opt_params--) {
+			opt_string = dm_shift_arg(&as);
+			if (!opt_string) {
+				ret = -EINVAL;
+				ti->error = "Not enough feature arguments";
+				goto bad;
+			}
 
-		if (opt_params == 1 && opt_string &&
-		    !strcasecmp(opt_string, "allow_discards"))
-			ti->num_discard_requests = 1;
-		else if (opt_params) {
-			ret = -EINVAL;
-			ti->error = "Invalid feature arguments";
-			goto bad;
+			if (!strcasecmp(opt_string, "allow_discards"))
+				ti->num_discard_requests = 1;
+			else if (!strcasecmp(opt_string, "inline_read"))
+				set_bit(DM_CRYPT_INLINE_READ, &cc->flags);
+			else {
+				ret = -EINVAL;
+				ti->error = "Invalid feature arguments";
+				goto bad;
+			}
 		}
 	}
 
@@ -1704,6 +1765,7 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 {
 	struct crypt_config *cc = ti->private;
 	unsigned i, sz = 0;
+	unsigned num_feature_args;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
@@ -1722,8 +1784,15 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
 
-		if (ti->num_discard_requests)
-			DMEMIT(" 1 allow_discards");
+		num_feature_args = !!ti->num_discard_requests +
+			test_bit(DM_CRYPT_INLINE_READ, &cc->flags);
+		if (num_feature_args) {
+			DMEMIT(" %u", num_feature_args);
+			if (ti->num_discard_requests)
+				DMEMIT(" allow_discards");
+			if (test_bit(DM_CRYPT_INLINE_READ, &cc->flags))
+				DMEMIT(" inline_read");
+		}
 
 		break;
 	}
@@ -1820,7 +1889,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 11, 0},
+	.version = {1, 12, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
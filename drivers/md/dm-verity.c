@@ -12,12 +12,18 @@
  * hash device. Setting this greatly improves performance when data and hash
  * are on the same disk on different partitions on devices with poor random
  * access behavior.
+ *
+ * In the file "/sys/module/dm_verity/parameters/max_pinned" you can set the
+ * number of bytes of the hash tree that a newly created target keeps in
+ * memory. The upper tree levels that fit are read and verified once, when
+ * the target is created, and are never looked up through dm-bufio again.
  */
 
 #include "dm-bufio.h"
 
 #include <linux/module.h>
 #include <linux/device-mapper.h>
+#include <linux/vmalloc.h>
 #include <crypto/hash.h>
 
 #define DM_MSG_PREFIX			"verity"
@@ -25,13 +31,22 @@
 #define DM_VERITY_IO_VEC_INLINE		16
 #define DM_VERITY_MEMPOOL_SIZE		4
 #define DM_VERITY_DEFAULT_PREFETCH_SIZE	262144
+#define DM_VERITY_DEFAULT_MAX_PINNED	(1024 * 1024)
 
 #define DM_VERITY_MAX_LEVELS		63
 
+/* Large ios are verified in up to this many ranges in parallel */
+#define DM_VERITY_MAX_RANGES		8
+#define DM_VERITY_MIN_RANGE_BLOCKS	8
+
 static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
 
+static unsigned dm_verity_max_pinned = DM_VERITY_DEFAULT_MAX_PINNED;
+
+module_param_named(max_pinned, dm_verity_max_pinned, uint, S_IRUGO | S_IWUSR);
+
 struct dm_verity {
 	struct dm_dev *data_dev;
 	struct dm_dev *hash_dev;
@@ -62,6 +77,44 @@ struct dm_verity {
 
 	/* starting blocks for each tree level. 0 is the lowest level. */
 	sector_t hash_level_block[DM_VERITY_MAX_LEVELS];
+
+	/*
+	 * Levels from pinned_level up are kept verified in pinned_hashes,
+	 * which holds the hash blocks from hash_start on. If nothing is
+	 * pinned, pinned_level is the number of levels.
+	 */
+	unsigned char pinned_level;
+	u8 *pinned_hashes;
+
+	/* with check_at_most_once, data blocks that passed verification */
+	unsigned long *verified_blocks;
+};
+
+/*
+ * A run of blocks of an io verified by one worker. This is the whole io
+ * unless the io was split to be verified on several cpus.
+ */
+struct dm_verity_range {
+	struct dm_verity_io *io;
+	struct work_struct work;
+
+	unsigned first;		/* first block, relative to io->block */
+	unsigned n_blocks;
+
+	/* position of the first block in io->io_vec */
+	unsigned vector;
+	unsigned offset;
+
+	/*
+	 * Three variably-size fields follow this struct:
+	 *
+	 * u8 hash_desc[v->shash_descsize];
+	 * u8 real_digest[v->digest_size];
+	 * u8 want_digest[v->digest_size];
+	 *
+	 * To access them use: range_hash_desc(), range_real_digest() and
+	 * range_want_digest().
+	 */
 };
 
 struct dm_verity_io {
@@ -79,35 +132,36 @@ struct dm_verity_io {
 	struct bio_vec *io_vec;
 	unsigned io_vec_size;
 
-	struct work_struct work;
+	/* ranges still being verified, and the error of any failed one */
+	atomic_t pending;
+	int error;
 
 	/* A space for short vectors; longer vectors are allocated separately. */
 	struct bio_vec io_vec_inline[DM_VERITY_IO_VEC_INLINE];
 
-	/*
-	 * Three variably-size fields follow this struct:
-	 *
-	 * u8 hash_desc[v->shash_descsize];
-	 * u8 real_digest[v->digest_size];
-	 * u8 want_digest[v->digest_size];
-	 *
-	 * To access them use: io_hash_desc(), io_real_digest() and io_want_digest().
-	 */
+	/* The first range; the variably-size fields of it follow the io. */
+	struct dm_verity_range range;
 };
 
-static struct shash_desc *io_hash_desc(struct dm_verity *v, struct dm_verity_io *io)
+static struct shash_desc *range_hash_desc(struct dm_verity *v,
+					  struct dm_verity_range *range)
 {
-	return (struct shash_desc *)(io + 1);
+	return (struct shash_desc *)(range + 1);
 }
 
-static u8 *io_real_digest(struct dm_verity *v, struct dm_verity_io *io)
+static u8 *range_real_digest(struct dm_verity *v, struct dm_verity_range *range)
 {
-	return (u8 *)(io + 1) + v->shash_descsize;
+	return (u8 *)(range + 1) + v->shash_descsize;
 }
 
-static u8 *io_want_digest(struct dm_verity *v, struct dm_verity_io *io)
+static u8 *range_want_digest(struct dm_verity *v, struct dm_verity_range *range)
 {
-	return (u8 *)(io + 1) + v->shash_descsize + v->digest_size;
+	return (u8 *)(range + 1) + v->shash_descsize + v->digest_size;
+}
+
+static size_t range_extra_size(struct dm_verity *v)
+{
+	return v->shash_descsize + v->digest_size * 2;
 }
 
 /*
@@ -174,21 +228,97 @@ static void verity_hash_at_level(struct dm_verity *v, sector_t block, int level,
 		*offset = idx << (v->hash_dev_block_bits - v->hash_per_block_bits);
 }
 
+/*
+ * Start hashing a block: the salt goes first in the current format.
+ */
+static int verity_hash_init(struct dm_verity *v, struct shash_desc *desc)
+{
+	int r;
+
+	desc->tfm = v->tfm;
+	desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+	r = crypto_shash_init(desc);
+	if (r < 0) {
+		DMERR("crypto_shash_init failed: %d", r);
+		return r;
+	}
+
+	if (likely(v->version >= 1)) {
+		r = crypto_shash_update(desc, v->salt, v->salt_size);
+		if (r < 0) {
+			DMERR("crypto_shash_update failed: %d", r);
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int verity_hash_update(struct shash_desc *desc, const u8 *data,
+			      unsigned len)
+{
+	int r = crypto_shash_update(desc, data, len);
+
+	if (r < 0)
+		DMERR("crypto_shash_update failed: %d", r);
+
+	return r;
+}
+
+/*
+ * Finish hashing a block: version 0 puts the salt last.
+ */
+static int verity_hash_final(struct dm_verity *v, struct shash_desc *desc,
+			     u8 *digest)
+{
+	int r;
+
+	if (!v->version) {
+		r = crypto_shash_update(desc, v->salt, v->salt_size);
+		if (r < 0) {
+			DMERR("crypto_shash_update failed: %d", r);
+			return r;
+		}
+	}
+
+	r = crypto_shash_final(desc, digest);
+	if (r < 0)
+		DMERR("crypto_shash_final failed: %d", r);
+
+	return r;
+}
+
+static int verity_hash(struct dm_verity *v, struct shash_desc *desc,
+		       const u8 *data, unsigned len, u8 *digest)
+{
+	int r;
+
+	r = verity_hash_init(v, desc);
+	if (r < 0)
+		return r;
+
+	r = verity_hash_update(desc, data, len);
+	if (r < 0)
+		return r;
+
+	return verity_hash_final(v, desc, digest);
+}
+
 /*
  * Verify hash of a metadata block pertaining to the specified data block
  * ("block" argument) at a specified level ("level" argument).
  *
- * On successful return, io_want_digest(v, io) contains the hash value for
- * a lower tree level or for the data block (if we're at the lowest leve).
+ * On successful return, range_want_digest(v, range) contains the hash value
+ * for a lower tree level or for the data block (if we're at the lowest leve).
  *
  * If "skip_unverified" is true, unverified buffer is skipped and 1 is returned.
  * If "skip_unverified" is false, unverified buffer is hashed and verified
- * against current value of io_want_digest(v, io).
+ * against current value of range_want_digest(v, range).
  */
-static int verity_verify_level(struct dm_verity_io *io, sector_t block,
+static int verity_verify_level(struct dm_verity_range *range, sector_t block,
 			       int level, bool skip_unverified)
 {
-	struct dm_verity *v = io->v;
+	struct dm_verity *v = range->io->v;
 	struct dm_buffer *buf;
 	struct buffer_aux *aux;
 	u8 *data;
@@ -198,6 +328,14 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 
 	verity_hash_at_level(v, block, level, &hash_block, &offset);
 
+	if (level >= v->pinned_level) {
+		data = v->pinned_hashes +
+			((hash_block - v->hash_start) << v->hash_dev_block_bits);
+		memcpy(range_want_digest(v, range), data + offset,
+		       v->digest_size);
+		return 0;
+	}
+
 	data = dm_bufio_read(v->bufio, hash_block, &buf);
 	if (unlikely(IS_ERR(data)))
 		return PTR_ERR(data);
@@ -205,7 +343,6 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 	aux = dm_bufio_get_aux_data(buf);
 
 	if (!aux->hash_verified) {
-		struct shash_desc *desc;
 		u8 *result;
 
 		if (skip_unverified) {
@@ -213,44 +350,12 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 			goto release_ret_r;
 		}
 
-		desc = io_hash_desc(v, io);
-		desc->tfm = v->tfm;
-		desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
-		r = crypto_shash_init(desc);
-		if (r < 0) {
-			DMERR("crypto_shash_init failed: %d", r);
-			goto release_ret_r;
-		}
-
-		if (likely(v->version >= 1)) {
-			r = crypto_shash_update(desc, v->salt, v->salt_size);
-			if (r < 0) {
-				DMERR("crypto_shash_update failed: %d", r);
-				goto release_ret_r;
-			}
-		}
-
-		r = crypto_shash_update(desc, data, 1 << v->hash_dev_block_bits);
-		if (r < 0) {
-			DMERR("crypto_shash_update failed: %d", r);
-			goto release_ret_r;
-		}
-
-		if (!v->version) {
-			r = crypto_shash_update(desc, v->salt, v->salt_size);
-			if (r < 0) {
-				DMERR("crypto_shash_update failed: %d", r);
-				goto release_ret_r;
-			}
-		}
-
-		result = io_real_digest(v, io);
-		r = crypto_shash_final(desc, result);
-		if (r < 0) {
-			DMERR("crypto_shash_final failed: %d", r);
+		result = range_real_digest(v, range);
+		r = verity_hash(v, range_hash_desc(v, range), data,
+				1 << v->hash_dev_block_bits, result);
+		if (r < 0)
 			goto release_ret_r;
-		}
-		if (unlikely(memcmp(result, io_want_digest(v, io), v->digest_size))) {
+		if (unlikely(memcmp(result, range_want_digest(v, range), v->digest_size))) {
 			DMERR_LIMIT("metadata block %llu is corrupted",
 				(unsigned long long)hash_block);
 			v->hash_failed = 1;
@@ -262,7 +367,7 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 
 	data += offset;
 
-	memcpy(io_want_digest(v, io), data, v->digest_size);
+	memcpy(range_want_digest(v, range), data, v->digest_size);
 
 	dm_bufio_release(buf);
 	return 0;
@@ -274,21 +379,53 @@ release_ret_r:
 }
 
 /*
- * Verify one "dm_verity_io" structure.
+ * Advance a position in the saved bio vector of an io by "bytes".
  */
-static int verity_verify_io(struct dm_verity_io *io)
+static void verity_vec_advance(struct dm_verity_io *io, unsigned *vector,
+			       unsigned *offset, unsigned bytes)
 {
+	while (bytes) {
+		struct bio_vec *bv;
+		unsigned len;
+
+		BUG_ON(*vector >= io->io_vec_size);
+		bv = &io->io_vec[*vector];
+		len = bv->bv_len - *offset;
+		if (likely(len >= bytes))
+			len = bytes;
+		*offset += len;
+		if (likely(*offset == bv->bv_len)) {
+			*offset = 0;
+			(*vector)++;
+		}
+		bytes -= len;
+	}
+}
+
+/*
+ * Verify one "dm_verity_range" structure.
+ */
+static int verity_verify_range(struct dm_verity_range *range)
+{
+	struct dm_verity_io *io = range->io;
 	struct dm_verity *v = io->v;
 	unsigned b;
 	int i;
-	unsigned vector = 0, offset = 0;
+	unsigned vector = range->vector, offset = range->offset;
 
-	for (b = 0; b < io->n_blocks; b++) {
+	for (b = range->first; b < range->first + range->n_blocks; b++) {
+		sector_t block = io->block + b;
 		struct shash_desc *desc;
 		u8 *result;
 		int r;
 		unsigned todo;
 
+		if (v->verified_blocks && test_bit(block, v->verified_blocks)) {
+			verity_vec_advance(io, &vector, &offset,
+					   1 << v->data_dev_block_bits);
+			continue;
+		}
+
 		if (likely(v->levels)) {
 			/*
 			 * First, we try to get the requested hash for
@@ -297,38 +434,26 @@ static int verity_verify_io(struct dm_verity_io *io)
 			 * function returns 0 and we fall back to whole
 			 * chain verification.
 			 */
-			int r = verity_verify_level(io, io->block + b, 0, true);
+			int r = verity_verify_level(range, block, 0, true);
 			if (likely(!r))
 				goto test_block_hash;
 			if (r < 0)
 				return r;
 		}
 
-		memcpy(io_want_digest(v, io), v->root_digest, v->digest_size);
+		memcpy(range_want_digest(v, range), v->root_digest, v->digest_size);
 
 		for (i = v->levels - 1; i >= 0; i--) {
-			int r = verity_verify_level(io, io->block + b, i, false);
+			int r = verity_verify_level(range, block, i, false);
 			if (unlikely(r))
 				return r;
 		}
 
 test_block_hash:
-		desc = io_hash_desc(v, io);
-		desc->tfm = v->tfm;
-		desc->flags = CRYPTO_TFM_REQ_MAY_SLEEP;
-		r = crypto_shash_init(desc);
-		if (r < 0) {
-			DMERR("crypto_shash_init failed: %d", r);
+		desc = range_hash_desc(v, range);
+		r = verity_hash_init(v, desc);
+		if (r < 0)
 			return r;
-		}
-
-		if (likely(v->version >= 1)) {
-			r = crypto_shash_update(desc, v->salt, v->salt_size);
-			if (r < 0) {
-				DMERR("crypto_shash_update failed: %d", r);
-				return r;
-			}
-		}
 
 		todo = 1 << v->data_dev_block_bits;
 		do {
@@ -342,13 +467,11 @@ test_block_hash:
 			len = bv->bv_len - offset;
 			if (likely(len >= todo))
 				len = todo;
-			r = crypto_shash_update(desc,
+			r = verity_hash_update(desc,
 					page + bv->bv_offset + offset, len);
 			kunmap_atomic(page);
-			if (r < 0) {
-				DMERR("crypto_shash_update failed: %d", r);
+			if (r < 0)
 				return r;
-			}
 			offset += len;
 			if (likely(offset == bv->bv_len)) {
 				offset = 0;
@@ -357,29 +480,22 @@ test_block_hash:
 			todo -= len;
 		} while (todo);
 
-		if (!v->version) {
-			r = crypto_shash_update(desc, v->salt, v->salt_size);
-			if (r < 0) {
-				DMERR("crypto_shash_update failed: %d", r);
-				return r;
-			}
-		}
-
-		result = io_real_digest(v, io);
-		r = crypto_shash_final(desc, result);
-		if (r < 0) {
-			DMERR("crypto_shash_final failed: %d", r);
+		result = range_real_digest(v, range);
+		r = verity_hash_final(v, desc, result);
+		if (r < 0)
 			return r;
-		}
-		if (unlikely(memcmp(result, io_want_digest(v, io), v->digest_size))) {
+		if (unlikely(memcmp(result, range_want_digest(v, range), v->digest_size))) {
 			DMERR_LIMIT("data block %llu is corrupted",
-				(unsigned long long)(io->block + b));
+				(unsigned long long)block);
 			v->hash_failed = 1;
 			return -EIO;
 		}
+
+		if (v->verified_blocks)
+			set_bit(block, v->verified_blocks);
 	}
-	BUG_ON(vector != io->io_vec_size);
-	BUG_ON(offset);
+	BUG_ON(range->first + range->n_blocks == io->n_blocks &&
+	       (vector != io->io_vec_size || offset));
 
 	return 0;
 }
@@ -403,11 +519,88 @@ static void verity_finish_io(struct dm_verity_io *io, int error)
 	bio_endio(bio, error);
 }
 
+/*
+ * One range is verified; the io ends with the last of its ranges.
+ */
+static void verity_range_done(struct dm_verity_range *range, int error)
+{
+	struct dm_verity_io *io = range->io;
+
+	if (unlikely(error))
+		io->error = error;
+
+	if (range != &io->range)
+		kfree(range);
+
+	if (atomic_dec_and_test(&io->pending))
+		verity_finish_io(io, io->error);
+}
+
+static void verity_range_work(struct work_struct *w)
+{
+	struct dm_verity_range *range =
+		container_of(w, struct dm_verity_range, work);
+
+	verity_range_done(range, verity_verify_range(range));
+}
+
+/*
+ * Split a large io into ranges of whole blocks and queue all but the first
+ * one, so that the workqueue verifies them on other cpus while the caller
+ * verifies the first. If ranges can't be allocated, fewer are used.
+ */
+static void verity_split_io(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	struct dm_verity_range *ranges[DM_VERITY_MAX_RANGES];
+	unsigned n_ranges, per_range, vector, offset;
+	unsigned i;
+
+	n_ranges = min_t(unsigned, num_online_cpus(), DM_VERITY_MAX_RANGES);
+	n_ranges = min(n_ranges, io->n_blocks / DM_VERITY_MIN_RANGE_BLOCKS);
+	if (n_ranges < 2)
+		return;
+
+	ranges[0] = &io->range;
+	for (i = 1; i < n_ranges; i++) {
+		ranges[i] = kmalloc(sizeof(struct dm_verity_range) +
+				    range_extra_size(v), GFP_NOIO);
+		if (!ranges[i])
+			break;
+	}
+	n_ranges = i;
+	if (n_ranges < 2)
+		return;
+
+	per_range = DIV_ROUND_UP(io->n_blocks, n_ranges);
+	atomic_set(&io->pending, n_ranges);
+
+	vector = 0;
+	offset = 0;
+	for (i = 0; i < n_ranges; i++) {
+		struct dm_verity_range *range = ranges[i];
+
+		range->io = io;
+		range->first = i * per_range;
+		range->n_blocks = min(per_range, io->n_blocks - range->first);
+		range->vector = vector;
+		range->offset = offset;
+		verity_vec_advance(io, &vector, &offset,
+				   range->n_blocks << v->data_dev_block_bits);
+
+		if (i) {
+			INIT_WORK(&range->work, verity_range_work);
+			queue_work(v->verify_wq, &range->work);
+		}
+	}
+}
+
 static void verity_work(struct work_struct *w)
 {
-	struct dm_verity_io *io = container_of(w, struct dm_verity_io, work);
+	struct dm_verity_io *io = container_of(w, struct dm_verity_io, range.work);
 
-	verity_finish_io(io, verity_verify_io(io));
+	verity_split_io(io);
+	verity_range_done(&io->range, verity_verify_range(&io->range));
 }
 
 static void verity_end_io(struct bio *bio, int error)
@@ -419,8 +612,8 @@ static void verity_end_io(struct bio *bio, int error)
 		return;
 	}
 
-	INIT_WORK(&io->work, verity_work);
-	queue_work(io->v->verify_wq, &io->work);
+	INIT_WORK(&io->range.work, verity_work);
+	queue_work(io->v->verify_wq, &io->range.work);
 }
 
 /*
@@ -432,9 +625,19 @@ static void verity_prefetch_io(struct dm_verity *v, struct dm_verity_io *io)
 {
 	int i;
 
+	/* Nothing to look up if all the blocks were verified before */
+	if (v->verified_blocks &&
+	    find_next_zero_bit(v->verified_blocks, io->block + io->n_blocks,
+			       io->block) >= io->block + io->n_blocks)
+		return;
+
 	for (i = v->levels - 2; i >= 0; i--) {
 		sector_t hash_block_start;
 		sector_t hash_block_end;
+
+		if (i >= v->pinned_level)
+			continue;
+
 		verity_hash_at_level(v, io->block, i, &hash_block_start, NULL);
 		verity_hash_at_level(v, io->block + io->n_blocks - 1, i, &hash_block_end, NULL);
 		if (!i) {
@@ -493,6 +696,14 @@ static int verity_map(struct dm_target *ti, struct bio *bio,
 	io->orig_bi_private = bio->bi_private;
 	io->block = bio->bi_sector >> (v->data_dev_block_bits - SECTOR_SHIFT);
 	io->n_blocks = bio->bi_size >> v->data_dev_block_bits;
+	atomic_set(&io->pending, 1);
+	io->error = 0;
+
+	io->range.io = io;
+	io->range.first = 0;
+	io->range.n_blocks = io->n_blocks;
+	io->range.vector = 0;
+	io->range.offset = 0;
 
 	bio->bi_end_io = verity_end_io;
 	bio->bi_private = io;
@@ -544,6 +755,8 @@ static void verity_status(struct dm_target *ti, status_type_t type,
 		else
 			for (x = 0; x < v->salt_size; x++)
 				DMEMIT("%02x", v->salt[x]);
+		if (v->verified_blocks)
+			DMEMIT(" 1 check_at_most_once");
 		break;
 	}
 }
@@ -614,6 +827,8 @@ static void verity_dtr(struct dm_target *ti)
 	if (v->bufio)
 		dm_bufio_client_destroy(v->bufio);
 
+	vfree(v->verified_blocks);
+	vfree(v->pinned_hashes);
 	kfree(v->salt);
 	kfree(v->root_digest);
 
@@ -631,6 +846,93 @@ static void verity_dtr(struct dm_target *ti)
 	kfree(v);
 }
 
+/*
+ * Read the upper levels of the hash tree into memory and verify them down
+ * from the root digest. As many levels as fit in "max_pinned" bytes are
+ * pinned, but never level 0. The levels are stored contiguously from
+ * hash_start, top level first.
+ *
+ * Pinning is only an optimization: if it fails, lookups go through dm-bufio
+ * as before, and a corrupted hash block is reported when it is used.
+ */
+static void verity_pin_levels(struct dm_verity *v)
+{
+	unsigned block_size = 1 << v->hash_dev_block_bits;
+	struct shash_desc *desc;
+	u8 *digest;
+	sector_t n_blocks, i;
+	int level, l;
+
+	v->pinned_level = v->levels;
+
+	for (level = 1; level < v->levels; level++) {
+		n_blocks = v->hash_level_block[level - 1] - v->hash_start;
+		if (n_blocks <= dm_verity_max_pinned >> v->hash_dev_block_bits)
+			break;
+	}
+	if (level >= v->levels)
+		return;
+
+	v->pinned_hashes = vmalloc(n_blocks << v->hash_dev_block_bits);
+	desc = kmalloc(range_extra_size(v), GFP_KERNEL);
+	if (!v->pinned_hashes || !desc)
+		goto unpin;
+	digest = (u8 *)desc + v->shash_descsize;
+
+	for (i = 0; i < n_blocks; i++) {
+		struct dm_buffer *buf;
+		u8 *data = dm_bufio_read(v->bufio, v->hash_start + i, &buf);
+
+		if (IS_ERR(data))
+			goto unpin;
+		memcpy(v->pinned_hashes + (i << v->hash_dev_block_bits), data,
+		       block_size);
+		dm_bufio_release(buf);
+	}
+
+	for (l = v->levels - 1; l >= level; l--) {
+		sector_t hash_block;
+
+		for (hash_block = v->hash_level_block[l];
+		     hash_block < v->hash_level_block[l - 1]; hash_block++) {
+			sector_t idx = hash_block - v->hash_level_block[l];
+			u8 *want = v->root_digest;
+
+			if (l < v->levels - 1) {
+				sector_t parent;
+				unsigned offset;
+
+				verity_hash_at_level(v,
+					idx << ((l + 1) * v->hash_per_block_bits),
+					l + 1, &parent, &offset);
+				want = v->pinned_hashes + offset +
+				       ((parent - v->hash_start) <<
+					v->hash_dev_block_bits);
+			}
+
+			if (verity_hash(v, desc, v->pinned_hashes +
+					((hash_block - v->hash_start) <<
+					 v->hash_dev_block_bits),
+					block_size, digest) < 0)
+				goto unpin;
+			if (memcmp(digest, want, v->digest_size)) {
+				DMERR("metadata block %llu is corrupted",
+				      (unsigned long long)hash_block);
+				goto unpin;
+			}
+		}
+	}
+
+	kfree(desc);
+	v->pinned_level = level;
+	return;
+
+unpin:
+	kfree(desc);
+	vfree(v->pinned_hashes);
+	v->pinned_hashes = NULL;
+}
+
 /*
  * Target parameters:
  *	<version>	The current format is version 1.
@@ -644,6 +946,15 @@ static void verity_dtr(struct dm_target *ti)
  *	<algorithm>
  *	<digest>
  *	<salt>		Hex string or "-" if no salt.
+ *	[<#opt_params> <opt_params>]
+ *
+ * Optional parameters:
+ *	check_at_most_once
+ *			Verify every data block only the first time it is
+ *			read. This trades protection against the data device
+ *			changing underneath a running system for not hashing
+ *			data again when it is re-read after page cache
+ *			eviction.
  */
 static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 {
@@ -654,6 +965,7 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	int i;
 	sector_t hash_position;
 	char dummy;
+	bool check_at_most_once = false;
 
 	v = kzalloc(sizeof(struct dm_verity), GFP_KERNEL);
 	if (!v) {
@@ -669,8 +981,8 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
-	if (argc != 10) {
-		ti->error = "Invalid argument count: exactly 10 arguments required";
+	if (argc < 10) {
+		ti->error = "Invalid argument count: at least 10 arguments required";
 		r = -EINVAL;
 		goto bad;
 	}
@@ -791,6 +1103,33 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		}
 	}
 
+	if (argc > 10) {
+		static struct dm_arg _args[] = {
+			{0, 1, "Invalid number of feature args"},
+		};
+		struct dm_arg_set as;
+		unsigned opt_params;
+		const char *arg_name;
+
+		as.argc = argc - 10;
+		as.argv = argv + 10;
+		r = dm_read_arg_group(_args, &as, &opt_params, &ti->error);
+		if (r)
+			goto bad;
+
+		while (opt_params--) {
+			arg_name = dm_shift_arg(&as);
+			if (!strcasecmp(arg_name, "check_at_most_once")) {
+				check_at_most_once = true;
+				continue;
+			}
+
+			ti->error = "Unrecognized verity feature request";
+			r = -EINVAL;
+			goto bad;
+		}
+	}
+
 	v->hash_per_block_bits =
 		fls((1 << v->hash_dev_block_bits) / v->digest_size) - 1;
 
@@ -838,8 +1177,20 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	verity_pin_levels(v);
+
+	if (check_at_most_once) {
+		v->verified_blocks = vzalloc(BITS_TO_LONGS(v->data_blocks) *
+					     sizeof(unsigned long));
+		if (!v->verified_blocks) {
+			ti->error = "Cannot allocate verified blocks bitmap";
+			r = -ENOMEM;
+			goto bad;
+		}
+	}
+
 	v->io_mempool = mempool_create_kmalloc_pool(DM_VERITY_MEMPOOL_SIZE,
-	  sizeof(struct dm_verity_io) + v->shash_descsize + v->digest_size * 2);
+	  sizeof(struct dm_verity_io) + range_extra_size(v));
 	if (!v->io_mempool) {
 		ti->error = "Cannot allocate io mempool";
 		r = -ENOMEM;
@@ -872,7 +1223,7 @@ bad:
 
 static struct target_type verity_target = {
 	.name		= "verity",
-	.version	= {1, 0, 0},
+	.version	= {1, 1, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
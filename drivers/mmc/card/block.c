@@ -81,7 +81,9 @@ static int cprm_ake_retry_flag;
 			(req->cmd_flags & REQ_META)) && \
 			(rq_data_dir(req) == WRITE))
 #define PACKED_CMD_VER		0x01
+#define PACKED_CMD_RD		0x01
 #define PACKED_CMD_WR		0x02
+#define PACKED_CMD_MAX_ENTRIES	63	/* entries the header block holds */
 #define PACKED_TRIGGER_MAX_ELEMENTS	5000
 #define MMC_BLK_MAX_RETRIES 5 /* max # of retries before aborting a command */
 #define MMC_BLK_UPDATE_STOP_REASON(stats, reason)			\
@@ -95,6 +97,11 @@ static int cprm_ake_retry_flag;
 #define PCKD_TRGR_URGENT_PENALTY	2
 #define PCKD_TRGR_LOWER_BOUND		5
 #define PCKD_TRGR_PRECISION_MULTIPLIER	100
+#define PCKD_TRGR_RD_MIX_PENALTY	1
+
+#define PCKD_MIX_SHIFT			3	/* weight 1/8 for the newest */
+#define PCKD_RD_MIX_HEAVY		(MMC_PACK_MIX_ONE * 3 / 4)
+#define PCKD_RD_TRGR_LOWER_BOUND	2
 
 static DEFINE_MUTEX(block_mutex);
 
@@ -148,6 +155,8 @@ struct mmc_blk_data {
 	struct device_attribute num_wr_reqs_to_start_packing;
 	struct device_attribute bkops_check_threshold;
 	struct device_attribute no_pack_for_random;
+	struct device_attribute num_rd_reqs_to_start_packing;
+	struct device_attribute packing_stats;
 	int	area_type;
 };
 
@@ -500,6 +509,131 @@ exit:
 	return ret;
 }
 
+static ssize_t
+num_rd_reqs_to_start_packing_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	int ret;
+
+	if (!md)
+		return -EINVAL;
+
+	ret = snprintf(buf, PAGE_SIZE, "%d\n",
+		       md->queue.num_rd_reqs_to_start_packing);
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+num_rd_reqs_to_start_packing_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	int value;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_card *card;
+	int ret = count;
+
+	if (!md)
+		return -EINVAL;
+
+	card = md->queue.card;
+	if (!card) {
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	sscanf(buf, "%d", &value);
+
+	if (value >= 0) {
+		md->queue.num_rd_reqs_to_start_packing =
+		    min_t(int, value, (int)card->ext_csd.max_packed_reads);
+
+		pr_debug("%s: trigger to pack reads: new value = %d",
+			mmc_hostname(card->host),
+			md->queue.num_rd_reqs_to_start_packing);
+	} else {
+		pr_err("%s: value %d is not valid. old value remains = %d",
+			mmc_hostname(card->host), value,
+			md->queue.num_rd_reqs_to_start_packing);
+		ret = -EINVAL;
+	}
+
+exit:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+packing_stats_show(struct device *dev,
+		   struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_queue *mq;
+	struct mmc_wr_pack_stats *stats;
+	struct mmc_pack_eff *rd, *wr;
+	int ret, i;
+
+	if (!md)
+		return -EINVAL;
+
+	mq = &md->queue;
+	if (!mq->card) {
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	rd = &mq->pack_eff[READ];
+	wr = &mq->pack_eff[WRITE];
+	ret = snprintf(buf, PAGE_SIZE,
+		       "rd_packed_cmds %lu\nrd_packed_reqs %lu\n"
+		       "rd_single_reqs %lu\nwr_packed_cmds %lu\n"
+		       "wr_packed_reqs %lu\nwr_single_reqs %lu\n"
+		       "rd_mix_pct %u\ndepth_avg %u\n"
+		       "rd_packing_enabled %d\nwr_packing_enabled %d\n",
+		       rd->packed_cmds, rd->packed_reqs, rd->single_reqs,
+		       wr->packed_cmds, wr->packed_reqs, wr->single_reqs,
+		       mq->rd_mix * 100 / MMC_PACK_MIX_ONE,
+		       mq->depth_avg >> MMC_PACK_DEPTH_SHIFT,
+		       mq->rd_packing_enabled, mq->wr_packing_enabled);
+
+	stats = &mq->rd_pack_stats;
+	spin_lock(&stats->lock);
+	if (stats->packing_events) {
+		for (i = 1; i <= mq->card->ext_csd.max_packed_reads; i++) {
+			if (!stats->packing_events[i])
+				continue;
+			ret += snprintf(buf + ret, PAGE_SIZE - ret,
+					"rd_packed_%d_reqs %u\n", i,
+					stats->packing_events[i]);
+		}
+	}
+	spin_unlock(&stats->lock);
+
+exit:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t
+packing_stats_store(struct device *dev,
+		    struct device_attribute *attr,
+		    const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	if (!md)
+		return -EINVAL;
+
+	/* any write starts the counting over */
+	mmc_blk_init_rd_packed_statistics(&md->queue);
+
+	mmc_blk_put(md);
+	return count;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -1959,6 +2093,40 @@ static int mmc_blk_packed_err_check(struct mmc_card *card,
 	return check;
 }
 
+/*
+ * Called once the header of a packed read is written: read the data of
+ * the packed requests, then check the outcome as for a packed write. The
+ * host is still claimed, and the next request only starts after we return.
+ */
+static int mmc_blk_packed_rd_err_check(struct mmc_card *card,
+				       struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+			mmc_active);
+	struct mmc_blk_request *hdr_brq = &mq_rq->packed_hdr_brq;
+	struct request *req = mq_rq->req;
+	struct mmc_queue *mq = req->q->queuedata;
+
+	if (hdr_brq->sbc.error || hdr_brq->cmd.error ||
+	    hdr_brq->data.error || hdr_brq->stop.error) {
+		pr_err("%s: packed read header failed: sbc %d cmd %d data %d stop %d\n",
+		       req->rq_disk->disk_name, hdr_brq->sbc.error,
+		       hdr_brq->cmd.error, hdr_brq->data.error,
+		       hdr_brq->stop.error);
+		/* nothing was read, resend the whole pack */
+		mq_rq->packed_retries--;
+		return MMC_BLK_RETRY;
+	}
+
+	mmc_wait_for_req(card->host, &mq_rq->brq.mrq);
+
+	/* packed commands tests check the outcome of the data phase too */
+	if (mq->err_check_fn)
+		return mq->err_check_fn(card, areq);
+
+	return mmc_blk_packed_err_check(card, areq);
+}
+
 static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 			       struct mmc_card *card,
 			       int disable_multi,
@@ -2141,13 +2309,14 @@ void mmc_blk_disable_wr_packing(struct mmc_queue *mq)
 }
 EXPORT_SYMBOL(mmc_blk_disable_wr_packing);
 
-static int get_packed_trigger(int potential, struct mmc_card *card,
+static int get_packed_trigger(int potential, struct mmc_queue *mq,
 			      struct request *req, int curr_trigger)
 {
-	static int num_mean_elements = 1;
-	static unsigned long mean_potential = PCKD_TRGR_INIT_MEAN_POTEN;
+	unsigned long mean_potential = mq->wr_trgr_mean_poten;
+	int num_mean_elements = mq->wr_trgr_num_elements;
 	unsigned int trigger = curr_trigger;
-	unsigned int pckd_trgr_upper_bound = card->ext_csd.max_packed_writes;
+	unsigned int pckd_trgr_upper_bound =
+		mq->card->ext_csd.max_packed_writes;
 
 	/* scale down the upper bound to 75% */
 	pckd_trgr_upper_bound = (pckd_trgr_upper_bound * 3) / 4;
@@ -2163,9 +2332,11 @@ static int get_packed_trigger(int potential, struct mmc_card *card,
 
 	/*
 	 * this is to prevent integer overflow in the following calculation:
-	 * once every PACKED_TRIGGER_MAX_ELEMENTS reset the algorithm
+	 * once every PACKED_TRIGGER_MAX_ELEMENTS reset the algorithm. The
+	 * history is per queue and starts out empty.
 	 */
-	if (num_mean_elements > PACKED_TRIGGER_MAX_ELEMENTS) {
+	if (!num_mean_elements ||
+	    num_mean_elements > PACKED_TRIGGER_MAX_ELEMENTS) {
 		num_mean_elements = 1;
 		mean_potential = PCKD_TRGR_INIT_MEAN_POTEN;
 	}
@@ -2190,6 +2361,9 @@ static int get_packed_trigger(int potential, struct mmc_card *card,
 	mean_potential /= ++num_mean_elements;
 	mean_potential /= PCKD_TRGR_PRECISION_MULTIPLIER;
 
+	mq->wr_trgr_mean_poten = mean_potential;
+	mq->wr_trgr_num_elements = num_mean_elements;
+
 	/*
 	 * if current potential packed writes is greater than the mean potential
 	 * then the heuristic is that the following workload will contain many
@@ -2212,9 +2386,98 @@ static int get_packed_trigger(int potential, struct mmc_card *card,
 	if (req && (req->cmd_flags & REQ_URGENT) && (rq_data_dir(req) == READ))
 		trigger += PCKD_TRGR_URGENT_PENALTY;
 
+	/*
+	 * while reads dominate the mix a long packed write mostly delays
+	 * them, so ask for a longer burst of writes before packing
+	 */
+	if ((mq->card->host->caps2 & MMC_CAP2_PACKED_RD_CONTROL) &&
+	    mq->rd_mix >= PCKD_RD_MIX_HEAVY && trigger < pckd_trgr_upper_bound)
+		trigger += PCKD_TRGR_RD_MIX_PENALTY;
+
 	return trigger;
 }
 
+/*
+ * Keep the running averages the packing policy works from: the share of
+ * reads among the requests issued, and the number of requests queued.
+ */
+static void mmc_blk_update_packing_mix(struct mmc_queue *mq,
+				       struct request *req)
+{
+	struct request_list *rl = &mq->queue->rq;
+	unsigned int depth;
+
+	if (!req || (req->cmd_flags & (REQ_DISCARD | REQ_FLUSH |
+				       REQ_SANITIZE)))
+		return;
+
+	mq->rd_mix -= mq->rd_mix >> PCKD_MIX_SHIFT;
+	if (rq_data_dir(req) == READ)
+		mq->rd_mix += MMC_PACK_MIX_ONE >> PCKD_MIX_SHIFT;
+
+	depth = rl->count[BLK_RW_SYNC] + rl->count[BLK_RW_ASYNC];
+	mq->depth_avg -= mq->depth_avg >> PCKD_MIX_SHIFT;
+	mq->depth_avg += (depth << MMC_PACK_DEPTH_SHIFT) >> PCKD_MIX_SHIFT;
+}
+
+static void mmc_blk_read_packing_control(struct mmc_queue *mq,
+					 struct request *req)
+{
+	struct mmc_card *card = mq->card;
+	struct mmc_host *host = card->host;
+
+	if (!(host->caps2 & MMC_CAP2_PACKED_RD) ||
+	    !card->ext_csd.max_packed_reads)
+		return;
+
+	/* Support for the read packing on eMMC 4.5 or later */
+	if (card->ext_csd.rev <= 5)
+		return;
+
+	/*
+	 * As for writes, without packing control on the host the reads
+	 * get packed whenever the queue allows
+	 */
+	if (!(host->caps2 & MMC_CAP2_PACKED_RD_CONTROL)) {
+		mq->rd_packing_enabled = true;
+		return;
+	}
+
+	if (!req || rq_data_dir(req) != READ)
+		return;
+
+	/*
+	 * A packed read costs an extra header transfer, and makes every
+	 * read in it wait for the whole pack. It only pays off while reads
+	 * are the bulk of the traffic and enough of them are queued to be
+	 * packed together.
+	 */
+	mq->rd_packing_enabled = mq->rd_mix >= PCKD_RD_MIX_HEAVY &&
+		(mq->depth_avg >> MMC_PACK_DEPTH_SHIFT) >=
+			mq->num_rd_reqs_to_start_packing;
+}
+
+/*
+ * Move the read trigger after each attempt to pack reads: an attempt that
+ * found nothing to pack with means the queue is shallower than the average
+ * suggested, a pack at least as long as the trigger means it can come down.
+ */
+static void mmc_blk_read_packing_feedback(struct mmc_queue *mq, u8 reqs,
+					  u8 max_packed_rd)
+{
+	int trigger = mq->num_rd_reqs_to_start_packing;
+
+	if (!(mq->card->host->caps2 & MMC_CAP2_PACKED_RD_CONTROL))
+		return;
+
+	if (!reqs)
+		trigger = min_t(int, trigger + 1, max_packed_rd);
+	else if (reqs + 1 >= trigger)
+		trigger = max_t(int, trigger - 1, PCKD_RD_TRGR_LOWER_BOUND);
+
+	mq->num_rd_reqs_to_start_packing = trigger;
+}
+
 static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 					  struct request *req)
 {
@@ -2244,7 +2507,7 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 			mq->wr_packing_enabled = true;
 		mq->num_wr_reqs_to_start_packing =
 			get_packed_trigger(mq->num_of_potential_packed_wr_reqs,
-					   mq->card, req,
+					   mq, req,
 					   mq->num_wr_reqs_to_start_packing);
 		mq->num_of_potential_packed_wr_reqs = 0;
 		return;
@@ -2256,7 +2519,7 @@ static void mmc_blk_write_packing_control(struct mmc_queue *mq,
 		mmc_blk_disable_wr_packing(mq);
 		mq->num_wr_reqs_to_start_packing =
 			get_packed_trigger(mq->num_of_potential_packed_wr_reqs,
-					   mq->card, req,
+					   mq, req,
 					   mq->num_wr_reqs_to_start_packing);
 		mq->num_of_potential_packed_wr_reqs = 0;
 		mq->wr_packing_enabled = false;
@@ -2300,6 +2563,25 @@ void mmc_blk_init_packed_statistics(struct mmc_card *card)
 }
 EXPORT_SYMBOL(mmc_blk_init_packed_statistics);
 
+void mmc_blk_init_rd_packed_statistics(struct mmc_queue *mq)
+{
+	struct mmc_wr_pack_stats *stats = &mq->rd_pack_stats;
+
+	memset(mq->pack_eff, 0, sizeof(mq->pack_eff));
+
+	if (!mq->card || !stats->packing_events)
+		return;
+
+	spin_lock(&stats->lock);
+	memset(stats->packing_events, 0,
+	       (mq->card->ext_csd.max_packed_reads + 1) *
+	       sizeof(*stats->packing_events));
+	memset(&stats->pack_stop_reason, 0, sizeof(stats->pack_stop_reason));
+	stats->enabled = true;
+	spin_unlock(&stats->lock);
+}
+EXPORT_SYMBOL(mmc_blk_init_rd_packed_statistics);
+
 static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 {
 	struct request_queue *q = mq->queue;
@@ -2320,12 +2602,17 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 			!card->ext_csd.packed_event_en)
 		goto no_packed;
 
-	if (!mq->wr_packing_enabled)
-		goto no_packed;
-
-	if ((rq_data_dir(cur) == WRITE) &&
-			(card->host->caps2 & MMC_CAP2_PACKED_WR))
+	if (rq_data_dir(cur) == READ) {
+		if (mq->rd_packing_enabled &&
+				(card->host->caps2 & MMC_CAP2_PACKED_RD))
+			max_packed_rw = min_t(u8,
+					      card->ext_csd.max_packed_reads,
+					      PACKED_CMD_MAX_ENTRIES);
+		stats = &mq->rd_pack_stats;
+	} else if (mq->wr_packing_enabled &&
+			(card->host->caps2 & MMC_CAP2_PACKED_WR)) {
 		max_packed_rw = card->ext_csd.max_packed_writes;
+	}
 
 	if (max_packed_rw == 0)
 		goto no_packed;
@@ -2443,7 +2730,7 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	}
 
 	if (stats->enabled) {
-		if (reqs + 1 <= card->ext_csd.max_packed_writes)
+		if (reqs + 1 <= max_packed_rw)
 			stats->packing_events[reqs + 1]++;
 		if (reqs + 1 == max_packed_rw)
 			MMC_BLK_UPDATE_STOP_REASON(stats, THRESHOLD);
@@ -2451,6 +2738,9 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 
 	spin_unlock(&stats->lock);
 
+	if (rq_data_dir(req) == READ)
+		mmc_blk_read_packing_feedback(mq, reqs, max_packed_rw);
+
 	if (reqs > 0) {
 		list_add(&req->queuelist, &mq->mqrq_cur->packed_list);
 		mq->mqrq_cur->packed_num = ++reqs;
@@ -2559,6 +2849,139 @@ static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
 	mmc_queue_bounce_pre(mqrq);
 }
 
+/*
+ * A packed read goes out in two steps: first the header is written with
+ * CMD25, announcing the CMD18s the card should serve, then the data of all
+ * of them is read with a single CMD18. mmc_active starts the header write,
+ * mmc_blk_packed_rd_err_check() runs the read once it is done.
+ */
+static void mmc_blk_packed_hdr_rrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *hdr_brq = &mqrq->packed_hdr_brq;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	struct request *prq;
+	u32 *packed_cmd_hdr = mqrq->packed_cmd_hdr;
+	u8 i = 1;
+
+	mqrq->packed_cmd = MMC_PACKED_READ;
+	mqrq->packed_blocks = 0;
+	mqrq->packed_fail_idx = MMC_PACKED_N_IDX;
+
+	memset(packed_cmd_hdr, 0, sizeof(mqrq->packed_cmd_hdr));
+	packed_cmd_hdr[0] = (mqrq->packed_num << 16) |
+		(PACKED_CMD_RD << 8) | PACKED_CMD_VER;
+
+	/*
+	 * Argument for each entry of packed group
+	 */
+	list_for_each_entry(prq, &mqrq->packed_list, queuelist) {
+		/* Argument of CMD23 */
+		packed_cmd_hdr[(i * 2)] = blk_rq_sectors(prq);
+		/* Argument of CMD18 */
+		packed_cmd_hdr[((i * 2)) + 1] =
+			mmc_card_blockaddr(card) ?
+			blk_rq_pos(prq) : blk_rq_pos(prq) << 9;
+		mqrq->packed_blocks += blk_rq_sectors(prq);
+		i++;
+	}
+
+	memset(hdr_brq, 0, sizeof(struct mmc_blk_request));
+	hdr_brq->mrq.cmd = &hdr_brq->cmd;
+	hdr_brq->mrq.data = &hdr_brq->data;
+	hdr_brq->mrq.sbc = &hdr_brq->sbc;
+	hdr_brq->mrq.stop = &hdr_brq->stop;
+
+	hdr_brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	hdr_brq->sbc.arg = MMC_CMD23_ARG_PACKED | 1;
+	hdr_brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	hdr_brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	hdr_brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		hdr_brq->cmd.arg <<= 9;
+	hdr_brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	hdr_brq->data.blksz = 512;
+	hdr_brq->data.blocks = 1;
+	hdr_brq->data.flags |= MMC_DATA_WRITE;
+
+	hdr_brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	hdr_brq->stop.arg = 0;
+	hdr_brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&hdr_brq->data, card);
+
+	sg_init_one(&mqrq->packed_hdr_sg, packed_cmd_hdr,
+		    sizeof(mqrq->packed_cmd_hdr));
+	hdr_brq->data.sg = &mqrq->packed_hdr_sg;
+	hdr_brq->data.sg_len = 1;
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.stop = &brq->stop;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | mqrq->packed_blocks;
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq->cmd.opcode = MMC_READ_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = mqrq->packed_blocks;
+	brq->data.flags |= MMC_DATA_READ;
+	brq->data.fault_injected = false;
+
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &hdr_brq->mrq;
+	mqrq->mmc_active.cmd_flags = req->cmd_flags;
+
+	/*
+	 * The data phase is only run from mmc_blk_packed_rd_err_check(), so a
+	 * test err_check_fn is called from there rather than installed here.
+	 */
+	mqrq->mmc_active.err_check = mmc_blk_packed_rd_err_check;
+
+	/*
+	 * This is intended for packed commands tests usage - in case these
+	 * functions are not in use the respective pointers are NULL
+	 */
+	if (mq->packed_test_fn)
+		mq->packed_test_fn(mq->queue, mqrq);
+
+	mqrq->mmc_active.reinsert_req = mmc_blk_reinsert_req;
+	mqrq->mmc_active.update_interrupted_req =
+		mmc_blk_update_interrupted_req;
+
+	mmc_queue_bounce_pre(mqrq);
+}
+
+static void mmc_blk_packed_prep(struct mmc_queue_req *mqrq,
+				struct mmc_card *card,
+				struct mmc_queue *mq)
+{
+	if (rq_data_dir(mqrq->req) == READ)
+		mmc_blk_packed_hdr_rrq_prep(mqrq, card, mq);
+	else
+		mmc_blk_packed_hdr_wrq_prep(mqrq, card, mq);
+}
+
 static int mmc_blk_cmd_err(struct mmc_blk_data *md, struct mmc_card *card,
 			   struct mmc_blk_request *brq, struct request *req,
 			   int ret)
@@ -2673,13 +3096,18 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		if ((card->ext_csd.bkops_en) && (rq_data_dir(rqc) == WRITE))
 			card->bkops_info.sectors_changed += blk_rq_sectors(rqc);
 		reqs = mmc_blk_prep_packed_list(mq, rqc);
+		if (reqs >= packed_num) {
+			mq->pack_eff[rq_data_dir(rqc)].packed_cmds++;
+			mq->pack_eff[rq_data_dir(rqc)].packed_reqs += reqs;
+		} else {
+			mq->pack_eff[rq_data_dir(rqc)].single_reqs++;
+		}
 	}
 
 	do {
 		if (rqc) {
 			if (reqs >= packed_num)
-				mmc_blk_packed_hdr_wrq_prep(mq->mqrq_cur,
-						card, mq);
+				mmc_blk_packed_prep(mq->mqrq_cur, card, mq);
 			else
 				mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
 			areq = &mq->mqrq_cur->mmc_active;
@@ -2771,14 +3199,31 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			int err;
 
 			err = mmc_blk_reset(md, card->host, type);
-			if (!err)
+			if (err == -ENODEV)
+				goto cmd_abort;
+			/*
+			 * A bad sector fails the whole packed read, which is
+			 * then unpacked below rather than resent as is.
+			 */
+			if (!err && mq_rq->packed_cmd != MMC_PACKED_READ)
 				break;
-			if (err == -ENODEV ||
-				mq_rq->packed_cmd != MMC_PACKED_NONE)
+			if (mq_rq->packed_cmd == MMC_PACKED_WRITE)
 				goto cmd_abort;
 			/* Fall through */
 		}
 		case MMC_BLK_ECC_ERR:
+			if (mq_rq->packed_cmd == MMC_PACKED_READ) {
+				/*
+				 * Redo the packed requests one by one, so
+				 * that the error ends only the request that
+				 * holds the bad sector. The others are put
+				 * back on the queue.
+				 */
+				pr_warning("%s: unpacking failed packed read\n",
+					   req->rq_disk->disk_name);
+				mmc_blk_revert_packed_req(mq, mq_rq);
+				break;
+			}
 			if (brq->data.blocks > 1) {
 				/* Redo read one sector at a time */
 				pr_warning("%s: retrying using single block read\n",
@@ -2828,7 +3273,7 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			} else {
 				if (!mq_rq->packed_retries)
 					goto cmd_abort;
-				mmc_blk_packed_hdr_wrq_prep(mq_rq, card, mq);
+				mmc_blk_packed_prep(mq_rq, card, mq);
 				mmc_start_req(card->host,
 						&mq_rq->mmc_active, NULL);
 			}
@@ -2904,7 +3349,9 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		goto out;
 	}
 
+	mmc_blk_update_packing_mix(mq, req);
 	mmc_blk_write_packing_control(mq, req);
+	mmc_blk_read_packing_control(mq, req);
 
 	clear_bit(MMC_QUEUE_NEW_REQUEST, &mq->flags);
 	clear_bit(MMC_QUEUE_URGENT_REQUEST, &mq->flags);
@@ -3171,6 +3618,9 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 		card = md->queue.card;
 		device_remove_file(disk_to_dev(md->disk),
 				   &md->num_wr_reqs_to_start_packing);
+		device_remove_file(disk_to_dev(md->disk),
+				   &md->num_rd_reqs_to_start_packing);
+		device_remove_file(disk_to_dev(md->disk), &md->packing_stats);
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 			if ((md->area_type & MMC_BLK_DATA_AREA_BOOT) &&
@@ -3271,8 +3721,35 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	if (ret)
 		goto no_pack_for_random_fails;
 
+	md->num_rd_reqs_to_start_packing.show =
+		num_rd_reqs_to_start_packing_show;
+	md->num_rd_reqs_to_start_packing.store =
+		num_rd_reqs_to_start_packing_store;
+	sysfs_attr_init(&md->num_rd_reqs_to_start_packing.attr);
+	md->num_rd_reqs_to_start_packing.attr.name =
+		"num_rd_reqs_to_start_packing";
+	md->num_rd_reqs_to_start_packing.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk),
+				 &md->num_rd_reqs_to_start_packing);
+	if (ret)
+		goto num_rd_reqs_to_start_packing_fail;
+
+	md->packing_stats.show = packing_stats_show;
+	md->packing_stats.store = packing_stats_store;
+	sysfs_attr_init(&md->packing_stats.attr);
+	md->packing_stats.attr.name = "packing_stats";
+	md->packing_stats.attr.mode = S_IRUGO | S_IWUSR;
+	ret = device_create_file(disk_to_dev(md->disk), &md->packing_stats);
+	if (ret)
+		goto packing_stats_fail;
+
 	return ret;
 
+packing_stats_fail:
+	device_remove_file(disk_to_dev(md->disk),
+			   &md->num_rd_reqs_to_start_packing);
+num_rd_reqs_to_start_packing_fail:
+	device_remove_file(disk_to_dev(md->disk), &md->no_pack_for_random);
 no_pack_for_random_fails:
 	device_remove_file(disk_to_dev(md->disk),
 			   &md->bkops_check_threshold);
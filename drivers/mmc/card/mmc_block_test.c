@@ -33,6 +33,9 @@
 #define PACKED_HDR_RW_MASK 0x0000FF00
 #define PACKED_HDR_NUM_REQS_MASK 0x00FF0000
 #define PACKED_HDR_BITS_16_TO_29_SET 0x3FFF0000
+#define PACKED_RD_MAX_ENTRIES	63 /* entries a packed header block holds */
+/* reads the packing policy sees before it trusts a read heavy mix */
+#define TEST_RD_COLD_MIX_REQS	8
 #define SECTOR_SIZE 512
 #define NUM_OF_SECTORS_PER_BIO		((BIO_U32_SIZE * 4) / SECTOR_SIZE)
 #define BIO_TO_SECTOR(x)		(x * NUM_OF_SECTORS_PER_BIO)
@@ -157,6 +160,16 @@ enum mmc_block_test_testcases {
 	TEST_LONG_SEQUENTIAL_WRITE,
 
 	TEST_NEW_REQ_NOTIFICATION,
+
+	/* Start of send read packing test group */
+	SEND_READ_PACKING_MIN_TESTCASE,
+	TEST_RD_STOP_DUE_TO_EMPTY_QUEUE = SEND_READ_PACKING_MIN_TESTCASE,
+	TEST_RD_STOP_DUE_TO_WRITE,
+	TEST_RD_STOP_DUE_TO_MAX_REQ_NUM,
+	TEST_RD_RET_PARTIAL_FOLLOWED_BY_SUCCESS,
+	TEST_RD_PACKING_NOT_EXP_WRITE_MIX,
+	TEST_RD_PACKING_EXP_READ_MIX,
+	SEND_READ_PACKING_MAX_TESTCASE = TEST_RD_PACKING_EXP_READ_MIX,
 };
 
 enum mmc_block_test_group {
@@ -168,6 +181,7 @@ enum mmc_block_test_group {
 	TEST_PACKING_CONTROL_GROUP,
 	TEST_BKOPS_GROUP,
 	TEST_NEW_NOTIFICATION_GROUP,
+	TEST_SEND_READ_PACKING_GROUP,
 };
 
 enum bkops_test_stages {
@@ -188,6 +202,7 @@ struct mmc_block_test_debug {
 	struct dentry *long_sequential_read_test;
 	struct dentry *long_sequential_write_test;
 	struct dentry *new_req_notification_test;
+	struct dentry *send_read_packing_test;
 };
 
 struct mmc_block_test_data {
@@ -225,6 +240,12 @@ struct mmc_block_test_data {
 	wait_queue_head_t bkops_wait_q;
 	/* A counter for the number of test requests completed */
 	unsigned int completed_req_count;
+	/* The expected read packing statistics for the current test */
+	struct mmc_wr_pack_stats exp_rd_packed_stats;
+	/* Packed read commands found malformed by test_check_packed_rd_cmd */
+	int rd_hdr_errors;
+	/* Host caps2 before the read packing tests changed them */
+	unsigned int saved_caps2;
 };
 
 static struct mmc_block_test_data *mbtd;
@@ -427,6 +448,61 @@ static void test_invalid_packed_cmd(struct request_queue *q,
 	}
 }
 
+/*
+ * A callback assigned to the packed_test_fn field in the read packing tests.
+ * Called from block layer in mmc_blk_packed_hdr_rrq_prep.
+ * Here we check that the packed read about to be sent is well formed: the
+ * header lists every request of the pack, and the CMD23s of the header
+ * write and of the data read carry the right block counts.
+ */
+static void test_check_packed_rd_cmd(struct request_queue *q,
+				     struct mmc_queue_req *mqrq)
+{
+	struct mmc_queue *mq = q->queuedata;
+	struct mmc_card *card = mq->card;
+	u32 *packed_cmd_hdr = mqrq->packed_cmd_hdr;
+	struct request *prq;
+	u32 addr;
+	int i = 1;
+
+	if (mqrq->packed_cmd != MMC_PACKED_READ)
+		return;
+
+	if ((packed_cmd_hdr[0] & PACKED_HDR_VER_MASK) != 1 ||
+	    ((packed_cmd_hdr[0] & PACKED_HDR_RW_MASK) >> 8) != 1 ||
+	    ((packed_cmd_hdr[0] & PACKED_HDR_NUM_REQS_MASK) >> 16) !=
+			mqrq->packed_num) {
+		test_pr_err("%s: bad packed read header 0x%x, %d reqs",
+			    __func__, packed_cmd_hdr[0], mqrq->packed_num);
+		mbtd->rd_hdr_errors++;
+	}
+
+	list_for_each_entry(prq, &mqrq->packed_list, queuelist) {
+		addr = mmc_card_blockaddr(card) ?
+			blk_rq_pos(prq) : blk_rq_pos(prq) << 9;
+		if (packed_cmd_hdr[i * 2] != blk_rq_sectors(prq) ||
+		    packed_cmd_hdr[i * 2 + 1] != addr) {
+			test_pr_err("%s: bad entry %d: %u@0x%x, expected %u@0x%x",
+				    __func__, i, packed_cmd_hdr[i * 2],
+				    packed_cmd_hdr[i * 2 + 1],
+				    blk_rq_sectors(prq), addr);
+			mbtd->rd_hdr_errors++;
+		}
+		i++;
+	}
+
+	if (mqrq->packed_hdr_brq.sbc.arg != (CMD23_PACKED_BIT | 1) ||
+	    mqrq->packed_hdr_brq.cmd.opcode != MMC_WRITE_MULTIPLE_BLOCK ||
+	    mqrq->brq.sbc.arg != (CMD23_PACKED_BIT | mqrq->packed_blocks) ||
+	    mqrq->brq.cmd.opcode != MMC_READ_MULTIPLE_BLOCK) {
+		test_pr_err("%s: bad commands: hdr CMD%d arg 0x%x, data CMD%d arg 0x%x",
+			    __func__, mqrq->packed_hdr_brq.cmd.opcode,
+			    mqrq->packed_hdr_brq.sbc.arg,
+			    mqrq->brq.cmd.opcode, mqrq->brq.sbc.arg);
+		mbtd->rd_hdr_errors++;
+	}
+}
+
 /*
  * A callback assigned to the err_check_fn field of the mmc_request by the
  * MMC/card/block layer.
@@ -471,6 +547,7 @@ static int test_err_check(struct mmc_card *card, struct mmc_async_req *areq)
 		ret = MMC_BLK_ABORT;
 		break;
 	case TEST_RET_PARTIAL_FOLLOWED_BY_SUCCESS:
+	case TEST_RD_RET_PARTIAL_FOLLOWED_BY_SUCCESS:
 		test_pr_info("%s: return partial followed by success",
 			      __func__);
 		/*
@@ -661,6 +738,18 @@ switch (td->test_info.testcase) {
 		return "\"long sequential write\"";
 	case TEST_NEW_REQ_NOTIFICATION:
 		return "\"new request notification test\"";
+	case TEST_RD_STOP_DUE_TO_EMPTY_QUEUE:
+		return "\"read packing - stop due to empty queue\"";
+	case TEST_RD_STOP_DUE_TO_WRITE:
+		return "\"read packing - stop due to write\"";
+	case TEST_RD_STOP_DUE_TO_MAX_REQ_NUM:
+		return "\"read packing - stop due to max req num\"";
+	case TEST_RD_RET_PARTIAL_FOLLOWED_BY_SUCCESS:
+		return "\"read packing - partial followed by success\"";
+	case TEST_RD_PACKING_NOT_EXP_WRITE_MIX:
+		return "\"read packing control - no packing, write mix\"";
+	case TEST_RD_PACKING_EXP_READ_MIX:
+		return "\"read packing control - pack, read mix\"";
 	default:
 		return " Unknown testcase";
 	}
@@ -1622,6 +1711,258 @@ static int validate_packed_commands_settings(void)
 	return 0;
 }
 
+static int get_max_packed_rd_reqs(struct mmc_queue *mq)
+{
+	return min_t(int, mq->card->ext_csd.max_packed_reads,
+		     PACKED_RD_MAX_ENTRIES);
+}
+
+/*
+ * Check that the card and the host can do packed reads, and turn them on
+ * in the host for the duration of the tests
+ */
+static int validate_packed_rd_settings(void)
+{
+	struct request_queue *req_q;
+	struct mmc_queue *mq;
+	struct mmc_card *card;
+
+	req_q = test_iosched_get_req_queue();
+	if (!req_q) {
+		test_pr_err("%s: test_iosched_get_req_queue failed", __func__);
+		test_iosched_set_test_result(TEST_FAILED);
+		return -EINVAL;
+	}
+
+	mq = req_q->queuedata;
+	if (!mq) {
+		test_pr_err("%s: NULL mq", __func__);
+		return -EINVAL;
+	}
+	card = mq->card;
+
+	if (card->ext_csd.rev <= 5 || !card->ext_csd.packed_event_en ||
+	    get_max_packed_rd_reqs(mq) < 3) {
+		test_pr_err(
+		"%s: no read packing support, ext_csd.max_packed_reads=%d",
+		__func__, card->ext_csd.max_packed_reads);
+		test_iosched_set_test_result(TEST_NOT_SUPPORTED);
+		return -EINVAL;
+	}
+
+	if (!mbtd->exp_rd_packed_stats.packing_events ||
+	    !mq->rd_pack_stats.packing_events) {
+		test_pr_err("%s: NULL read packing_events", __func__);
+		return -EINVAL;
+	}
+
+	mbtd->saved_caps2 = card->host->caps2;
+	card->host->caps2 |= MMC_CAP2_PACKED_RD;
+
+	test_pr_info("%s: max number of packed reads supported is %d ",
+		     __func__, get_max_packed_rd_reqs(mq));
+
+	return 0;
+}
+
+/* Hand read packing back to the host configuration */
+static void restore_packed_rd_settings(void)
+{
+	struct request_queue *req_q = test_iosched_get_req_queue();
+	struct mmc_queue *mq = req_q ? req_q->queuedata : NULL;
+	unsigned int caps = MMC_CAP2_PACKED_RD | MMC_CAP2_PACKED_RD_CONTROL;
+
+	if (!mq)
+		return;
+
+	mq->card->host->caps2 &= ~caps;
+	mq->card->host->caps2 |= mbtd->saved_caps2 & caps;
+}
+
+/*
+ * Prepare the read requests of a read packing testcase, and the read
+ * packing statistics expected once they are done
+ */
+static int prepare_packed_rd_requests(struct test_data *td)
+{
+	struct mmc_queue *mq = td->req_q->queuedata;
+	struct mmc_wr_pack_stats *exp = &mbtd->exp_rd_packed_stats;
+	int max_packed_reqs = get_max_packed_rd_reqs(mq);
+	unsigned int *seed = &mbtd->random_test_seed;
+	unsigned int start_sec = td->start_sector;
+	unsigned int num_bios;
+	int num_requests;
+	int i, ret;
+
+	if (mbtd->random_test_seed <= 0) {
+		mbtd->random_test_seed =
+			(unsigned int)(get_jiffies_64() & 0xFFFF);
+		test_pr_info("%s: got seed from jiffies %d",
+			     __func__, mbtd->random_test_seed);
+	}
+
+	if (mbtd->is_random)
+		num_requests = pseudo_random_seed(seed, 2,
+						  max_packed_reqs - 1);
+	else
+		num_requests = max_packed_reqs - 1;
+
+	switch (td->test_info.testcase) {
+	case TEST_RD_STOP_DUE_TO_MAX_REQ_NUM:
+		num_requests = max_packed_reqs;
+		break;
+	case TEST_RD_PACKING_NOT_EXP_WRITE_MIX:
+		num_requests = min(num_requests, TEST_RD_COLD_MIX_REQS);
+		break;
+	default:
+		break;
+	}
+
+	test_pr_info("%s: Adding %d read requests, first req_id=%d",
+		     __func__, num_requests, td->wr_rd_next_req_id);
+
+	for (i = 1; i <= num_requests; i++) {
+		if (mbtd->is_random)
+			pseudo_rnd_num_of_bios(seed, &num_bios);
+		else
+			num_bios = (i % 5) + 1;
+
+		ret = test_iosched_add_wr_rd_test_req(0, READ, start_sec,
+				num_bios, TEST_NO_PATTERN, NULL);
+		if (ret) {
+			test_pr_err("%s: failed to add a read request",
+				    __func__);
+			return ret;
+		}
+		start_sec += BIO_TO_SECTOR(num_bios);
+	}
+
+	memset(exp->pack_stop_reason, 0, sizeof(exp->pack_stop_reason));
+	memset(exp->packing_events, 0,
+	       (mq->card->ext_csd.max_packed_reads + 1) *
+	       sizeof(*exp->packing_events));
+
+	switch (td->test_info.testcase) {
+	case TEST_RD_STOP_DUE_TO_WRITE:
+		ret = test_iosched_add_wr_rd_test_req(0, WRITE, start_sec, 1,
+				TEST_PATTERN_5A, NULL);
+		if (ret) {
+			test_pr_err("%s: failed to add a write request",
+				    __func__);
+			return ret;
+		}
+		exp->packing_events[num_requests] = 1;
+		exp->pack_stop_reason[WRONG_DATA_DIR] = 1;
+		break;
+	case TEST_RD_STOP_DUE_TO_MAX_REQ_NUM:
+		exp->packing_events[num_requests] = 1;
+		exp->pack_stop_reason[THRESHOLD] = 1;
+		break;
+	case TEST_RD_PACKING_NOT_EXP_WRITE_MIX:
+		/* the reads go out one by one, nothing gets counted */
+		break;
+	case TEST_RD_RET_PARTIAL_FOLLOWED_BY_SUCCESS:
+		mq->err_check_fn = test_err_check;
+		/* Fall through */
+	default:
+		exp->packing_events[num_requests] = 1;
+		exp->pack_stop_reason[EMPTY_QUEUE] = 1;
+	}
+
+	mbtd->num_requests = num_requests;
+	mbtd->rd_hdr_errors = 0;
+	mq->packed_test_fn = test_check_packed_rd_cmd;
+
+	return 0;
+}
+
+static int run_packed_rd_test(struct test_data *td)
+{
+	struct mmc_queue *mq = td->req_q->queuedata;
+	struct mmc_host *host = mq->card->host;
+
+	mmc_blk_init_rd_packed_statistics(mq);
+
+	/*
+	 * The stop reason testcases pack whatever is queued, the packing
+	 * control ones start the policy from a known history
+	 */
+	switch (td->test_info.testcase) {
+	case TEST_RD_PACKING_NOT_EXP_WRITE_MIX:
+		host->caps2 |= MMC_CAP2_PACKED_RD_CONTROL;
+		mq->rd_mix = 0;
+		mq->depth_avg = 0;
+		break;
+	case TEST_RD_PACKING_EXP_READ_MIX:
+		host->caps2 |= MMC_CAP2_PACKED_RD_CONTROL;
+		mq->rd_mix = MMC_PACK_MIX_ONE;
+		mq->depth_avg = mbtd->num_requests << MMC_PACK_DEPTH_SHIFT;
+		mq->num_rd_reqs_to_start_packing =
+			min(mq->num_rd_reqs_to_start_packing,
+			    mbtd->num_requests / 2);
+		break;
+	default:
+		host->caps2 &= ~MMC_CAP2_PACKED_RD_CONTROL;
+		break;
+	}
+	mq->rd_packing_enabled = false;
+
+	__blk_run_queue(td->req_q);
+
+	return 0;
+}
+
+/*
+ * Compare the read packing statistics of the queue to the expected ones,
+ * and check that no malformed packed read was sent
+ */
+static int check_rd_packing_statistics(struct test_data *td)
+{
+	struct mmc_queue *mq = td->req_q->queuedata;
+	struct mmc_wr_pack_stats *stats = &mq->rd_pack_stats;
+	struct mmc_wr_pack_stats *exp = &mbtd->exp_rd_packed_stats;
+	int max_packed_reqs = get_max_packed_rd_reqs(mq);
+	int i, ret = 0;
+
+	if (mbtd->rd_hdr_errors) {
+		test_pr_err("%s: %d malformed packed reads", __func__,
+			    mbtd->rd_hdr_errors);
+		return -EINVAL;
+	}
+
+	spin_lock(&stats->lock);
+
+	for (i = 1; i <= max_packed_reqs; ++i) {
+		if (stats->packing_events[i] != exp->packing_events[i]) {
+			test_pr_err(
+			"%s: Wrong pack stats in index %d, got %d, expected %d",
+			__func__, i, stats->packing_events[i],
+			       exp->packing_events[i]);
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	for (i = 0; !ret && i < MAX_REASONS; ++i) {
+		if (stats->pack_stop_reason[i] != exp->pack_stop_reason[i]) {
+			test_pr_err(
+			"%s: Wrong pack stop reason %d: got %d, expected %d",
+			__func__, i, stats->pack_stop_reason[i],
+			       exp->pack_stop_reason[i]);
+			ret = -EINVAL;
+		}
+	}
+
+	spin_unlock(&stats->lock);
+
+	if (ret && td->fs_wr_reqs_during_test) {
+		test_iosched_set_ignore_round(true);
+		return 0;
+	}
+
+	return ret;
+}
+
 static void pseudo_rnd_sector_and_size(unsigned int *seed,
 				       unsigned int min_start_sector,
 				       unsigned int *start_sector,
@@ -3094,6 +3435,110 @@ const struct file_operations new_req_notification_test_ops = {
 	.read = new_req_notification_test_read,
 };
 
+/* send_read_packing TEST */
+static ssize_t send_read_packing_test_write(struct file *file,
+				const char __user *buf,
+				size_t count,
+				loff_t *ppos)
+{
+	int ret = 0;
+	int i = 0;
+	int number = -1;
+	int j = 0;
+
+	test_pr_info("%s: -- send_read_packing TEST --", __func__);
+
+	sscanf(buf, "%d", &number);
+
+	if (number <= 0)
+		number = 1;
+
+	mbtd->test_group = TEST_SEND_READ_PACKING_GROUP;
+
+	if (validate_packed_rd_settings())
+		return count;
+
+	if (mbtd->random_test_seed > 0)
+		test_pr_info("%s: Test seed: %d", __func__,
+			      mbtd->random_test_seed);
+
+	memset(&mbtd->test_info, 0, sizeof(struct test_info));
+
+	mbtd->test_info.data = mbtd;
+	mbtd->test_info.prepare_test_fn = prepare_packed_rd_requests;
+	mbtd->test_info.run_test_fn = run_packed_rd_test;
+	mbtd->test_info.check_test_result_fn = check_rd_packing_statistics;
+	mbtd->test_info.get_test_case_str_fn = get_test_case_str;
+	mbtd->test_info.post_test_fn = post_test;
+
+	for (i = 0; i < number; ++i) {
+		test_pr_info("%s: Cycle # %d / %d", __func__, i+1, number);
+		test_pr_info("%s: ====================", __func__);
+
+		for (j = SEND_READ_PACKING_MIN_TESTCASE;
+		      j <= SEND_READ_PACKING_MAX_TESTCASE; j++) {
+
+			mbtd->test_info.testcase = j;
+			mbtd->is_random = RANDOM_TEST;
+			ret = test_iosched_start_test(&mbtd->test_info);
+			if (ret)
+				break;
+			/* Allow FS requests to be dispatched */
+			msleep(1000);
+			mbtd->test_info.testcase = j;
+			mbtd->is_random = NON_RANDOM_TEST;
+			ret = test_iosched_start_test(&mbtd->test_info);
+			if (ret)
+				break;
+			/* Allow FS requests to be dispatched */
+			msleep(1000);
+		}
+	}
+
+	test_pr_info("%s: Completed all the test cases.", __func__);
+
+	restore_packed_rd_settings();
+
+	return count;
+}
+
+static ssize_t send_read_packing_test_read(struct file *file,
+			       char __user *buffer,
+			       size_t count,
+			       loff_t *offset)
+{
+	if (!access_ok(VERIFY_WRITE, buffer, count))
+		return count;
+
+	memset((void *)buffer, 0, count);
+
+	snprintf(buffer, count,
+		 "\nsend_read_packing_test\n"
+		 "=========\n"
+		 "Description:\n"
+		 "This test checks the following scenarios\n"
+		 "- Pack reads until the queue is empty\n"
+		 "- Pack reads until a write\n"
+		 "- Pack the max number of reads\n"
+		 "- Card reports a partial packed read, then success\n"
+		 "- Packing control: no read packing after a write mix\n"
+		 "- Packing control: read packing after a read mix\n"
+		 "Each packed read is checked for a well formed header\n");
+
+	if (message_repeat == 1) {
+		message_repeat = 0;
+		return strnlen(buffer, count);
+	} else {
+		return 0;
+	}
+}
+
+const struct file_operations send_read_packing_test_ops = {
+	.open = test_open,
+	.write = send_read_packing_test_write,
+	.read = send_read_packing_test_read,
+};
+
 static void mmc_block_test_debugfs_cleanup(void)
 {
 	debugfs_remove(mbtd->debug.random_test_seed);
@@ -3106,6 +3551,7 @@ static void mmc_block_test_debugfs_cleanup(void)
 	debugfs_remove(mbtd->debug.long_sequential_read_test);
 	debugfs_remove(mbtd->debug.long_sequential_write_test);
 	debugfs_remove(mbtd->debug.new_req_notification_test);
+	debugfs_remove(mbtd->debug.send_read_packing_test);
 }
 
 static int mmc_block_test_debugfs_init(void)
@@ -3218,6 +3664,16 @@ static int mmc_block_test_debugfs_init(void)
 	if (!mbtd->debug.long_sequential_write_test)
 		goto err_nomem;
 
+	mbtd->debug.send_read_packing_test =
+		debugfs_create_file("send_read_packing_test",
+				    S_IRUGO | S_IWUGO,
+				    tests_root,
+				    NULL,
+				    &send_read_packing_test_ops);
+
+	if (!mbtd->debug.send_read_packing_test)
+		goto err_nomem;
+
 	return 0;
 
 err_nomem:
@@ -3248,6 +3704,11 @@ static void mmc_block_test_probe(void)
 				sizeof(*mbtd->exp_packed_stats.packing_events),
 				GFP_KERNEL);
 
+	mbtd->exp_rd_packed_stats.packing_events =
+		kzalloc((mq->card->ext_csd.max_packed_reads + 1) *
+			sizeof(*mbtd->exp_rd_packed_stats.packing_events),
+			GFP_KERNEL);
+
 	mmc_block_test_debugfs_init();
 }
 
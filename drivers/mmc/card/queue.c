@@ -31,6 +31,13 @@
  */
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
 
+/*
+ * Reads are packed only while this many requests are queued on average,
+ * see mmc_blk_read_packing_control(). The packing policy moves it from
+ * here according to how full the read packs turn out.
+ */
+#define DEFAULT_NUM_RD_REQS_TO_START_PACK 4
+
 /*
  * Prepare a MMC request. This just filters out odd stuff.
  */
@@ -281,6 +288,20 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	mq->num_wr_reqs_to_start_packing =
 		min_t(int, (int)card->ext_csd.max_packed_writes,
 		     DEFAULT_NUM_REQS_TO_START_PACK);
+	mq->num_rd_reqs_to_start_packing =
+		min_t(int, (int)card->ext_csd.max_packed_reads,
+		     DEFAULT_NUM_RD_REQS_TO_START_PACK);
+
+	/* read packing statistics are per queue, and on from the start */
+	spin_lock_init(&mq->rd_pack_stats.lock);
+	if (card->ext_csd.max_packed_reads) {
+		mq->rd_pack_stats.packing_events = kzalloc(
+			(card->ext_csd.max_packed_reads + 1) *
+			sizeof(*mq->rd_pack_stats.packing_events),
+			GFP_KERNEL);
+		mq->rd_pack_stats.enabled =
+			mq->rd_pack_stats.packing_events != NULL;
+	}
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
@@ -415,6 +436,9 @@ success:
 	kfree(mqrq_prev->bounce_buf);
 	mqrq_prev->bounce_buf = NULL;
 
+	kfree(mq->rd_pack_stats.packing_events);
+	mq->rd_pack_stats.packing_events = NULL;
+
 	blk_cleanup_queue(mq->queue);
 	return ret;
 }
@@ -456,6 +480,9 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	kfree(mqrq_prev->bounce_buf);
 	mqrq_prev->bounce_buf = NULL;
 
+	kfree(mq->rd_pack_stats.packing_events);
+	mq->rd_pack_stats.packing_events = NULL;
+
 	mq->card = NULL;
 }
 EXPORT_SYMBOL(mmc_cleanup_queue);
@@ -15,11 +15,14 @@ struct mmc_blk_request {
 enum mmc_packed_cmd {
 	MMC_PACKED_NONE = 0,
 	MMC_PACKED_WRITE,
+	MMC_PACKED_READ,
 };
 
 struct mmc_queue_req {
 	struct request		*req;
 	struct mmc_blk_request	brq;
+	struct mmc_blk_request	packed_hdr_brq;	/* packed read header */
+	struct scatterlist	packed_hdr_sg;
 	struct scatterlist	*sg;
 	char			*bounce_buf;
 	struct scatterlist	*bounce_sg;
@@ -34,6 +37,20 @@ struct mmc_queue_req {
 	u8		packed_num;
 };
 
+/*
+ * How well the requests of one data direction got packed, exported
+ * through the packing_stats attribute of the disk
+ */
+struct mmc_pack_eff {
+	unsigned long		packed_cmds;	/* packed commands issued */
+	unsigned long		packed_reqs;	/* requests carried by them */
+	unsigned long		single_reqs;	/* requests issued alone */
+};
+
+/* fixed point of the packing policy averages in struct mmc_queue */
+#define MMC_PACK_MIX_ONE	256	/* rd_mix of a read only workload */
+#define MMC_PACK_DEPTH_SHIFT	4	/* fraction bits of depth_avg */
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
@@ -53,6 +70,14 @@ struct mmc_queue {
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
 	bool			no_pack_for_random;
+	unsigned long		wr_trgr_mean_poten;
+	int			wr_trgr_num_elements;
+	bool			rd_packing_enabled;
+	int			num_rd_reqs_to_start_packing;
+	unsigned int		rd_mix;		/* running share of reads */
+	unsigned int		depth_avg;	/* running queue depth */
+	struct mmc_wr_pack_stats rd_pack_stats;	/* same as card's, for reads */
+	struct mmc_pack_eff	pack_eff[2];	/* indexed by READ/WRITE */
 	int (*err_check_fn) (struct mmc_card *, struct mmc_async_req *);
 	void (*packed_test_fn) (struct request_queue *, struct mmc_queue_req *);
 };
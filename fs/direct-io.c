@@ -130,6 +130,8 @@ struct dio {
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct request_queue *poll_q;	/* poll for the last bio on this */
+	ktime_t poll_start;		/* when the last bio was submitted */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -425,6 +427,14 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 
 	bio->bi_dio_inode = dio->inode;
 
+	if (!dio->is_async) {
+		struct request_queue *q = bdev_get_queue(bio->bi_bdev);
+
+		dio->poll_q = blk_poll_wanted(q) ? q : NULL;
+		if (dio->poll_q)
+			dio->poll_start = ktime_get();
+	}
+
 	if (sdio->submit_io)
 		sdio->submit_io(dio->rw, bio, dio->inode,
 			       sdio->logical_offset_in_bio);
@@ -458,6 +468,17 @@ static inline void dio_cleanup(struct dio *dio, struct dio_submit *sdio)
 		page_cache_release(dio_get_page(dio, sdio));
 }
 
+/*
+ * Called by blk_poll() without bio_lock, dio_await_one() checks again.
+ */
+static bool dio_poll_done(void *data)
+{
+	struct dio *dio = data;
+
+	return ACCESS_ONCE(dio->refcount) <= 1 ||
+		ACCESS_ONCE(dio->bio_list) != NULL;
+}
+
 /*
  * Wait for the next BIO to complete.  Remove it and return it.  NULL is
  * returned once all BIOs have been completed.  This must only be called once
@@ -468,9 +489,24 @@ static struct bio *dio_await_one(struct dio *dio)
 {
 	unsigned long flags;
 	struct bio *bio = NULL;
+	bool polled = false;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
+	/*
+	 * If only the last bio is left and its queue wants to be polled, try
+	 * that first.  waiter is set so that a completion during the hybrid
+	 * sleep still wakes us up.
+	 */
+	if (dio->poll_q && dio->refcount == 2 && dio->bio_list == NULL) {
+		polled = true;
+		dio->waiter = current;
+		spin_unlock_irqrestore(&dio->bio_lock, flags);
+		blk_poll(dio->poll_q, dio->poll_start, dio_poll_done, dio);
+		spin_lock_irqsave(&dio->bio_lock, flags);
+		dio->waiter = NULL;
+	}
+
 	/*
 	 * Wait as long as the list is empty and there are bios in flight.  bio
 	 * completion drops the count, maybe adds to the list, and wakes while
@@ -491,6 +527,9 @@ static struct bio *dio_await_one(struct dio *dio)
 		dio->bio_list = bio->bi_private;
 	}
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
+
+	if (polled)
+		blk_poll_account(dio->poll_q, dio->poll_start);
 	return bio;
 }
 
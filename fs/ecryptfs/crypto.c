@@ -37,6 +37,9 @@
 #include <asm/unaligned.h>
 #include "ecryptfs_kernel.h"
 
+#define DECRYPT		0
+#define ENCRYPT		1
+
 #ifdef CONFIG_CRYPTO_FIPS
 #include <crypto/rng.h>
 #define SEED_LEN 32
@@ -46,17 +49,6 @@
 #include "ecryptfs_dek.h"
 #endif
 
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-
 #ifdef CONFIG_CRYPTO_FIPS
 static int crypto_cc_reset_rng(struct crypto_rng *tfm)
 {
@@ -396,6 +388,7 @@ ecryptfs_init_crypt_stat(struct ecryptfs_crypt_stat *crypt_stat)
 	mutex_init(&crypt_stat->keysig_list_mutex);
 	mutex_init(&crypt_stat->cs_mutex);
 	mutex_init(&crypt_stat->cs_tfm_mutex);
+	init_rwsem(&crypt_stat->cs_tfm_rwsem);
 	mutex_init(&crypt_stat->cs_hash_tfm_mutex);
 	crypt_stat->flags |= ECRYPTFS_STRUCT_INITIALIZED;
 }
@@ -411,7 +404,7 @@ void ecryptfs_destroy_crypt_stat(struct ecryptfs_crypt_stat *crypt_stat)
 	struct ecryptfs_key_sig *key_sig, *key_sig_tmp;
 
 	if (crypt_stat->tfm)
-		crypto_free_blkcipher(crypt_stat->tfm);
+		crypto_free_ablkcipher(crypt_stat->tfm);
 	if (crypt_stat->hash_tfm)
 		crypto_free_hash(crypt_stat->hash_tfm);
 	list_for_each_entry_safe(key_sig, key_sig_tmp,
@@ -492,52 +485,51 @@ int virt_to_scatterlist(const void *addr, int size, struct scatterlist *sg,
 }
 
 /**
- * encrypt_scatterlist
- * @crypt_stat: Pointer to the crypt_stat struct to initialize.
- * @dest_sg: Destination of encrypted data
- * @src_sg: Data to be encrypted
- * @size: Length of data to be encrypted
- * @iv: iv to use during encryption
+ * ecryptfs_set_key
+ * @crypt_stat: Pointer to the crypt_stat struct whose tfm needs the key
+ *
+ * Sets the file key into the tfm once, when the first extent of the
+ * file is encrypted or decrypted. The tfm is not locked after that:
+ * requests carry their own IV, so any number of them may be in flight
+ * on it at once. Callers hold cs_tfm_rwsem shared; whoever clears
+ * ECRYPTFS_KEY_SET to re-key the file holds it exclusively, so no
+ * request is in flight when the key is replaced.
  *
- * Returns the number of bytes encrypted; negative value on error
+ * Returns zero on success; non-zero on error
  */
-static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
-{
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
+static int ecryptfs_set_key(struct ecryptfs_crypt_stat *crypt_stat)
+{
 	int rc = 0;
 #ifdef CONFIG_SDP
 	int sig_len = 0;
 	unsigned char sig[ECRYPTFS_MAX_KEY_BYTES];
 #endif
+
+	if (crypt_stat->flags & ECRYPTFS_KEY_SET) {
+		smp_rmb();
+		return 0;
+	}
 	BUG_ON(!crypt_stat || !crypt_stat->tfm
 	       || !(crypt_stat->flags & ECRYPTFS_STRUCT_INITIALIZED));
 #ifdef CONFIG_SDP
-	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-		if(crypt_stat->flags & ECRYPTFS_DEK_SDP_ENABLED && 
-			crypt_stat->flags & ECRYPTFS_DEK_IS_SENSITIVE) {
-			rc = ecryptfs_get_sdp_dek(sig, &sig_len, crypt_stat);
-			if (rc) {
-				ecryptfs_printk(KERN_ERR, "Get encrypt key failed\n");
-				rc = -EINVAL;
-				goto out;
-			}
-		}
-		else{
-			memcpy(sig, crypt_stat->key, crypt_stat->key_size);
-			sig_len = crypt_stat->key_size;
+	memset(sig, 0, ECRYPTFS_MAX_KEY_BYTES);
+	if(crypt_stat->flags & ECRYPTFS_DEK_SDP_ENABLED &&
+		crypt_stat->flags & ECRYPTFS_DEK_IS_SENSITIVE) {
+		rc = ecryptfs_get_sdp_dek(sig, &sig_len, crypt_stat);
+		if (rc) {
+			ecryptfs_printk(KERN_ERR, "Get encrypt key failed\n");
+			rc = -EINVAL;
+			goto out;
 		}
+	}
+	else{
+		memcpy(sig, crypt_stat->key, crypt_stat->key_size);
+		sig_len = crypt_stat->key_size;
+	}
 #if ECRYPTFS_DEK_DEBUG
-		ecryptfs_printk(KERN_DEBUG, "Key size [%zd]; key:\n", sig_len);
-		ecryptfs_dump_hex(sig, sig_len);
+	ecryptfs_printk(KERN_DEBUG, "Key size [%zd]; key:\n", sig_len);
+	ecryptfs_dump_hex(sig, sig_len);
 #endif
-	}
 #endif
 	if (unlikely(ecryptfs_verbosity > 0)) {
 #ifndef CONFIG_SDP
@@ -547,14 +539,13 @@ static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
 				  crypt_stat->key_size);
 #endif
 	}
-	/* Consider doing this once, when the file is opened */
 	mutex_lock(&crypt_stat->cs_tfm_mutex);
 	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
 #ifdef CONFIG_SDP
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, sig, sig_len);
+		rc = crypto_ablkcipher_setkey(crypt_stat->tfm, sig, sig_len);
 #else
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-					     crypt_stat->key_size);
+		rc = crypto_ablkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
+					      crypt_stat->key_size);
 #endif
 		if (rc) {
 			ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
@@ -563,10 +554,9 @@ static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
 			rc = -EINVAL;
 			goto out;
 		}
+		smp_wmb();
 		crypt_stat->flags |= ECRYPTFS_KEY_SET;
 	}
-	ecryptfs_printk(KERN_DEBUG, "Encrypting [%d] bytes.\n", size);
-	crypto_blkcipher_encrypt_iv(&desc, dest_sg, src_sg, size);
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
 out:
 #ifdef CONFIG_SDP
@@ -576,63 +566,240 @@ out:
 }
 
 /**
- * ecryptfs_lower_offset_for_extent
+ * ecryptfs_init_crypt_batch
+ * @batch: The batch to initialize
  *
- * Convert an eCryptfs page index into a lower byte offset
+ * A batch collects the extent requests submitted by
+ * ecryptfs_encrypt_extents() and ecryptfs_decrypt_extents(), which may
+ * complete asynchronously, until ecryptfs_wait_crypt_batch() is called.
  */
-static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
-					     struct ecryptfs_crypt_stat *crypt_stat)
+void ecryptfs_init_crypt_batch(struct ecryptfs_crypt_batch *batch)
 {
-	(*offset) = ecryptfs_lower_header_size(crypt_stat)
-		    + (crypt_stat->extent_size * extent_num);
+	/* the extra count is dropped by ecryptfs_wait_crypt_batch() */
+	atomic_set(&batch->pending, 1);
+	init_completion(&batch->done);
+	batch->rc = 0;
+	batch->crypt_stat = NULL;
 }
 
 /**
- * ecryptfs_encrypt_extent
- * @enc_extent_page: Allocated page into which to encrypt the data in
- *                   @page
- * @crypt_stat: crypt_stat containing cryptographic context for the
- *              encryption operation
- * @page: Page containing plaintext data extent to encrypt
- * @extent_offset: Page extent offset for use in generating IV
+ * ecryptfs_wait_crypt_batch
+ * @batch: The batch to wait on
  *
- * Encrypts one extent of data.
+ * Waits for every request submitted to @batch to complete.
  *
- * Return zero on success; non-zero otherwise
+ * Returns zero if all of them succeeded; the error of a failed one
+ * otherwise
  */
-static int ecryptfs_encrypt_extent(struct page *enc_extent_page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *page,
-				   unsigned long extent_offset)
+int ecryptfs_wait_crypt_batch(struct ecryptfs_crypt_batch *batch)
 {
+	if (!atomic_dec_and_test(&batch->pending))
+		wait_for_completion(&batch->done);
+	if (batch->crypt_stat) {
+		up_read(&batch->crypt_stat->cs_tfm_rwsem);
+		batch->crypt_stat = NULL;
+	}
+	return batch->rc;
+}
+
+struct ecryptfs_extent_req {
+	struct ecryptfs_crypt_batch *batch;
+	struct scatterlist src_sg;
+	struct scatterlist dst_sg;
+	char iv[ECRYPTFS_MAX_IV_BYTES];
+	struct ablkcipher_request req;	/* followed by the tfm request ctx */
+};
+
+static void ecryptfs_extent_req_done(struct ecryptfs_extent_req *er, int rc)
+{
+	struct ecryptfs_crypt_batch *batch = er->batch;
+
+	if (rc) {
+		ecryptfs_printk(KERN_ERR, "Error in extent crypto; rc = [%d]\n",
+				rc);
+		batch->rc = rc;
+	}
+	kfree(er);
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+static void ecryptfs_extent_req_complete(struct crypto_async_request *areq,
+					 int rc)
+{
+	/* a backlogged request has only just been started */
+	if (rc == -EINPROGRESS)
+		return;
+	ecryptfs_extent_req_done(areq->data, rc);
+}
+
+/**
+ * crypt_extent
+ * @crypt_stat: The cryptographic context
+ * @dst_page: The page to write the result into
+ * @src_page: The page to read the input from
+ * @extent_offset: Extent offset in the pages; the same in both
+ * @op: ENCRYPT or DECRYPT
+ * @batch: The batch to account the request in
+ *
+ * Submits one extent for encryption or decryption. Its IV is derived
+ * from the extent's position in the file, given by @src_page for
+ * encryption and by @dst_page for decryption.
+ *
+ * Returns zero if the request was submitted (it may have already
+ * completed); non-zero otherwise
+ */
+static int crypt_extent(struct ecryptfs_crypt_stat *crypt_stat,
+			struct page *dst_page, struct page *src_page,
+			unsigned long extent_offset, int op,
+			struct ecryptfs_crypt_batch *batch)
+{
+	struct page *page = (op == ENCRYPT ? src_page : dst_page);
+	struct ecryptfs_extent_req *er;
 	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
+	size_t size = crypt_stat->extent_size;
+	int offset = extent_offset * size;
 	int rc;
 
+	er = kmalloc(sizeof(*er) + crypto_ablkcipher_reqsize(crypt_stat->tfm),
+		     GFP_NOFS);
+	if (!er)
+		return -ENOMEM;
+
 	extent_base = (((loff_t)page->index)
 		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
+	rc = ecryptfs_derive_iv(er->iv, crypt_stat,
 				(extent_base + extent_offset));
 	if (rc) {
 		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
 			"extent [0x%.16llx]; rc = [%d]\n",
 			(unsigned long long)(extent_base + extent_offset), rc);
-		goto out;
+		kfree(er);
+		return rc;
 	}
-	rc = ecryptfs_encrypt_page_offset(crypt_stat, enc_extent_page, 0,
-					  page, (extent_offset
-						 * crypt_stat->extent_size),
-					  crypt_stat->extent_size, extent_iv);
-	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to encrypt page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
-		goto out;
+
+	sg_init_table(&er->src_sg, 1);
+	sg_set_page(&er->src_sg, src_page, size, offset);
+	sg_init_table(&er->dst_sg, 1);
+	sg_set_page(&er->dst_sg, dst_page, size, offset);
+
+	er->batch = batch;
+	ablkcipher_request_set_tfm(&er->req, crypt_stat->tfm);
+	ablkcipher_request_set_callback(&er->req,
+			CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+			ecryptfs_extent_req_complete, er);
+	ablkcipher_request_set_crypt(&er->req, &er->src_sg, &er->dst_sg, size,
+				     er->iv);
+
+	atomic_inc(&batch->pending);
+	ecryptfs_printk(KERN_DEBUG, "%s [%zd] bytes.\n",
+			op == ENCRYPT ? "Encrypting" : "Decrypting", size);
+	if (op == ENCRYPT)
+		rc = crypto_ablkcipher_encrypt(&er->req);
+	else
+		rc = crypto_ablkcipher_decrypt(&er->req);
+	if (rc != -EINPROGRESS && rc != -EBUSY)
+		ecryptfs_extent_req_done(er, rc);
+	return 0;
+}
+
+static int crypt_extents(struct page *dst_page, struct page *src_page,
+			 int op, struct ecryptfs_crypt_batch *batch)
+{
+	struct page *page = (op == ENCRYPT ? src_page : dst_page);
+	struct ecryptfs_crypt_stat *crypt_stat =
+		&(ecryptfs_inode_to_private(page->mapping->host)->crypt_stat);
+	unsigned long extent_offset;
+	int rc;
+
+	BUG_ON(!(crypt_stat->flags & ECRYPTFS_ENCRYPTED));
+	if (!batch->crypt_stat) {
+		down_read(&crypt_stat->cs_tfm_rwsem);
+		batch->crypt_stat = crypt_stat;
 	}
-	rc = 0;
-out:
-	return rc;
+	BUG_ON(batch->crypt_stat != crypt_stat);
+	rc = ecryptfs_set_key(crypt_stat);
+	if (rc)
+		return rc;
+
+	for (extent_offset = 0;
+	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
+	     extent_offset++) {
+		rc = crypt_extent(crypt_stat, dst_page, src_page,
+				  extent_offset, op, batch);
+		if (rc) {
+			printk(KERN_ERR "%s: Error attempting to crypt page "
+			       "with page->index = [%ld], extent_offset = "
+			       "[%ld]; rc = [%d]\n", __func__, page->index,
+			       extent_offset, rc);
+			return rc;
+		}
+	}
+	return 0;
+}
+
+/**
+ * ecryptfs_encrypt_extents
+ * @enc_page: Allocated page into which to encrypt the data in @page
+ * @page: Page mapped from the eCryptfs inode for the file
+ * @batch: Batch to submit the extent requests to
+ *
+ * Submits every extent of @page for encryption. The result is only in
+ * @enc_page once ecryptfs_wait_crypt_batch() has returned.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+int ecryptfs_encrypt_extents(struct page *enc_page, struct page *page,
+			     struct ecryptfs_crypt_batch *batch)
+{
+	return crypt_extents(enc_page, page, ENCRYPT, batch);
+}
+
+/**
+ * ecryptfs_decrypt_extents
+ * @page: Page mapped from the eCryptfs inode for the file
+ * @enc_page: Page holding the lower file contents for @page
+ * @batch: Batch to submit the extent requests to
+ *
+ * Submits every extent of @enc_page for decryption into @page. The
+ * result is only in @page once ecryptfs_wait_crypt_batch() has returned.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+int ecryptfs_decrypt_extents(struct page *page, struct page *enc_page,
+			     struct ecryptfs_crypt_batch *batch)
+{
+	return crypt_extents(page, enc_page, DECRYPT, batch);
+}
+
+/**
+ * ecryptfs_lower_offset_for_extent
+ *
+ * Convert an eCryptfs page index into a lower byte offset
+ */
+static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
+					     struct ecryptfs_crypt_stat *crypt_stat)
+{
+	(*offset) = ecryptfs_lower_header_size(crypt_stat)
+		    + (crypt_stat->extent_size * extent_num);
+}
+
+/**
+ * ecryptfs_lower_offset_for_page
+ *
+ * Lower byte offset of the first extent of an eCryptfs page. The
+ * extents of a page are contiguous in the lower file.
+ */
+loff_t ecryptfs_lower_offset_for_page(struct ecryptfs_crypt_stat *crypt_stat,
+				      struct page *page)
+{
+	loff_t offset;
+
+	ecryptfs_lower_offset_for_extent(
+		&offset, (((loff_t)page->index)
+			  * (PAGE_CACHE_SIZE / crypt_stat->extent_size)),
+		crypt_stat);
+	return offset;
 }
 
 /**
@@ -641,7 +808,8 @@ out:
  *        decrypted content that needs to be encrypted (to a temporary
  *        page; not in place) and written out to the lower file
  *
- * Encrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * Encrypt an eCryptfs page. The extents of the page are encrypted
+ * concurrently and then written out to the lower file in one go. Note
  * that eCryptfs pages may straddle the lower pages -- for instance,
  * if the file was created on a machine with an 8K page size
  * (resulting in an 8K header), and then the file is copied onto a
@@ -655,9 +823,9 @@ int ecryptfs_encrypt_page(struct page *page)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
+	struct ecryptfs_crypt_batch batch;
 	char *enc_extent_virt;
 	struct page *enc_extent_page = NULL;
-	loff_t extent_offset;
 	int rc = 0;
 
 	ecryptfs_inode = page->mapping->host;
@@ -671,75 +839,31 @@ int ecryptfs_encrypt_page(struct page *page)
 				"encrypted extent\n");
 		goto out;
 	}
-	enc_extent_virt = kmap(enc_extent_page);
-	for (extent_offset = 0;
-	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
-	     extent_offset++) {
-		loff_t offset;
-
-		rc = ecryptfs_encrypt_extent(enc_extent_page, crypt_stat, page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((((loff_t)page->index)
-				   * (PAGE_CACHE_SIZE
-				      / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
-					  offset, crypt_stat->extent_size);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to write lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-	}
-	rc = 0;
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-static int ecryptfs_decrypt_extent(struct page *page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *enc_extent_page,
-				   unsigned long extent_offset)
-{
-	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
-	int rc;
-
-	extent_base = (((loff_t)page->index)
-		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
-				(extent_base + extent_offset));
+	ecryptfs_init_crypt_batch(&batch);
+	rc = ecryptfs_encrypt_extents(enc_extent_page, page, &batch);
+	if (ecryptfs_wait_crypt_batch(&batch) && !rc)
+		rc = batch.rc;
 	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error attempting to derive IV for "
-			"extent [0x%.16llx]; rc = [%d]\n",
-			(unsigned long long)(extent_base + extent_offset), rc);
+		printk(KERN_ERR "%s: Error encrypting extent; "
+		       "rc = [%d]\n", __func__, rc);
 		goto out;
 	}
-	rc = ecryptfs_decrypt_page_offset(crypt_stat, page,
-					  (extent_offset
-					   * crypt_stat->extent_size),
-					  enc_extent_page, 0,
-					  crypt_stat->extent_size, extent_iv);
+	enc_extent_virt = kmap(enc_extent_page);
+	rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
+				  ecryptfs_lower_offset_for_page(crypt_stat,
+								 page),
+				  PAGE_CACHE_SIZE);
+	kunmap(enc_extent_page);
 	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to decrypt to page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to write lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
 	rc = 0;
 out:
+	if (enc_extent_page)
+		__free_page(enc_extent_page);
 	return rc;
 }
 
@@ -749,7 +873,8 @@ out:
  *        and decrypted from the lower file will be written into this
  *        page
  *
- * Decrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * Decrypt an eCryptfs page. The extents of the page are read from the
+ * lower file in one go and then decrypted concurrently. Note
  * that eCryptfs pages may straddle the lower pages -- for instance,
  * if the file was created on a machine with an 8K page size
  * (resulting in an 8K header), and then the file is copied onto a
@@ -763,9 +888,9 @@ int ecryptfs_decrypt_page(struct page *page)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
+	struct ecryptfs_crypt_batch batch;
 	char *enc_extent_virt;
 	struct page *enc_extent_page = NULL;
-	unsigned long extent_offset;
 	int rc = 0;
 
 	ecryptfs_inode = page->mapping->host;
@@ -780,181 +905,32 @@ int ecryptfs_decrypt_page(struct page *page)
 		goto out;
 	}
 	enc_extent_virt = kmap(enc_extent_page);
-	for (extent_offset = 0;
-	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
-	     extent_offset++) {
-		loff_t offset;
-
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((page->index * (PAGE_CACHE_SIZE
-						  / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_read_lower(enc_extent_virt, offset,
-					 crypt_stat->extent_size,
-					 ecryptfs_inode);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to read lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-		rc = ecryptfs_decrypt_extent(page, crypt_stat, enc_extent_page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-	}
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-/**
- * decrypt_scatterlist
- * @crypt_stat: Cryptographic context
- * @dest_sg: The destination scatterlist to decrypt into
- * @src_sg: The source scatterlist to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted; negative value on error
- */
-static int decrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
-{
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
-	int rc = 0;
-#ifdef CONFIG_SDP
-	int sig_len = 0;
-	unsigned char sig[ECRYPTFS_MAX_KEY_BYTES];
-#endif
-	BUG_ON(!crypt_stat || !crypt_stat->tfm
-	       || !(crypt_stat->flags & ECRYPTFS_STRUCT_INITIALIZED));
-#ifdef CONFIG_SDP
-	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-		memset(sig, 0, ECRYPTFS_MAX_KEY_BYTES);
-		if(crypt_stat->flags & ECRYPTFS_DEK_SDP_ENABLED &&
-			crypt_stat->flags & ECRYPTFS_DEK_IS_SENSITIVE) {
-			rc = ecryptfs_get_sdp_dek(sig, &sig_len, crypt_stat);
-			if (rc) {
-				ecryptfs_printk(KERN_ERR, "Get decrypt key failed\n");
-				rc = -EINVAL;
-				goto out;
-			}
-		}
-		else{
-			memcpy(sig, crypt_stat->key, crypt_stat->key_size);
-			sig_len = crypt_stat->key_size;
-		}
-#if ECRYPTFS_DEK_DEBUG
-		ecryptfs_printk(KERN_DEBUG, "Key size [%zd]; key:\n", sig_len);
-		ecryptfs_dump_hex(sig, sig_len);
-#endif
-	}
-#endif
-
-	/* Consider doing this once, when the file is opened */
-	mutex_lock(&crypt_stat->cs_tfm_mutex);
-	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-#ifdef CONFIG_SDP
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, sig, sig_len);
-#else
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-				     crypt_stat->key_size);
-#endif
-		if (rc) {
-			ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-					rc);
-			mutex_unlock(&crypt_stat->cs_tfm_mutex);
-			rc = -EINVAL;
-			goto out;
-		}
-		crypt_stat->flags |= ECRYPTFS_KEY_SET;
+	rc = ecryptfs_read_lower(enc_extent_virt,
+				 ecryptfs_lower_offset_for_page(crypt_stat,
+								page),
+				 PAGE_CACHE_SIZE, ecryptfs_inode);
+	kunmap(enc_extent_page);
+	if (rc < 0) {
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to read lower page; rc = [%d]"
+				"\n", rc);
+		goto out;
 	}
-	ecryptfs_printk(KERN_DEBUG, "Decrypting [%d] bytes.\n", size);
-	rc = crypto_blkcipher_decrypt_iv(&desc, dest_sg, src_sg, size);
-	mutex_unlock(&crypt_stat->cs_tfm_mutex);
+	ecryptfs_init_crypt_batch(&batch);
+	rc = ecryptfs_decrypt_extents(page, enc_extent_page, &batch);
+	if (ecryptfs_wait_crypt_batch(&batch) && !rc)
+		rc = batch.rc;
 	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error decrypting; rc = [%d]\n",
-				rc);
+		printk(KERN_ERR "%s: Error decrypting extent; "
+		       "rc = [%d]\n", __func__, rc);
 		goto out;
 	}
-	rc = size;
 out:
-#ifdef CONFIG_SDP
-	memset(sig, 0, ECRYPTFS_MAX_KEY_BYTES);
-#endif
+	if (enc_extent_page)
+		__free_page(enc_extent_page);
 	return rc;
 }
 
-/**
- * ecryptfs_encrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to encrypt into
- * @dst_offset: The offset in the page to encrypt into
- * @src_page: The page to encrypt from
- * @src_offset: The offset in the page to encrypt from
- * @size: The number of bytes to encrypt
- * @iv: The initialization vector to use for the encryption
- *
- * Returns the number of bytes encrypted
- */
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_init_table(&dst_sg, 1);
-
-	sg_set_page(&src_sg, src_page, size, src_offset);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-	return encrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
-/**
- * ecryptfs_decrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to decrypt into
- * @dst_offset: The offset in the page to decrypt into
- * @src_page: The page to decrypt from
- * @src_offset: The offset in the page to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted
- */
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_set_page(&src_sg, src_page, size, src_offset);
-
-	sg_init_table(&dst_sg, 1);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-
-	return decrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
 #define ECRYPTFS_MAX_SCATTERLIST_LEN 4
 
 /**
@@ -989,8 +965,8 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 						    crypt_stat->cipher, "cbc");
 	if (rc)
 		goto out_unlock;
-	crypt_stat->tfm = crypto_alloc_blkcipher(full_alg_name, 0,
-						 CRYPTO_ALG_ASYNC);
+	/* async implementations (crypto engines, cryptd) are welcome */
+	crypt_stat->tfm = crypto_alloc_ablkcipher(full_alg_name, 0, 0);
 	kfree(full_alg_name);
 	if (IS_ERR(crypt_stat->tfm)) {
 		rc = PTR_ERR(crypt_stat->tfm);
@@ -1000,7 +976,7 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 				crypt_stat->cipher);
 		goto out_unlock;
 	}
-	crypto_blkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	crypto_ablkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
 	rc = 0;
 out_unlock:
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
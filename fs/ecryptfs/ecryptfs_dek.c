@@ -236,8 +236,11 @@ static int ecryptfs_sdp_set_sensitive(struct dentry *dentry) {
 		memset(&crypt_stat->sdp_dek, 0, sizeof(dek_t));
 		goto out;
 	}
+	/* wait for extent requests on the old key before dropping it */
+	down_write(&crypt_stat->cs_tfm_rwsem);
 	memset(crypt_stat->key, 0, crypt_stat->key_size);
 	crypt_stat->flags &= ~(ECRYPTFS_KEY_SET);
+	up_write(&crypt_stat->cs_tfm_rwsem);
 	ecryptfs_update_crypt_flag(dentry, 1);
 out:
 	memset(&DEK, 0, sizeof(dek_t));
@@ -405,8 +408,10 @@ long ecryptfs_do_sdp_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 				memcpy(crypt_stat->sdp_dek.buf, req.dek.buf, req.dek.len);
 				crypt_stat->sdp_dek.len = req.dek.len;
 				crypt_stat->sdp_dek.type = req.dek.type;
+				down_write(&crypt_stat->cs_tfm_rwsem);
 				memset(crypt_stat->key, 0, crypt_stat->key_size);
 				crypt_stat->flags &= ~(ECRYPTFS_KEY_SET);
+				up_write(&crypt_stat->cs_tfm_rwsem);
 				mutex_unlock(&crypt_stat->cs_mutex);
 				ecryptfs_update_crypt_flag(ecryptfs_dentry, 1);
 			} else {
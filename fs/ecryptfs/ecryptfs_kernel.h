@@ -36,6 +36,7 @@
 #include <linux/fs_stack.h>
 #include <linux/namei.h>
 #include <linux/scatterlist.h>
+#include <linux/completion.h>
 #include <linux/hash.h>
 #include <linux/nsproxy.h>
 #include <linux/backing-dev.h>
@@ -255,7 +256,7 @@ struct ecryptfs_crypt_stat {
 	size_t extent_shift;
 	unsigned int extent_mask;
 	struct ecryptfs_mount_crypt_stat *mount_crypt_stat;
-	struct crypto_blkcipher *tfm;
+	struct crypto_ablkcipher *tfm;
 	struct crypto_hash *hash_tfm; /* Crypto context for generating
 				       * the initialization vectors */
 	unsigned char cipher[ECRYPTFS_MAX_CIPHER_NAME_SIZE];
@@ -264,6 +265,8 @@ struct ecryptfs_crypt_stat {
 	struct list_head keysig_list;
 	struct mutex keysig_list_mutex;
 	struct mutex cs_tfm_mutex;
+	struct rw_semaphore cs_tfm_rwsem; /* held shared by batches in flight,
+					   * exclusively to change the key */
 	struct mutex cs_hash_tfm_mutex;
 	struct mutex cs_mutex;
 #ifdef CONFIG_SDP
@@ -272,6 +275,25 @@ struct ecryptfs_crypt_stat {
 #endif
 };
 
+/**
+ * ecryptfs_crypt_batch - Extent requests waited on together
+ * @pending: Requests in flight, plus one held until the batch is waited on
+ * @done: Completed when @pending drops to zero
+ * @rc: Error of a failed request, if any
+ * @crypt_stat: Whose cs_tfm_rwsem the batch holds shared, from its first
+ *              submission until it has been waited on
+ *
+ * The extents of one or more pages are handed to the cipher without
+ * waiting for each other, so that a crypto engine or several CPUs can
+ * work on them at once.
+ */
+struct ecryptfs_crypt_batch {
+	atomic_t pending;
+	struct completion done;
+	int rc;
+	struct ecryptfs_crypt_stat *crypt_stat;
+};
+
 /* inode private data. */
 struct ecryptfs_inode_info {
 	struct inode vfs_inode;
@@ -665,6 +687,14 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat);
 int ecryptfs_write_inode_size_to_metadata(struct inode *ecryptfs_inode);
 int ecryptfs_encrypt_page(struct page *page);
 int ecryptfs_decrypt_page(struct page *page);
+void ecryptfs_init_crypt_batch(struct ecryptfs_crypt_batch *batch);
+int ecryptfs_wait_crypt_batch(struct ecryptfs_crypt_batch *batch);
+int ecryptfs_encrypt_extents(struct page *enc_page, struct page *page,
+			     struct ecryptfs_crypt_batch *batch);
+int ecryptfs_decrypt_extents(struct page *page, struct page *enc_page,
+			     struct ecryptfs_crypt_batch *batch);
+loff_t ecryptfs_lower_offset_for_page(struct ecryptfs_crypt_stat *crypt_stat,
+				      struct page *page);
 int ecryptfs_write_metadata(struct dentry *ecryptfs_dentry,
 			    struct inode *ecryptfs_inode);
 int ecryptfs_read_metadata(struct dentry *ecryptfs_dentry);
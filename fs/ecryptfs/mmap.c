@@ -286,6 +286,110 @@ out:
 	return rc;
 }
 
+/* Pages whose extents are decrypted concurrently by ecryptfs_readpages() */
+#define ECRYPTFS_READPAGES_BATCH 16
+
+/**
+ * ecryptfs_readpages
+ * @file: An eCryptfs file
+ * @mapping: The eCryptfs inode mapping
+ * @pages: Readahead pages, not yet in the page cache
+ * @nr_pages: Number of pages on @pages
+ *
+ * Reads the lower file contents for up to ECRYPTFS_READPAGES_BATCH
+ * pages and submits all of their extents for decryption before waiting
+ * on any of them, instead of decrypting one page at a time. Files that
+ * are not decrypted on read go through ecryptfs_readpage().
+ *
+ * Returns zero; errors are reported through the page flags.
+ */
+static int ecryptfs_readpages(struct file *file, struct address_space *mapping,
+			      struct list_head *pages, unsigned nr_pages)
+{
+	struct ecryptfs_crypt_stat *crypt_stat =
+		&ecryptfs_inode_to_private(mapping->host)->crypt_stat;
+	struct page *batch_pages[ECRYPTFS_READPAGES_BATCH];
+	struct page *enc_pages[ECRYPTFS_READPAGES_BATCH];
+	int page_rc[ECRYPTFS_READPAGES_BATCH];
+	struct ecryptfs_crypt_batch batch;
+	bool decrypt;
+	int nr, i, rc;
+
+	decrypt = (crypt_stat->flags & ECRYPTFS_ENCRYPTED)
+		  && !(crypt_stat->flags & ECRYPTFS_VIEW_AS_ENCRYPTED);
+
+	while (!list_empty(pages)) {
+		ecryptfs_init_crypt_batch(&batch);
+		nr = 0;
+		while (nr < ECRYPTFS_READPAGES_BATCH && !list_empty(pages)) {
+			struct page *page = list_entry(pages->prev,
+						       struct page, lru);
+			struct page *enc_page;
+			char *enc_virt;
+
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+						  GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+			if (!decrypt) {
+				ecryptfs_readpage(file, page);
+				page_cache_release(page);
+				continue;
+			}
+
+			enc_page = alloc_page(GFP_USER);
+			if (!enc_page) {
+				rc = -ENOMEM;
+				goto add;
+			}
+			enc_virt = kmap(enc_page);
+			rc = ecryptfs_read_lower(enc_virt,
+				ecryptfs_lower_offset_for_page(crypt_stat,
+							       page),
+				PAGE_CACHE_SIZE, mapping->host);
+			kunmap(enc_page);
+			if (rc < 0) {
+				ecryptfs_printk(KERN_ERR, "Error attempting "
+						"to read lower page; rc = [%d]"
+						"\n", rc);
+				goto add;
+			}
+			rc = ecryptfs_decrypt_extents(page, enc_page, &batch);
+add:
+			batch_pages[nr] = page;
+			enc_pages[nr] = enc_page;
+			page_rc[nr] = rc;
+			nr++;
+		}
+
+		rc = ecryptfs_wait_crypt_batch(&batch);
+		for (i = 0; i < nr; i++) {
+			struct page *page = batch_pages[i];
+
+			if (rc || page_rc[i]) {
+				ecryptfs_printk(KERN_ERR, "Error decrypting "
+						"page (upper index [0x%.16lx])"
+						"\n", page->index);
+				ClearPageUptodate(page);
+			} else {
+				SetPageUptodate(page);
+#ifdef CONFIG_SDP
+				if (crypt_stat->flags &
+				    ECRYPTFS_DEK_IS_SENSITIVE)
+					SetPageSensitive(page);
+#endif
+			}
+			unlock_page(page);
+			page_cache_release(page);
+			if (enc_pages[i])
+				__free_page(enc_pages[i]);
+		}
+	}
+	return 0;
+}
+
 /**
  * Called with lower inode mutex held.
  */
@@ -642,6 +746,7 @@ static sector_t ecryptfs_bmap(struct address_space *mapping, sector_t block)
 const struct address_space_operations ecryptfs_aops = {
 	.writepage = ecryptfs_writepage,
 	.readpage = ecryptfs_readpage,
+	.readpages = ecryptfs_readpages,
 	.write_begin = ecryptfs_write_begin,
 	.write_end = ecryptfs_write_end,
 #ifdef CONFIG_SDP
@@ -1839,6 +1839,14 @@ INT32 fat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_chai
 	return(num_clusters);
 }
 
+/*
+ * With the free-extent index, a new chain starts in the first free run at or
+ * after the search pointer that can hold the request. When the cluster after
+ * a growing chain is taken, the chain becomes a FAT chain as before, but the
+ * rest of the request goes to a run that can hold all of it instead of to the
+ * next free cluster, so it adds a single fragment. Nothing is reserved for
+ * later growth. The search pointer moves past what was allocated.
+ */
 INT32 exfat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_chain)
 {
 	INT32 num_clusters = 0;
@@ -1847,7 +1855,7 @@ INT32 exfat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_ch
 
 	hint_clu = p_chain->dir;
 	if (hint_clu == CLUSTER_32(~0)) {
-		hint_clu = test_alloc_bitmap(sb, p_fs->clu_srch_ptr-2);
+		hint_clu = find_free_extent(sb, p_fs->clu_srch_ptr, num_alloc);
 		if (hint_clu == CLUSTER_32(~0))
 			return 0;
 	} else if (hint_clu >= p_fs->num_clusters) {
@@ -1859,8 +1867,11 @@ INT32 exfat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_ch
 	
 	p_chain->dir = CLUSTER_32(~0);
 
-	while ((new_clu = test_alloc_bitmap(sb, hint_clu-2)) != CLUSTER_32(~0)) {
+	while ((new_clu = next_free_cluster(sb, hint_clu)) != CLUSTER_32(~0)) {
 		if (new_clu != hint_clu) {
+			if (p_fs->free_index_valid)
+				new_clu = find_free_extent(sb, hint_clu, num_alloc);
+
 			if (p_chain->flags == 0x03) {
 				exfat_chain_cont_cluster(sb, p_chain->dir, num_clusters);
 				p_chain->flags = 0x01;
@@ -1887,14 +1898,8 @@ INT32 exfat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_ch
 		}
 		last_clu = new_clu;
 
-		if ((--num_alloc) == 0) {
-			p_fs->clu_srch_ptr = hint_clu;
-			if (p_fs->used_clusters != (UINT32) ~0)
-				p_fs->used_clusters += num_clusters;
-
-			p_chain->size += num_clusters;
-			return(num_clusters);
-		}
+		if ((--num_alloc) == 0)
+			break;
 
 		hint_clu = new_clu + 1;
 		if (hint_clu >= p_fs->num_clusters) {
@@ -1907,7 +1912,14 @@ INT32 exfat_alloc_cluster(struct super_block *sb, INT32 num_alloc, CHAIN_T *p_ch
 		}
 	}
 
-	p_fs->clu_srch_ptr = hint_clu;
+	if (!p_fs->free_index_valid) {
+		p_fs->clu_srch_ptr = hint_clu;
+	} else if (num_clusters > 0) {
+		p_fs->clu_srch_ptr = last_clu + 1;
+		if (p_fs->clu_srch_ptr >= p_fs->num_clusters)
+			p_fs->clu_srch_ptr = 2;
+	}
+
 	if (p_fs->used_clusters != (UINT32) ~0)
 		p_fs->used_clusters += num_clusters;
 
@@ -2174,6 +2186,7 @@ INT32 load_alloc_bitmap(struct super_block *sb)
 				}
 
 				p_fs->pbr_bh = NULL;
+				build_free_index(sb);
 				return FFS_SUCCESS;
 			}
 		}
@@ -2192,6 +2205,8 @@ void free_alloc_bitmap(struct super_block *sb)
 
 	brelse(p_fs->pbr_bh);
 
+	destroy_free_index(sb);
+
 	for (i = 0; i < p_fs->map_sectors; i++) {
 		__brelse(p_fs->vol_amap[i]);
 	}
@@ -2213,6 +2228,7 @@ INT32 set_alloc_bitmap(struct super_block *sb, UINT32 clu)
 	sector = START_SECTOR(p_fs->map_clu) + i;
 
 	Bitmap_set((UINT8 *) p_fs->vol_amap[i]->b_data, b);
+	del_free_cluster(sb, clu+2);
 
 	return (sector_write(sb, sector, p_fs->vol_amap[i], 0));
 } 
@@ -2235,6 +2251,7 @@ INT32 clr_alloc_bitmap(struct super_block *sb, UINT32 clu)
 	sector = START_SECTOR(p_fs->map_clu) + i;
 
 	Bitmap_clear((UINT8 *) p_fs->vol_amap[i]->b_data, b);
+	add_free_extent(sb, clu+2, 1);
 
 	return (sector_write(sb, sector, p_fs->vol_amap[i], 0));
 
@@ -2292,6 +2309,263 @@ UINT32 test_alloc_bitmap(struct super_block *sb, UINT32 clu)
 	return(CLUSTER_32(~0));
 }
 
+/*
+ * In-memory index of the free runs in the allocation bitmap, kept in an
+ * rbtree ordered by start cluster. It is built at mount and kept in step by
+ * set_alloc_bitmap()/clr_alloc_bitmap(). If the volume is too fragmented for
+ * FREE_EXTENT_MAX runs, or memory runs out, the index is dropped and
+ * allocation falls back to scanning the bitmap.
+ */
+typedef struct {
+	struct rb_node node;
+	UINT32 start;
+	UINT32 len;
+} FREE_EXTENT_T;
+
+/* Returns the run containing @clu, or else the first run after it */
+static FREE_EXTENT_T *lookup_free_extent(FS_INFO_T *p_fs, UINT32 clu)
+{
+	struct rb_node *n = p_fs->free_root.rb_node;
+	FREE_EXTENT_T *fe, *next = NULL;
+
+	while (n) {
+		fe = rb_entry(n, FREE_EXTENT_T, node);
+
+		if (clu < fe->start) {
+			next = fe;
+			n = n->rb_left;
+		} else if (clu >= fe->start + fe->len) {
+			n = n->rb_right;
+		} else {
+			return fe;
+		}
+	}
+	return next;
+}
+
+static INT32 insert_free_extent(FS_INFO_T *p_fs, UINT32 start, UINT32 len)
+{
+	struct rb_node **p = &p_fs->free_root.rb_node, *parent = NULL;
+	FREE_EXTENT_T *fe;
+
+	if (p_fs->free_extents >= FREE_EXTENT_MAX)
+		return FFS_MEMORYERR;
+
+	fe = kmalloc(sizeof(FREE_EXTENT_T), GFP_NOFS);
+	if (!fe)
+		return FFS_MEMORYERR;
+
+	fe->start = start;
+	fe->len = len;
+
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, FREE_EXTENT_T, node)->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&fe->node, parent, p);
+	rb_insert_color(&fe->node, &p_fs->free_root);
+	p_fs->free_extents++;
+
+	return FFS_SUCCESS;
+}
+
+static void erase_free_extent(FS_INFO_T *p_fs, FREE_EXTENT_T *fe)
+{
+	rb_erase(&fe->node, &p_fs->free_root);
+	kfree(fe);
+	p_fs->free_extents--;
+}
+
+void destroy_free_index(struct super_block *sb)
+{
+	struct rb_node *n;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	while ((n = rb_first(&p_fs->free_root)) != NULL)
+		erase_free_extent(p_fs, rb_entry(n, FREE_EXTENT_T, node));
+
+	p_fs->free_index_valid = FALSE;
+}
+
+void build_free_index(struct super_block *sb)
+{
+	UINT32 clu, start = 0, len = 0;
+	INT32 map_i, map_b;
+	UINT8 k;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+	BD_INFO_T *p_bd = &(EXFAT_SB(sb)->bd_info);
+
+	p_fs->free_root = RB_ROOT;
+	p_fs->free_extents = 0;
+	p_fs->free_index_valid = TRUE;
+
+	for (clu = 2; clu < p_fs->num_clusters; ) {
+		if (!p_fs->free_index_valid)
+			break;
+
+		map_i = (clu-2) >> (p_bd->sector_size_bits + 3);
+		map_b = ((clu-2) >> 3) & p_bd->sector_size_mask;
+		k = *(((UINT8 *) p_fs->vol_amap[map_i]->b_data) + map_b);
+
+		if ((((clu-2) & 0x7) == 0) && ((k == 0x00) || (k == 0xFF)) &&
+		    (clu + 8 <= p_fs->num_clusters)) {
+			if (k == 0x00) {
+				if (len == 0)
+					start = clu;
+				len += 8;
+			} else if (len) {
+				add_free_extent(sb, start, len);
+				len = 0;
+			}
+			clu += 8;
+			continue;
+		}
+
+		if (!(k & (1 << ((clu-2) & 0x7)))) {
+			if (len == 0)
+				start = clu;
+			len++;
+		} else if (len) {
+			add_free_extent(sb, start, len);
+			len = 0;
+		}
+		clu++;
+	}
+
+	if (len && p_fs->free_index_valid)
+		add_free_extent(sb, start, len);
+
+	if (!p_fs->free_index_valid)
+		printk(KERN_INFO "[EXFAT] too many free extents, "
+				"using bitmap scan for allocation\n");
+}
+
+/* Marks @len clusters from @clu free in the index, merging neighbours */
+void add_free_extent(struct super_block *sb, UINT32 clu, UINT32 len)
+{
+	FREE_EXTENT_T *next, *prev = NULL;
+	struct rb_node *n;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	if (!p_fs->free_index_valid)
+		return;
+
+	next = lookup_free_extent(p_fs, clu);
+	if (next && (next->start <= clu))
+		return;
+
+	n = next ? rb_prev(&next->node) : rb_last(&p_fs->free_root);
+	if (n)
+		prev = rb_entry(n, FREE_EXTENT_T, node);
+
+	if (prev && (prev->start + prev->len == clu)) {
+		prev->len += len;
+		if (next && (clu + len == next->start)) {
+			prev->len += next->len;
+			erase_free_extent(p_fs, next);
+		}
+	} else if (next && (clu + len == next->start)) {
+		next->start = clu;
+		next->len += len;
+	} else if (insert_free_extent(p_fs, clu, len) != FFS_SUCCESS) {
+		destroy_free_index(sb);
+	}
+}
+
+/* Marks @clu in use in the index, splitting the run it was in if needed */
+void del_free_cluster(struct super_block *sb, UINT32 clu)
+{
+	UINT32 end;
+	FREE_EXTENT_T *fe;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	if (!p_fs->free_index_valid)
+		return;
+
+	fe = lookup_free_extent(p_fs, clu);
+	if (!fe || (fe->start > clu))
+		return;
+
+	end = fe->start + fe->len;
+
+	if (fe->len == 1) {
+		erase_free_extent(p_fs, fe);
+	} else if (clu == fe->start) {
+		fe->start++;
+		fe->len--;
+	} else if (clu == end - 1) {
+		fe->len--;
+	} else {
+		fe->len = clu - fe->start;
+		if (insert_free_extent(p_fs, clu + 1, end - clu - 1) != FFS_SUCCESS)
+			destroy_free_index(sb);
+	}
+}
+
+/* Same contract as test_alloc_bitmap(), but takes a cluster number */
+UINT32 next_free_cluster(struct super_block *sb, UINT32 clu)
+{
+	FREE_EXTENT_T *fe;
+	struct rb_node *n;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	if (!p_fs->free_index_valid)
+		return test_alloc_bitmap(sb, clu-2);
+
+	fe = lookup_free_extent(p_fs, clu);
+	if (fe)
+		return MAX(clu, fe->start);
+
+	n = rb_first(&p_fs->free_root);
+	if (!n)
+		return CLUSTER_32(~0);
+
+	return rb_entry(n, FREE_EXTENT_T, node)->start;
+}
+
+/*
+ * Returns the first cluster, at or after @clu and wrapping around, of a free
+ * run that can hold @num_clusters. If there is none, the start of the
+ * largest free run is returned.
+ */
+UINT32 find_free_extent(struct super_block *sb, UINT32 clu, UINT32 num_clusters)
+{
+	UINT32 start;
+	FREE_EXTENT_T *fe, *best = NULL;
+	struct rb_node *n;
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	if (!p_fs->free_index_valid)
+		return test_alloc_bitmap(sb, clu-2);
+
+	fe = lookup_free_extent(p_fs, clu);
+	if (fe) {
+		start = MAX(clu, fe->start);
+		if (fe->start + fe->len - start >= num_clusters)
+			return start;
+
+		for (n = rb_next(&fe->node); n; n = rb_next(n)) {
+			fe = rb_entry(n, FREE_EXTENT_T, node);
+			if (fe->len >= num_clusters)
+				return fe->start;
+		}
+	}
+
+	for (n = rb_first(&p_fs->free_root); n; n = rb_next(n)) {
+		fe = rb_entry(n, FREE_EXTENT_T, node);
+		if (fe->len >= num_clusters)
+			return fe->start;
+		if (!best || (fe->len > best->len))
+			best = fe;
+	}
+
+	return best ? best->start : CLUSTER_32(~0);
+}
+
 void sync_alloc_bitmap(struct super_block *sb)
 {
 	INT32 i;
@@ -427,6 +427,9 @@ extern "C" {
 		UINT16      **vol_utbl;               
 
 		UINT32      clu_srch_ptr;           
+		struct rb_root free_root;
+		UINT32      free_extents;
+		UINT32      free_index_valid;
 		UINT32      used_clusters;          
 		UENTRY_T    hint_uentry;            
 
@@ -434,13 +437,9 @@ extern "C" {
 
 		FS_FUNC_T	*fs_func;
 
-		BUF_CACHE_T FAT_cache_array[FAT_CACHE_SIZE];
-		BUF_CACHE_T FAT_cache_lru_list;
-		BUF_CACHE_T FAT_cache_hash_list[FAT_CACHE_HASH_SIZE];
-
-		BUF_CACHE_T buf_cache_array[BUF_CACHE_SIZE];
-		BUF_CACHE_T buf_cache_lru_list;
-		BUF_CACHE_T buf_cache_hash_list[BUF_CACHE_HASH_SIZE];
+		BUF_POOL_T  FAT_cache;
+		BUF_POOL_T  buf_cache;
+		struct shrinker cache_shrinker;
 	} FS_INFO_T;
 
 #define ES_2_ENTRIES		2
@@ -506,6 +505,13 @@ extern "C" {
 	UINT32 test_alloc_bitmap(struct super_block *sb, UINT32 clu);
 	void   sync_alloc_bitmap(struct super_block *sb);
 
+	void   build_free_index(struct super_block *sb);
+	void   destroy_free_index(struct super_block *sb);
+	void   add_free_extent(struct super_block *sb, UINT32 clu, UINT32 len);
+	void   del_free_cluster(struct super_block *sb, UINT32 clu);
+	UINT32 next_free_cluster(struct super_block *sb, UINT32 clu);
+	UINT32 find_free_extent(struct super_block *sb, UINT32 clu, UINT32 num_clusters);
+
 	INT32  load_upcase_table(struct super_block *sb);
 	void   free_upcase_table(struct super_block *sb);
 
@@ -44,64 +44,99 @@ static BUF_CACHE_T *buf_cache_get(struct super_block *sb, UINT32 sec);
 static void buf_cache_insert_hash(struct super_block *sb, BUF_CACHE_T *bp);
 static void buf_cache_remove_hash(BUF_CACHE_T *bp);
 
+static INT32 pool_init(BUF_POOL_T *pool, UINT32 min_count, UINT32 max_count);
+static void pool_destroy(BUF_POOL_T *pool);
+static BUF_CACHE_T *pool_get(BUF_POOL_T *pool);
+static INT32 pool_trim(BUF_POOL_T *pool, INT32 nr);
+static INT32 pool_hash(FS_INFO_T *p_fs, BUF_POOL_T *pool, UINT32 sec);
+
 static void push_to_mru(BUF_CACHE_T *bp, BUF_CACHE_T *list);
 static void push_to_lru(BUF_CACHE_T *bp, BUF_CACHE_T *list);
 static void move_to_mru(BUF_CACHE_T *bp, BUF_CACHE_T *list);
 static void move_to_lru(BUF_CACHE_T *bp, BUF_CACHE_T *list);
 
-INT32 buf_init(struct super_block *sb)
+/*
+ * Both caches start out with FAT_CACHE_SIZE/BUF_CACHE_SIZE entries and grow
+ * on demand up to a limit that scales with the size of the volume: one FAT
+ * sector per 2^FAT_CACHE_SHIFT bytes, one directory sector per
+ * 2^BUF_CACHE_SHIFT bytes. Every entry pins a buffer_head, so entries above
+ * the initial size are handed back by a per-volume shrinker.
+ */
+static UINT32 cache_limit(struct super_block *sb, UINT32 min_count,
+			  UINT32 max_count, UINT32 shift)
 {
-	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+	UINT64 nr = i_size_read(sb->s_bdev->bd_inode) >> shift;
+
+	return (UINT32) clamp_t(UINT64, nr, min_count, max_count);
+}
 
-	INT32 i;
+/*
+ * All cache users run under fs_struct[drv].v_sem, so the shrinker only
+ * trims when it can take that semaphore without waiting. fs_struct[].sb is
+ * set once the mount has completed and cleared after buf_shutdown().
+ */
+static int exfat_cache_shrink(struct shrinker *shrink, struct shrink_control *sc)
+{
+	FS_INFO_T *p_fs = container_of(shrink, FS_INFO_T, cache_shrinker);
+	INT32 drv = p_fs->drv;
+	INT32 nr = sc->nr_to_scan;
 
-	p_fs->FAT_cache_lru_list.next = p_fs->FAT_cache_lru_list.prev = &p_fs->FAT_cache_lru_list;
+	if (nr) {
+		if (!(sc->gfp_mask & __GFP_FS))
+			return -1;
 
-	for (i = 0; i < FAT_CACHE_SIZE; i++) {
-		p_fs->FAT_cache_array[i].drv = -1;
-		p_fs->FAT_cache_array[i].sec = ~0;
-		p_fs->FAT_cache_array[i].flag = 0;
-		p_fs->FAT_cache_array[i].buf_bh = NULL;
-		p_fs->FAT_cache_array[i].prev = p_fs->FAT_cache_array[i].next = NULL;
-		push_to_mru(&(p_fs->FAT_cache_array[i]), &p_fs->FAT_cache_lru_list);
-	}
+		if (!fs_struct[drv].sb ||
+		    &(EXFAT_SB(fs_struct[drv].sb)->fs_info) != p_fs)
+			return -1;
 
-	p_fs->buf_cache_lru_list.next = p_fs->buf_cache_lru_list.prev = &p_fs->buf_cache_lru_list;
+		if (down_trylock(&(fs_struct[drv].v_sem)))
+			return -1;
 
-	for (i = 0; i < BUF_CACHE_SIZE; i++) {
-		p_fs->buf_cache_array[i].drv = -1;
-		p_fs->buf_cache_array[i].sec = ~0;
-		p_fs->buf_cache_array[i].flag = 0;
-		p_fs->buf_cache_array[i].buf_bh = NULL;
-		p_fs->buf_cache_array[i].prev = p_fs->buf_cache_array[i].next = NULL;
-		push_to_mru(&(p_fs->buf_cache_array[i]), &p_fs->buf_cache_lru_list);
-	}
+		nr = pool_trim(&p_fs->buf_cache, nr);
+		pool_trim(&p_fs->FAT_cache, nr);
 
-	for (i = 0; i < FAT_CACHE_HASH_SIZE; i++) {
-		p_fs->FAT_cache_hash_list[i].drv = -1;
-		p_fs->FAT_cache_hash_list[i].sec = ~0;
-		p_fs->FAT_cache_hash_list[i].hash_next = p_fs->FAT_cache_hash_list[i].hash_prev = &(p_fs->FAT_cache_hash_list[i]);
+		up(&(fs_struct[drv].v_sem));
 	}
 
-	for (i = 0; i < FAT_CACHE_SIZE; i++) {
-		FAT_cache_insert_hash(sb, &(p_fs->FAT_cache_array[i]));
-	}
+	return (p_fs->FAT_cache.count - p_fs->FAT_cache.min_count) +
+	       (p_fs->buf_cache.count - p_fs->buf_cache.min_count);
+}
 
-	for (i = 0; i < BUF_CACHE_HASH_SIZE; i++) {
-		p_fs->buf_cache_hash_list[i].drv = -1;
-		p_fs->buf_cache_hash_list[i].sec = ~0;
-		p_fs->buf_cache_hash_list[i].hash_next = p_fs->buf_cache_hash_list[i].hash_prev = &(p_fs->buf_cache_hash_list[i]);
-	}
+INT32 buf_init(struct super_block *sb)
+{
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
 
-	for (i = 0; i < BUF_CACHE_SIZE; i++) {
-		buf_cache_insert_hash(sb, &(p_fs->buf_cache_array[i]));
+	if (pool_init(&p_fs->FAT_cache, FAT_CACHE_SIZE,
+		      cache_limit(sb, FAT_CACHE_SIZE, FAT_CACHE_MAX_SIZE,
+				  FAT_CACHE_SHIFT)) != FFS_SUCCESS)
+		return(FFS_MEMORYERR);
+
+	if (pool_init(&p_fs->buf_cache, BUF_CACHE_SIZE,
+		      cache_limit(sb, BUF_CACHE_SIZE, BUF_CACHE_MAX_SIZE,
+				  BUF_CACHE_SHIFT)) != FFS_SUCCESS) {
+		pool_destroy(&p_fs->FAT_cache);
+		return(FFS_MEMORYERR);
 	}
 
+	p_fs->cache_shrinker.shrink = exfat_cache_shrink;
+	p_fs->cache_shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&p_fs->cache_shrinker);
+
 	return(FFS_SUCCESS);
 }
 
 INT32 buf_shutdown(struct super_block *sb)
 {
+	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
+
+	if (!p_fs->buf_cache.hash_list)
+		return(FFS_SUCCESS);
+
+	unregister_shrinker(&p_fs->cache_shrinker);
+
+	pool_destroy(&p_fs->FAT_cache);
+	pool_destroy(&p_fs->buf_cache);
+
 	return(FFS_SUCCESS);
 }
 
@@ -357,7 +392,7 @@ UINT8 *FAT_getblk(struct super_block *sb, UINT32 sec)
 
 	bp = FAT_cache_find(sb, sec);
 	if (bp != NULL) {
-		move_to_mru(bp, &p_fs->FAT_cache_lru_list);
+		move_to_mru(bp, &p_fs->FAT_cache.lru_list);
 		return(bp->buf_bh->b_data);
 	}
 
@@ -378,7 +413,7 @@ UINT8 *FAT_getblk(struct super_block *sb, UINT32 sec)
 		bp->flag = 0;
 		bp->buf_bh = NULL;
 
-		move_to_lru(bp, &p_fs->FAT_cache_lru_list);
+		move_to_lru(bp, &p_fs->FAT_cache.lru_list);
 		return NULL;
 	}
 
@@ -402,9 +437,10 @@ void FAT_release_all(struct super_block *sb)
 
 	sm_P(&f_sem);
 
-	bp = p_fs->FAT_cache_lru_list.next;
-	while (bp != &p_fs->FAT_cache_lru_list) {
+	bp = p_fs->FAT_cache.lru_list.next;
+	while (bp != &p_fs->FAT_cache.lru_list) {
 		if (bp->drv == p_fs->drv) {
+			FAT_cache_remove_hash(bp);
 			bp->drv = -1;
 			bp->sec = ~0;
 			bp->flag = 0;
@@ -427,8 +463,8 @@ void FAT_sync(struct super_block *sb)
 
 	sm_P(&f_sem);
 
-	bp = p_fs->FAT_cache_lru_list.next;
-	while (bp != &p_fs->FAT_cache_lru_list) {
+	bp = p_fs->FAT_cache.lru_list.next;
+	while (bp != &p_fs->FAT_cache.lru_list) {
 		if ((bp->drv == p_fs->drv) && (bp->flag & DIRTYBIT)) {
 			sync_dirty_buffer(bp->buf_bh);
 			bp->flag &= ~(DIRTYBIT);
@@ -442,13 +478,13 @@ void FAT_sync(struct super_block *sb)
 static BUF_CACHE_T *FAT_cache_find(struct super_block *sb, UINT32 sec)
 {
 	INT32 off;
-	BUF_CACHE_T *bp, *hp;
+	BUF_CACHE_T *bp;
+	struct hlist_node *pos;
 	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
 
-	off = (sec + (sec >> p_fs->sectors_per_clu_bits)) & (FAT_CACHE_HASH_SIZE - 1);
+	off = pool_hash(p_fs, &p_fs->FAT_cache, sec);
 
-	hp = &(p_fs->FAT_cache_hash_list[off]);
-	for (bp = hp->hash_next; bp != hp; bp = bp->hash_next) {
+	hlist_for_each_entry(bp, pos, &(p_fs->FAT_cache.hash_list[off]), hash) {
 		if ((bp->drv == p_fs->drv) && (bp->sec == sec)) {
 
 			WARN(!bp->buf_bh, "[EXFAT] FAT_cache has no bh. "
@@ -463,36 +499,25 @@ static BUF_CACHE_T *FAT_cache_find(struct super_block *sb, UINT32 sec)
 
 static BUF_CACHE_T *FAT_cache_get(struct super_block *sb, UINT32 sec)
 {
-	BUF_CACHE_T *bp;
 	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
 
-	bp = p_fs->FAT_cache_lru_list.prev;
-
-
-	move_to_mru(bp, &p_fs->FAT_cache_lru_list);
-	return(bp);
+	return(pool_get(&p_fs->FAT_cache));
 }
 
 static void FAT_cache_insert_hash(struct super_block *sb, BUF_CACHE_T *bp)
 {
 	INT32 off;
-	BUF_CACHE_T *hp;
 	FS_INFO_T *p_fs;
 
 	p_fs = &(EXFAT_SB(sb)->fs_info);
-	off = (bp->sec + (bp->sec >> p_fs->sectors_per_clu_bits)) & (FAT_CACHE_HASH_SIZE-1);
+	off = pool_hash(p_fs, &p_fs->FAT_cache, bp->sec);
 
-	hp = &(p_fs->FAT_cache_hash_list[off]);
-	bp->hash_next = hp->hash_next;
-	bp->hash_prev = hp;
-	hp->hash_next->hash_prev = bp;
-	hp->hash_next = bp;
+	hlist_add_head(&bp->hash, &(p_fs->FAT_cache.hash_list[off]));
 }
 
 static void FAT_cache_remove_hash(BUF_CACHE_T *bp)
 {
-	(bp->hash_prev)->hash_next = bp->hash_next;
-	(bp->hash_next)->hash_prev = bp->hash_prev;
+	hlist_del_init(&bp->hash);
 }
 
 UINT8 *buf_getblk(struct super_block *sb, UINT32 sec)
@@ -515,7 +540,7 @@ static UINT8 *__buf_getblk(struct super_block *sb, UINT32 sec)
 
 	bp = buf_cache_find(sb, sec);
 	if (bp != NULL) {
-		move_to_mru(bp, &p_fs->buf_cache_lru_list);
+		move_to_mru(bp, &p_fs->buf_cache.lru_list);
 		return(bp->buf_bh->b_data);
 	}
 
@@ -536,7 +561,7 @@ static UINT8 *__buf_getblk(struct super_block *sb, UINT32 sec)
 		bp->flag = 0;
 		bp->buf_bh = NULL;
 
-		move_to_lru(bp, &p_fs->buf_cache_lru_list);
+		move_to_lru(bp, &p_fs->buf_cache.lru_list);
 		return NULL;
 	}
 
@@ -597,6 +622,7 @@ void buf_release(struct super_block *sb, UINT32 sec)
 
 	bp = buf_cache_find(sb, sec);
 	if (likely(bp != NULL)) {
+		buf_cache_remove_hash(bp);
 		bp->drv = -1;
 		bp->sec = ~0;
 		bp->flag = 0;
@@ -606,7 +632,7 @@ void buf_release(struct super_block *sb, UINT32 sec)
 			bp->buf_bh = NULL;
 		}
 
-		move_to_lru(bp, &p_fs->buf_cache_lru_list);
+		move_to_lru(bp, &p_fs->buf_cache.lru_list);
 	}
 
 	sm_V(&b_sem);
@@ -619,9 +645,10 @@ void buf_release_all(struct super_block *sb)
 
 	sm_P(&b_sem);
 
-	bp = p_fs->buf_cache_lru_list.next;
-	while (bp != &p_fs->buf_cache_lru_list) {
+	bp = p_fs->buf_cache.lru_list.next;
+	while (bp != &p_fs->buf_cache.lru_list) {
 		if (bp->drv == p_fs->drv) {
+			buf_cache_remove_hash(bp);
 			bp->drv = -1;
 			bp->sec = ~0;
 			bp->flag = 0;
@@ -644,8 +671,8 @@ void buf_sync(struct super_block *sb)
 
 	sm_P(&b_sem);
 
-	bp = p_fs->buf_cache_lru_list.next;
-	while (bp != &p_fs->buf_cache_lru_list) {
+	bp = p_fs->buf_cache.lru_list.next;
+	while (bp != &p_fs->buf_cache.lru_list) {
 		if ((bp->drv == p_fs->drv) && (bp->flag & DIRTYBIT)) {
 			sync_dirty_buffer(bp->buf_bh);
 			bp->flag &= ~(DIRTYBIT);
@@ -659,13 +686,13 @@ void buf_sync(struct super_block *sb)
 static BUF_CACHE_T *buf_cache_find(struct super_block *sb, UINT32 sec)
 {
 	INT32 off;
-	BUF_CACHE_T *bp, *hp;
+	BUF_CACHE_T *bp;
+	struct hlist_node *pos;
 	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
 
-	off = (sec + (sec >> p_fs->sectors_per_clu_bits)) & (BUF_CACHE_HASH_SIZE - 1);
+	off = pool_hash(p_fs, &p_fs->buf_cache, sec);
 
-	hp = &(p_fs->buf_cache_hash_list[off]);
-	for (bp = hp->hash_next; bp != hp; bp = bp->hash_next) {
+	hlist_for_each_entry(bp, pos, &(p_fs->buf_cache.hash_list[off]), hash) {
 		if ((bp->drv == p_fs->drv) && (bp->sec == sec)) {
 			touch_buffer(bp->buf_bh);
 			return(bp);
@@ -676,37 +703,147 @@ static BUF_CACHE_T *buf_cache_find(struct super_block *sb, UINT32 sec)
 
 static BUF_CACHE_T *buf_cache_get(struct super_block *sb, UINT32 sec)
 {
-	BUF_CACHE_T *bp;
 	FS_INFO_T *p_fs = &(EXFAT_SB(sb)->fs_info);
 
-	bp = p_fs->buf_cache_lru_list.prev;
-	while (bp->flag & LOCKBIT) bp = bp->prev;
-
-
-	move_to_mru(bp, &p_fs->buf_cache_lru_list);
-	return(bp);
+	return(pool_get(&p_fs->buf_cache));
 }
 
 static void buf_cache_insert_hash(struct super_block *sb, BUF_CACHE_T *bp)
 {
 	INT32 off;
-	BUF_CACHE_T *hp;
 	FS_INFO_T *p_fs;
 
 	p_fs = &(EXFAT_SB(sb)->fs_info);
-	off = (bp->sec + (bp->sec >> p_fs->sectors_per_clu_bits)) & (BUF_CACHE_HASH_SIZE-1);
+	off = pool_hash(p_fs, &p_fs->buf_cache, bp->sec);
 
-	hp = &(p_fs->buf_cache_hash_list[off]);
-	bp->hash_next = hp->hash_next;
-	bp->hash_prev = hp;
-	hp->hash_next->hash_prev = bp;
-	hp->hash_next = bp;
+	hlist_add_head(&bp->hash, &(p_fs->buf_cache.hash_list[off]));
 }
 
 static void buf_cache_remove_hash(BUF_CACHE_T *bp)
 {
-	(bp->hash_prev)->hash_next = bp->hash_next;
-	(bp->hash_next)->hash_prev = bp->hash_prev;
+	hlist_del_init(&bp->hash);
+}
+
+static BUF_CACHE_T *pool_alloc_entry(BUF_POOL_T *pool, gfp_t gfp)
+{
+	BUF_CACHE_T *bp;
+
+	bp = kmalloc(sizeof(BUF_CACHE_T), gfp);
+	if (!bp)
+		return NULL;
+
+	bp->drv = -1;
+	bp->sec = ~0;
+	bp->flag = 0;
+	bp->buf_bh = NULL;
+	INIT_HLIST_NODE(&bp->hash);
+
+	push_to_lru(bp, &pool->lru_list);
+	pool->count++;
+
+	return bp;
+}
+
+static void pool_free_entry(BUF_POOL_T *pool, BUF_CACHE_T *bp)
+{
+	bp->prev->next = bp->next;
+	bp->next->prev = bp->prev;
+	hlist_del_init(&bp->hash);
+
+	if (bp->buf_bh)
+		__brelse(bp->buf_bh);
+
+	kfree(bp);
+	pool->count--;
+}
+
+static INT32 pool_init(BUF_POOL_T *pool, UINT32 min_count, UINT32 max_count)
+{
+	UINT32 i, nr_hash;
+
+	nr_hash = roundup_pow_of_two(max_count / BUF_CACHE_HASH_DEPTH);
+
+	pool->lru_list.next = pool->lru_list.prev = &pool->lru_list;
+	pool->count = 0;
+	pool->min_count = min_count;
+	pool->max_count = max_count;
+	pool->hash_mask = nr_hash - 1;
+
+	pool->hash_list = kmalloc(nr_hash * sizeof(struct hlist_head), GFP_KERNEL);
+	if (!pool->hash_list)
+		return(FFS_MEMORYERR);
+
+	for (i = 0; i < nr_hash; i++)
+		INIT_HLIST_HEAD(&(pool->hash_list[i]));
+
+	for (i = 0; i < min_count; i++) {
+		if (!pool_alloc_entry(pool, GFP_KERNEL)) {
+			pool_destroy(pool);
+			return(FFS_MEMORYERR);
+		}
+	}
+
+	return(FFS_SUCCESS);
+}
+
+static void pool_destroy(BUF_POOL_T *pool)
+{
+	while (pool->lru_list.next != &pool->lru_list)
+		pool_free_entry(pool, pool->lru_list.next);
+
+	kfree(pool->hash_list);
+	pool->hash_list = NULL;
+}
+
+/*
+ * Returns the entry to (re)use for a new sector, at the MRU end. Unused
+ * entries sit at the LRU end and are taken first; otherwise the pool grows
+ * while it is below its limit, and only then is the LRU entry evicted.
+ */
+static BUF_CACHE_T *pool_get(BUF_POOL_T *pool)
+{
+	BUF_CACHE_T *bp;
+
+	bp = pool->lru_list.prev;
+	if ((bp->drv == -1) && !(bp->flag & LOCKBIT))
+		goto out;
+
+	if (pool->count < pool->max_count) {
+		bp = pool_alloc_entry(pool, GFP_NOFS | __GFP_NOWARN);
+		if (bp)
+			goto out;
+	}
+
+	bp = pool->lru_list.prev;
+	while (bp->flag & LOCKBIT) bp = bp->prev;
+
+out:
+	move_to_mru(bp, &pool->lru_list);
+	return(bp);
+}
+
+/* Frees up to @nr unlocked entries above the initial size, LRU first */
+static INT32 pool_trim(BUF_POOL_T *pool, INT32 nr)
+{
+	BUF_CACHE_T *bp, *prev;
+
+	bp = pool->lru_list.prev;
+	while ((nr > 0) && (pool->count > pool->min_count) &&
+	       (bp != &pool->lru_list)) {
+		prev = bp->prev;
+		if (!(bp->flag & LOCKBIT)) {
+			pool_free_entry(pool, bp);
+			nr--;
+		}
+		bp = prev;
+	}
+
+	return(nr);
+}
+
+static INT32 pool_hash(FS_INFO_T *p_fs, BUF_POOL_T *pool, UINT32 sec)
+{
+	return((sec + (sec >> p_fs->sectors_per_clu_bits)) & pool->hash_mask);
 }
 
 static void push_to_mru(BUF_CACHE_T *bp, BUF_CACHE_T *list)
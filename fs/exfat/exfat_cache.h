@@ -32,14 +32,23 @@ extern "C" {
 	typedef struct __BUF_CACHE_T {
 		struct __BUF_CACHE_T *next;
 		struct __BUF_CACHE_T *prev;
-		struct __BUF_CACHE_T *hash_next;
-		struct __BUF_CACHE_T *hash_prev;
+		struct hlist_node    hash;
 		INT32                drv;
 		UINT32               sec;
 		UINT32               flag;
 		struct buffer_head   *buf_bh;
 	} BUF_CACHE_T;
 
+	/* one of the two per-volume caches: FAT sectors or directory sectors */
+	typedef struct __BUF_POOL_T {
+		BUF_CACHE_T          lru_list;
+		struct hlist_head    *hash_list;
+		UINT32               hash_mask;
+		UINT32               count;
+		UINT32               min_count;
+		UINT32               max_count;
+	} BUF_POOL_T;
+
 	INT32  buf_init(struct super_block *sb);
 	INT32  buf_shutdown(struct super_block *sb);
 	INT32  FAT_read(struct super_block *sb, UINT32 loc, UINT32 *content);
@@ -28,9 +28,13 @@ extern "C" {
 #define MAX_OPEN                20
 #define MAX_DENTRY              512
 #define FAT_CACHE_SIZE          128
-#define FAT_CACHE_HASH_SIZE     64
+#define FAT_CACHE_MAX_SIZE      2048
+#define FAT_CACHE_SHIFT         25
 #define BUF_CACHE_SIZE          256
-#define BUF_CACHE_HASH_SIZE     64
+#define BUF_CACHE_MAX_SIZE      1024
+#define BUF_CACHE_SHIFT         26
+#define BUF_CACHE_HASH_DEPTH    4
+#define FREE_EXTENT_MAX         16384
 #define DEFAULT_CODEPAGE        437
 #define DEFAULT_IOCHARSET       "utf8"
 #ifdef __cplusplus
@@ -24,6 +24,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/fs.h>
+#include <linux/rbtree.h>
 #include "exfat_config.h"
 
 #ifdef CONFIG_EXFAT_SUPPORT_STLOG
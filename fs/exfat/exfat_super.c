@@ -162,6 +162,7 @@ static time_t accum_days_in_year[] = {
 };
 
 static void _exfat_truncate(struct inode *inode, loff_t old_size);
+static void exfat_extent_inval(struct inode *inode);
 
 void exfat_time_fat2unix(struct exfat_sb_info *sbi, struct timespec *ts,
 						 DATE_TIME_T *tp)
@@ -1345,6 +1346,7 @@ static void _exfat_truncate(struct inode *inode, loff_t old_size)
 
 	if (EXFAT_I(inode)->fid.start_clu == 0) goto out;
 
+	exfat_extent_inval(inode);
 	err = FsTruncateFile(inode, old_size, i_size_read(inode));
 	if (err) goto out;
 
@@ -1381,6 +1383,104 @@ const struct inode_operations exfat_file_inode_operations = {
 #endif
 };
 
+/*
+ * Each inode caches a few runs of clusters that are contiguous both in the
+ * file and on disk, so exfat_get_block() can map a whole run at once and
+ * mpage_readpages()/mpage_writepages()/direct I/O build bios that span
+ * clusters instead of walking the FAT chain one cluster per call.
+ */
+static int exfat_extent_lookup(struct inode *inode, unsigned int fclus,
+					 unsigned int *dclus, unsigned int *len)
+{
+	struct exfat_inode_info *ei = EXFAT_I(inode);
+	struct exfat_extent *ext;
+	int i, found = 0;
+
+	spin_lock(&ei->extent_lock);
+	for (i = 0; i < ei->nr_extents; i++) {
+		ext = &ei->extents[i];
+		if ((fclus >= ext->fclus) && (fclus < ext->fclus + ext->len)) {
+			*dclus = ext->dclus + (fclus - ext->fclus);
+			*len = ext->len - (fclus - ext->fclus);
+			found = 1;
+			break;
+		}
+	}
+	spin_unlock(&ei->extent_lock);
+
+	return found;
+}
+
+static void exfat_extent_add(struct inode *inode, unsigned int fclus,
+					   unsigned int dclus, unsigned int len)
+{
+	struct exfat_inode_info *ei = EXFAT_I(inode);
+	struct exfat_extent *ext;
+	int i;
+
+	spin_lock(&ei->extent_lock);
+	for (i = 0; i < ei->nr_extents; i++) {
+		ext = &ei->extents[i];
+		if ((fclus >= ext->fclus) && (fclus <= ext->fclus + ext->len) &&
+		    (dclus - fclus == ext->dclus - ext->fclus)) {
+			if (fclus + len > ext->fclus + ext->len)
+				ext->len = fclus + len - ext->fclus;
+			goto out;
+		}
+	}
+
+	if (ei->nr_extents < EXFAT_MAX_EXTENTS) {
+		ext = &ei->extents[ei->nr_extents++];
+	} else {
+		ext = &ei->extents[ei->extent_victim];
+		ei->extent_victim = (ei->extent_victim + 1) % EXFAT_MAX_EXTENTS;
+	}
+	ext->fclus = fclus;
+	ext->dclus = dclus;
+	ext->len = len;
+out:
+	spin_unlock(&ei->extent_lock);
+}
+
+static void exfat_extent_inval(struct inode *inode)
+{
+	struct exfat_inode_info *ei = EXFAT_I(inode);
+
+	spin_lock(&ei->extent_lock);
+	ei->nr_extents = 0;
+	ei->extent_victim = 0;
+	spin_unlock(&ei->extent_lock);
+}
+
+/*
+ * Returns the number of clusters from file cluster @fclus (disk cluster
+ * @dclus) on that are contiguous on disk, at most @max_clus and never past
+ * i_size.
+ */
+static unsigned int exfat_extent_probe(struct inode *inode, unsigned int fclus,
+					 unsigned int dclus, unsigned int max_clus)
+{
+	FS_INFO_T *p_fs = &(EXFAT_SB(inode->i_sb)->fs_info);
+	unsigned int nr_clus, len, next;
+
+	nr_clus = (unsigned int)((i_size_read(inode) + p_fs->cluster_size - 1)
+				 >> p_fs->cluster_size_bits);
+	if (fclus >= nr_clus)
+		return 1;
+	max_clus = min(max_clus, nr_clus - fclus);
+
+	if (EXFAT_I(inode)->fid.flags == 0x03)
+		return max(max_clus, 1U);
+
+	for (len = 1; len < max_clus; len++) {
+		if (FsMapCluster(inode, fclus + len, &next) ||
+		    (next != dclus + len))
+			break;
+	}
+
+	return len;
+}
+
 static int exfat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 					  unsigned long *mapped_blocks, int *create)
 {
@@ -1392,7 +1492,8 @@ static int exfat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	const unsigned char blocksize_bits = sb->s_blocksize_bits;
 	sector_t last_block;
 	int err, clu_offset, sec_offset;
-	unsigned int cluster;
+	unsigned long max_blocks = *mapped_blocks;
+	unsigned int cluster, run;
 
 	*phys = 0;
 	*mapped_blocks = 0;
@@ -1417,6 +1518,12 @@ static int exfat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	clu_offset = sector >> p_fs->sectors_per_clu_bits;
 	sec_offset = sector & (p_fs->sectors_per_clu - 1);
 
+	if (!*create && exfat_extent_lookup(inode, clu_offset, &cluster, &run)) {
+		*phys = START_SECTOR(cluster) + sec_offset;
+		*mapped_blocks = (run << p_fs->sectors_per_clu_bits) - sec_offset;
+		return 0;
+	}
+
 	EXFAT_I(inode)->fid.size = i_size_read(inode);
 
 	err = FsMapCluster(inode, clu_offset, &cluster);
@@ -1427,8 +1534,15 @@ static int exfat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 		else
 			return -EIO;
 	} else if (cluster != CLUSTER_32(~0)) {
+		run = 1;
+		if (!*create)
+			run = exfat_extent_probe(inode, clu_offset, cluster,
+				(sec_offset + max_blocks + p_fs->sectors_per_clu - 1)
+				>> p_fs->sectors_per_clu_bits);
+		exfat_extent_add(inode, clu_offset, cluster, run);
+
 		*phys = START_SECTOR(cluster) + sec_offset;
-		*mapped_blocks = p_fs->sectors_per_clu - sec_offset;
+		*mapped_blocks = (run << p_fs->sectors_per_clu_bits) - sec_offset;
 	}
 
 	return 0;
@@ -1440,7 +1554,7 @@ static int exfat_get_block(struct inode *inode, sector_t iblock,
 	struct super_block *sb = inode->i_sb;
 	unsigned long max_blocks = bh_result->b_size >> inode->i_blkbits;
 	int err;
-	unsigned long mapped_blocks;
+	unsigned long mapped_blocks = max_blocks;
 	sector_t phys;
 
 	__lock_super(sb);
@@ -1764,6 +1878,8 @@ static struct inode *exfat_alloc_inode(struct super_block *sb) {
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,4,00)
 	init_rwsem(&ei->truncate_lock);
 #endif
+	ei->nr_extents = 0;
+	ei->extent_victim = 0;
 
 	return &ei->vfs_inode;
 }
@@ -1818,6 +1934,7 @@ static void exfat_evict_inode(struct inode *inode)
 		loff_t old_size = i_size_read(inode);
 		i_size_write(inode, 0);
 		EXFAT_I(inode)->fid.size = old_size;
+		exfat_extent_inval(inode);
 		FsTruncateFile(inode, old_size, 0);
 	}
 
@@ -2335,6 +2452,7 @@ static void init_once(void *foo)
 	struct exfat_inode_info *ei = (struct exfat_inode_info *)foo;
 
 	INIT_HLIST_NODE(&ei->i_hash_fat);
+	spin_lock_init(&ei->extent_lock);
 	inode_init_once(&ei->vfs_inode);
 }
 
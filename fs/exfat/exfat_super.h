@@ -87,12 +87,25 @@ struct exfat_sb_info {
 #endif
 };
 
+#define EXFAT_MAX_EXTENTS	8
+
+/* file clusters fclus..fclus+len-1 are disk clusters dclus..dclus+len-1 */
+struct exfat_extent {
+	unsigned int fclus;
+	unsigned int dclus;
+	unsigned int len;
+};
+
 struct exfat_inode_info {
 	FILE_ID_T fid;
 	char  *target;
 	loff_t mmu_private;    
 	loff_t i_pos;         
 	struct hlist_node i_hash_fat; 
+	spinlock_t extent_lock;
+	int nr_extents;
+	int extent_victim;
+	struct exfat_extent extents[EXFAT_MAX_EXTENTS];
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,4,00)
 	struct rw_semaphore truncate_lock;
 #endif
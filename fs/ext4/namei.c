@@ -177,10 +177,17 @@ static int ext4_htree_next_block(struct inode *dir, __u32 hash,
 				 struct dx_frame *frame,
 				 struct dx_frame *frames,
 				 __u32 *start_hash);
+#ifdef CONFIG_SDCARD_FS_CI_SEARCH
+static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
+		const struct qstr *d_name,
+		struct ext4_dir_entry_2 **res_dir,
+		int *err, char *ci_name_buf);
+#else
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir,
 		const struct qstr *d_name,
 		struct ext4_dir_entry_2 **res_dir,
 		int *err);
+#endif
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 			     struct inode *inode);
 
@@ -930,7 +937,22 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 		goto restart;
 	}
 	if (is_dx(dir)) {
+#ifdef CONFIG_SDCARD_FS_CI_SEARCH
+		bh = ext4_dx_find_entry(dir, d_name, res_dir, &err,
+					ci_name_buf);
+		/*
+		 * The index is hashed on the exact name, so it only finds
+		 * names that match in case (or share their hash block). A
+		 * case-insensitive lookup it misses has to scan the
+		 * directory.
+		 */
+		if (err == -ENOENT && ci_name_buf) {
+			err = 0;
+			goto linear;
+		}
+#else
 		bh = ext4_dx_find_entry(dir, d_name, res_dir, &err);
+#endif
 		/*
 		 * On success, or if the error was file not found,
 		 * return.  Otherwise, fall back to doing a search the
@@ -945,6 +967,9 @@ static struct buffer_head * ext4_find_entry (struct inode *dir,
 		dxtrace(printk(KERN_DEBUG "ext4_find_entry: dx failed, "
 			       "falling back\n"));
 	}
+#ifdef CONFIG_SDCARD_FS_CI_SEARCH
+linear:
+#endif
 	nblocks = dir->i_size >> EXT4_BLOCK_SIZE_BITS(sb);
 	start = EXT4_I(dir)->i_dir_start_lookup;
 	if (start >= nblocks)
@@ -1032,8 +1057,14 @@ cleanup_and_exit:
 	return ret;
 }
 
+#ifdef CONFIG_SDCARD_FS_CI_SEARCH
+static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct qstr *d_name,
+		       struct ext4_dir_entry_2 **res_dir, int *err,
+		       char *ci_name_buf)
+#else
 static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct qstr *d_name,
 		       struct ext4_dir_entry_2 **res_dir, int *err)
+#endif
 {
 	struct super_block * sb = dir->i_sb;
 	struct dx_hash_info	hinfo;
@@ -1052,7 +1083,7 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct q
 #ifdef CONFIG_SDCARD_FS_CI_SEARCH
 		retval = search_dirblock(bh, dir, d_name,
 					 block << EXT4_BLOCK_SIZE_BITS(sb),
-					 res_dir, NULL);
+					 res_dir, ci_name_buf);
 #else
 		retval = search_dirblock(bh, dir, d_name,
 					 block << EXT4_BLOCK_SIZE_BITS(sb),
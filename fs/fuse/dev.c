@@ -20,21 +20,75 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/freezer.h>
+#include <linux/uaccess.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+void fuse_chan_init(struct fuse_conn *fc, struct fuse_chan *ch)
+{
+	memset(ch, 0, sizeof(*ch));
+	ch->fc = fc;
+	ch->connected = 1;
+	init_waitqueue_head(&ch->waitq);
+	INIT_LIST_HEAD(&ch->pending);
+	INIT_LIST_HEAD(&ch->processing);
+	INIT_LIST_HEAD(&ch->interrupts);
+	INIT_LIST_HEAD(&ch->bg_queue);
+}
+
+/*
+ * Pick the channel to queue a new request on.  Requests are spread over
+ * the channels by submitting cpu, but a channel whose reader is not
+ * waiting for requests (busy, or not reading at all) is passed over for
+ * one that has an idle reader.
+ *
+ * Called with fc->lock held
+ */
+static struct fuse_chan *fuse_pick_chan(struct fuse_conn *fc)
+{
+	struct fuse_chan *ch;
+	unsigned idx;
+	unsigned i;
+
+	if (fc->nr_chans == 1)
+		return &fc->chan;
+
+	idx = raw_smp_processor_id() % fc->nr_chans;
+	for (i = 0; i < fc->nr_chans; i++) {
+		ch = fc->chans[(idx + i) % fc->nr_chans];
+		if (ch->connected && waitqueue_active(&ch->waitq))
+			return ch;
+	}
+
+	ch = fc->chans[idx];
+	return ch->connected ? ch : &fc->chan;
+}
+
+/*
+ * Background limits are per channel, the connection as a whole is
+ * limited by the sum over the connected channels
+ */
+static unsigned fuse_bg_limit(struct fuse_conn *fc, unsigned limit)
+{
+	if (limit > UINT_MAX / fc->live_chans)
+		return UINT_MAX;
+
+	return limit * fc->live_chans;
+}
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -238,18 +292,19 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 	return fc->reqctr;
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+static void queue_request(struct fuse_chan *ch, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	req->chan = ch;
+	list_add_tail(&req->list, &ch->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
-		atomic_inc(&fc->num_waiting);
+		atomic_inc(&ch->fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -260,27 +315,32 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 
 	spin_lock(&fc->lock);
 	if (fc->connected) {
+		/* Forgets can be read from any channel */
+		struct fuse_chan *ch = fuse_pick_chan(fc);
+
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		wake_up(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
 	}
 	spin_unlock(&fc->lock);
 }
 
-static void flush_bg_queue(struct fuse_conn *fc)
+static void flush_bg_queue(struct fuse_chan *ch)
 {
-	while (fc->active_background < fc->max_background &&
-	       !list_empty(&fc->bg_queue)) {
+	struct fuse_conn *fc = ch->fc;
+
+	while (ch->active_background < fc->max_background &&
+	       !list_empty(&ch->bg_queue)) {
 		struct fuse_req *req;
 
-		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
+		req = list_entry(ch->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
-		fc->active_background++;
+		ch->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(ch, req);
 	}
 }
 
@@ -303,18 +363,22 @@ __releases(fc->lock)
 	list_del(&req->intr_entry);
 	req->state = FUSE_REQ_FINISHED;
 	if (req->background) {
-		if (fc->num_background == fc->max_background) {
+		fc->num_background--;
+		req->chan->active_background--;
+		if (fc->bg_blocked && fc->num_background <
+		    fuse_bg_limit(fc, fc->max_background)) {
+			fc->bg_blocked = 0;
 			fc->blocked = 0;
 			wake_up_all(&fc->blocked_waitq);
 		}
-		if (fc->num_background == fc->congestion_threshold &&
+		if (fc->bg_congested && fc->num_background <
+		    fuse_bg_limit(fc, fc->congestion_threshold) &&
 		    fc->connected && fc->bdi_initialized) {
+			fc->bg_congested = 0;
 			clear_bdi_congested(&fc->bdi, BLK_RW_SYNC);
 			clear_bdi_congested(&fc->bdi, BLK_RW_ASYNC);
 		}
-		fc->num_background--;
-		fc->active_background--;
-		flush_bg_queue(fc);
+		flush_bg_queue(req->chan);
 	}
 	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
@@ -336,11 +400,11 @@ __acquires(fc->lock)
 	spin_lock(&fc->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+static void queue_interrupt(struct fuse_chan *ch, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &ch->interrupts);
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -358,7 +422,7 @@ __acquires(fc->lock)
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(req->chan, req);
 	}
 
 	if (!req->force) {
@@ -421,7 +485,7 @@ void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 		req->out.h.error = -ECONNREFUSED;
 	else {
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(fuse_pick_chan(fc), req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
@@ -435,17 +499,25 @@ EXPORT_SYMBOL_GPL(fuse_request_send);
 static void fuse_request_send_nowait_locked(struct fuse_conn *fc,
 					    struct fuse_req *req)
 {
+	struct fuse_chan *ch = fuse_pick_chan(fc);
+
 	req->background = 1;
+	req->chan = ch;
 	fc->num_background++;
-	if (fc->num_background == fc->max_background)
+	if (!fc->bg_blocked && fc->num_background >=
+	    fuse_bg_limit(fc, fc->max_background)) {
+		fc->bg_blocked = 1;
 		fc->blocked = 1;
-	if (fc->num_background == fc->congestion_threshold &&
+	}
+	if (!fc->bg_congested && fc->num_background >=
+	    fuse_bg_limit(fc, fc->congestion_threshold) &&
 	    fc->bdi_initialized) {
+		fc->bg_congested = 1;
 		set_bdi_congested(&fc->bdi, BLK_RW_SYNC);
 		set_bdi_congested(&fc->bdi, BLK_RW_ASYNC);
 	}
-	list_add_tail(&req->list, &fc->bg_queue);
-	flush_bg_queue(fc);
+	list_add_tail(&req->list, &ch->bg_queue);
+	flush_bg_queue(ch);
 }
 
 static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
@@ -476,7 +548,7 @@ static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 	req->in.h.unique = unique;
 	spin_lock(&fc->lock);
 	if (fc->connected) {
-		queue_request(fc, req);
+		queue_request(fuse_pick_chan(fc), req);
 		err = 0;
 	}
 	spin_unlock(&fc->lock);
@@ -915,21 +987,22 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_chan *ch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	return !list_empty(&ch->pending) || !list_empty(&ch->interrupts) ||
+		forget_pending(ch->fc);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_chan *ch)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_conn *fc = ch->fc;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&ch->waitq, &wait);
+	while (fc->connected && !request_pending(ch)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -939,7 +1012,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&ch->waitq, &wait);
 }
 
 /*
@@ -1103,9 +1176,10 @@ __releases(fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *ch, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = ch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -1115,32 +1189,32 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(ch))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(ch);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(ch))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&ch->interrupts)) {
+		req = list_entry(ch->interrupts.next, struct fuse_req,
 				 intr_entry);
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
+		if (list_empty(&ch->pending) || fc->forget_batch-- > 0)
 			return fuse_read_forget(fc, cs, nbytes);
 
 		if (fc->forget_batch <= -8)
 			fc->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(ch->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
@@ -1177,9 +1251,9 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &ch->processing);
 		if (req->interrupted)
-			queue_interrupt(fc, req);
+			queue_interrupt(ch, req);
 		spin_unlock(&fc->lock);
 	}
 	return reqsize;
@@ -1194,13 +1268,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(ch, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1228,18 +1302,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(in);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, ch->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(ch, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1667,11 +1741,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *ch, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &ch->processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1710,9 +1784,10 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *ch,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = ch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
@@ -1746,7 +1821,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(ch, oh.unique);
 	if (!req)
 		goto err_unlock;
 
@@ -1766,7 +1841,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(ch, req);
 
 		spin_unlock(&fc->lock);
 		fuse_copy_finish(cs);
@@ -1807,13 +1882,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(iocb->ki_filp);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(ch, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1824,13 +1899,15 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
+	struct fuse_chan *ch;
 	struct fuse_conn *fc;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	ch = fuse_get_chan(out);
+	if (!ch)
 		return -EPERM;
+	fc = ch->fc;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
@@ -1880,10 +1957,10 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
-	if (flags & SPLICE_F_MOVE)
+	if ((flags & SPLICE_F_MOVE) || fc->splice_move)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(ch, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1897,16 +1974,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	struct fuse_conn *fc;
+	if (!ch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = ch->fc;
+	poll_wait(file, &ch->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(ch))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1972,10 +2051,16 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	unsigned i;
+
 	fc->max_background = UINT_MAX;
-	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	for (i = 0; i < fc->nr_chans; i++) {
+		struct fuse_chan *ch = fc->chans[i];
+
+		flush_bg_queue(ch);
+		end_requests(fc, &ch->pending);
+		end_requests(fc, &ch->processing);
+	}
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -1995,6 +2080,24 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/* Called with fc->lock held */
+static void __fuse_wake_readers(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_chans; i++) {
+		wake_up_all(&fc->chans[i]->waitq);
+		kill_fasync(&fc->chans[i]->fasync, SIGIO, POLL_IN);
+	}
+}
+
+void fuse_wake_readers(struct fuse_conn *fc)
+{
+	spin_lock(&fc->lock);
+	__fuse_wake_readers(fc);
+	spin_unlock(&fc->lock);
+}
+
 /*
  * Abort all requests.
  *
@@ -2023,24 +2126,66 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		__fuse_wake_readers(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Close a cloned channel.  Requests not yet read move over to the
+ * mount time channel, requests already read through this channel can
+ * no longer be answered, so they are aborted.
+ *
+ * Called with fc->lock held, releases and reacquires it
+ */
+static void fuse_chan_close(struct fuse_chan *ch)
+__releases(fc->lock)
+__acquires(fc->lock)
+{
+	struct fuse_conn *fc = ch->fc;
+	struct fuse_chan *to = &fc->chan;
+	struct fuse_req *req;
+
+	ch->connected = 0;
+	fc->live_chans--;
+
+	list_for_each_entry(req, &ch->bg_queue, list)
+		req->chan = to;
+	list_splice_tail_init(&ch->bg_queue, &to->bg_queue);
+
+	list_for_each_entry(req, &ch->pending, list) {
+		req->chan = to;
+		if (req->background) {
+			ch->active_background--;
+			to->active_background++;
+		}
+	}
+	list_splice_tail_init(&ch->pending, &to->pending);
+	flush_bg_queue(to);
+	wake_up_all(&to->waitq);
+	kill_fasync(&to->fasync, SIGIO, POLL_IN);
+
+	end_requests(fc, &ch->processing);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (ch) {
+		struct fuse_conn *fc = ch->fc;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
+		if (ch != &fc->chan) {
+			fuse_chan_close(ch);
+		} else {
+			fc->connected = 0;
+			fc->blocked = 0;
+			end_queued_requests(fc);
+			end_polls(fc);
+			wake_up_all(&fc->blocked_waitq);
+		}
 		spin_unlock(&fc->lock);
 		fuse_conn_put(fc);
 	}
@@ -2051,12 +2196,97 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &ch->fasync);
+}
+
+/*
+ * Make @file, a newly opened device file, another channel of the
+ * connection of @old
+ */
+static int fuse_dev_clone(struct file *file, struct fuse_chan *old)
+{
+	struct fuse_conn *fc = old->fc;
+	struct fuse_chan *new;
+	struct fuse_chan *ch;
+	unsigned i;
+	int err;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	if (file->private_data)
+		goto out_unlock;
+
+	spin_lock(&fc->lock);
+	err = -ENOTCONN;
+	if (!fc->connected)
+		goto out_unlock_conn;
+
+	/* Reuse the slot of a closed clone if there is one */
+	for (i = 1; i < fc->nr_chans; i++) {
+		ch = fc->chans[i];
+		if (!ch->connected && list_empty(&ch->processing) &&
+		    !ch->active_background)
+			break;
+	}
+	if (i == fc->nr_chans) {
+		err = -EMFILE;
+		if (fc->nr_chans == FUSE_MAX_CHANS)
+			goto out_unlock_conn;
+		ch = new;
+		new = NULL;
+		fc->chans[fc->nr_chans++] = ch;
+	}
+	fuse_chan_init(fc, ch);
+	fc->live_chans++;
+	file->private_data = ch;
+	fuse_conn_get(fc);
+	err = 0;
+
+ out_unlock_conn:
+	spin_unlock(&fc->lock);
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(new);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct file *old;
+	u32 oldfd;
+	int err;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	/*
+	 * Only the fuse device can be cloned, CUSE channels have their
+	 * own file operations
+	 */
+	err = -EINVAL;
+	if (old->f_op == &fuse_dev_operations &&
+	    file->f_op == &fuse_dev_operations && fuse_get_chan(old))
+		err = fuse_dev_clone(file, fuse_get_chan(old));
+	fput(old);
+
+	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2071,6 +2301,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -44,6 +44,9 @@
     doing the mount will be allowed to access the filesystem */
 #define FUSE_ALLOW_OTHER         (1 << 1)
 
+/** Maximum number of device files (channels) per connection */
+#define FUSE_MAX_CHANS 32
+
 /** List of active connections */
 extern struct list_head fuse_conn_list;
 
@@ -115,6 +118,7 @@ enum {
 };
 
 struct fuse_conn;
+struct fuse_chan;
 
 /** FUSE specific file data */
 struct fuse_file {
@@ -224,12 +228,15 @@ enum fuse_req_state {
  */
 struct fuse_req {
 	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	    fuse_chan and fuse_conn */
 	struct list_head list;
 
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
+	/** Channel the request is queued on, set when queued */
+	struct fuse_chan *chan;
+
 	/** refcount */
 	atomic_t count;
 
@@ -324,6 +331,47 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A request channel.
+ *
+ * Every /dev/fuse file of a connection is a channel: the one given at
+ * mount time, and any cloned from it with FUSE_DEV_IOC_CLONE.  Requests
+ * are queued on one channel and can only be read and answered through
+ * that channel's file, so a multi-threaded daemon can give each thread
+ * its own channel and queue.
+ *
+ * All members are protected by fuse_conn->lock.
+ */
+struct fuse_chan {
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Channel file is open.  Cleared when a cloned file is
+	    released; the mount time channel is never closed alone */
+	unsigned connected:1;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** Number of background requests currently queued for userspace */
+	unsigned active_background;
+
+	/** The list of background requests set aside for later queuing */
+	struct list_head bg_queue;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+};
+
 /**
  * A Fuse connection.
  *
@@ -356,14 +404,17 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** The channel of the device file given at mount time */
+	struct fuse_chan chan;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Request channels, chans[0] is &chan */
+	struct fuse_chan *chans[FUSE_MAX_CHANS];
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Number of entries used in chans */
+	unsigned nr_chans;
+
+	/** Number of connected channels */
+	unsigned live_chans;
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -374,23 +425,24 @@ struct fuse_conn {
 	/** rbtree of fuse_files waiting for poll events indexed by ph */
 	struct rb_root polled_files;
 
-	/** Maximum number of outstanding background requests */
+	/** Maximum number of outstanding background requests per
+	    channel */
 	unsigned max_background;
 
-	/** Number of background requests at which congestion starts */
+	/** Number of background requests per channel at which
+	    congestion starts */
 	unsigned congestion_threshold;
 
 	/** Number of requests currently in the background */
 	unsigned num_background;
 
-	/** Number of background requests currently queued for userspace */
-	unsigned active_background;
-
-	/** The list of background requests set aside for later queuing */
-	struct list_head bg_queue;
+	/** Background requests reached max_background on all
+	    channels, the connection is blocked */
+	unsigned bg_blocked:1;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
+	/** Background requests reached congestion_threshold on all
+	    channels, the bdi is congested */
+	unsigned bg_congested:1;
 
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
@@ -490,6 +542,14 @@ struct fuse_conn {
 	/** Are BSD file locking primitives not implemented by fs? */
 	unsigned no_flock:1;
 
+	/** Steal pages from every reply spliced into the device, as if
+	    it was spliced with SPLICE_F_MOVE */
+	unsigned splice_move:1;
+
+	/** Keep dirty pages in the page cache, with i_size and mtime
+	    maintained by the kernel */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -511,9 +571,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -702,6 +759,14 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Initialize a request channel of the connection
+ */
+void fuse_chan_init(struct fuse_conn *fc, struct fuse_chan *ch);
+
+/* Wake up the readers of all channels */
+void fuse_wake_readers(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -789,5 +854,7 @@ unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
+int fuse_flush_times(struct inode *inode, struct fuse_file *ff);
+int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
 
 #endif /* _FS_FUSE_I_H */
@@ -32,12 +32,10 @@
 
 #include "scfs.h"
 
-#if MAX_BUFFER_CACHE
-/* cluster cache list, and related stuff */
-struct read_buffer_cache buffer_cache[MAX_BUFFER_CACHE];
-spinlock_t buffer_cache_lock;
-int read_buffer_index = 0;
-#endif
+/* decompressed cluster cache, and related stuff */
+static LIST_HEAD(cluster_cache_lru);
+static DEFINE_SPINLOCK(cluster_cache_lock);
+static int cluster_cache_count;
 
 #ifdef SCFS_ASYNC_READ_PAGES
 u64 scfs_readpage_total_count = ATOMIC_INIT(0);
@@ -56,6 +54,185 @@ atomic_t pcb_read_count = {0};
 atomic_t scfs_lower_read_count = {0};
 #endif
 
+static struct scfs_cached_cluster *
+scfs_alloc_cached_cluster(struct scfs_inode_info *sii, unsigned int cluster_idx)
+{
+	struct scfs_cached_cluster *cc;
+
+	cc = kmalloc(sizeof(*cc), GFP_NOFS | __GFP_NORETRY | __GFP_NOWARN);
+	if (!cc)
+		return NULL;
+
+	cc->page = alloc_pages(GFP_NOFS | __GFP_NORETRY | __GFP_NOWARN,
+		SCFS_MEMPOOL_ORDER);
+	if (!cc->page) {
+		kfree(cc);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&cc->inode_list);
+	INIT_LIST_HEAD(&cc->lru);
+	cc->cluster_idx = cluster_idx;
+	cc->users = 0;
+
+	/* an invalidation from here on makes the insert drop this entry */
+	spin_lock(&cluster_cache_lock);
+	cc->gen = sii->cluster_cache_gen;
+	spin_unlock(&cluster_cache_lock);
+
+	return cc;
+}
+
+static void scfs_free_cached_cluster(struct scfs_cached_cluster *cc)
+{
+	__free_pages(cc->page, SCFS_MEMPOOL_ORDER);
+	kfree(cc);
+}
+
+static void scfs_dispose_cached_clusters(struct list_head *dispose)
+{
+	struct scfs_cached_cluster *cc, *tmp;
+
+	list_for_each_entry_safe(cc, tmp, dispose, lru) {
+		list_del(&cc->lru);
+		scfs_free_cached_cluster(cc);
+	}
+}
+
+/* move up to @nr unused clusters from the LRU tail to @dispose */
+static int __scfs_shrink_cluster_cache(int nr, struct list_head *dispose)
+{
+	struct scfs_cached_cluster *cc, *tmp;
+	int freed = 0;
+
+	list_for_each_entry_safe_reverse(cc, tmp, &cluster_cache_lru, lru) {
+		if (freed >= nr)
+			break;
+		if (cc->users)
+			continue;
+		list_del_init(&cc->inode_list);
+		list_move(&cc->lru, dispose);
+		cluster_cache_count--;
+		freed++;
+	}
+
+	return freed;
+}
+
+static struct scfs_cached_cluster *
+scfs_get_cached_cluster(struct scfs_inode_info *sii, unsigned int cluster_idx)
+{
+	struct scfs_cached_cluster *cc;
+
+	spin_lock(&cluster_cache_lock);
+	list_for_each_entry(cc, &sii->cluster_cache, inode_list) {
+		if (cc->cluster_idx == cluster_idx) {
+			cc->users++;
+			list_move(&cc->lru, &cluster_cache_lru);
+			spin_unlock(&cluster_cache_lock);
+			return cc;
+		}
+	}
+	spin_unlock(&cluster_cache_lock);
+
+	return NULL;
+}
+
+static void scfs_put_cached_cluster(struct scfs_cached_cluster *cc)
+{
+	int unlinked;
+
+	spin_lock(&cluster_cache_lock);
+	unlinked = (--cc->users == 0 && list_empty(&cc->lru));
+	spin_unlock(&cluster_cache_lock);
+
+	if (unlinked)
+		scfs_free_cached_cluster(cc);
+}
+
+static void
+scfs_insert_cached_cluster(struct scfs_inode_info *sii,
+	struct scfs_cached_cluster *new)
+{
+	struct scfs_cached_cluster *cc;
+	LIST_HEAD(dispose);
+
+	spin_lock(&cluster_cache_lock);
+	if (new->gen != sii->cluster_cache_gen)
+		goto drop;
+
+	/* another reader may have brought in the same cluster meanwhile */
+	list_for_each_entry(cc, &sii->cluster_cache, inode_list)
+		if (cc->cluster_idx == new->cluster_idx)
+			goto drop;
+
+	list_add(&new->inode_list, &sii->cluster_cache);
+	list_add(&new->lru, &cluster_cache_lru);
+	if (++cluster_cache_count > SCFS_CLUSTER_CACHE_MAX)
+		__scfs_shrink_cluster_cache(cluster_cache_count -
+			SCFS_CLUSTER_CACHE_MAX, &dispose);
+	spin_unlock(&cluster_cache_lock);
+
+	scfs_dispose_cached_clusters(&dispose);
+	return;
+
+drop:
+	spin_unlock(&cluster_cache_lock);
+	scfs_free_cached_cluster(new);
+}
+
+/**
+ * scfs_invalidate_cluster_cache
+ *
+ * Parameters:
+ * @sii: inode whose cached clusters are to be dropped
+ *
+ * Description:
+ * - Called whenever the cluster contents of a file may change (append,
+ *   truncate) and when the inode is evicted. Clusters still being copied
+ *   from are unlinked here and freed by their last user.
+ */
+void scfs_invalidate_cluster_cache(struct scfs_inode_info *sii)
+{
+	struct scfs_cached_cluster *cc, *tmp;
+	LIST_HEAD(dispose);
+
+	spin_lock(&cluster_cache_lock);
+	sii->cluster_cache_gen++;
+	list_for_each_entry_safe(cc, tmp, &sii->cluster_cache, inode_list) {
+		list_del_init(&cc->inode_list);
+		if (cc->users)
+			list_del_init(&cc->lru);
+		else
+			list_move(&cc->lru, &dispose);
+		cluster_cache_count--;
+	}
+	spin_unlock(&cluster_cache_lock);
+
+	scfs_dispose_cached_clusters(&dispose);
+}
+
+static int scfs_cluster_cache_shrink(struct shrinker *shrink,
+	struct shrink_control *sc)
+{
+	LIST_HEAD(dispose);
+	int count;
+
+	spin_lock(&cluster_cache_lock);
+	if (sc->nr_to_scan)
+		__scfs_shrink_cluster_cache(sc->nr_to_scan, &dispose);
+	count = cluster_cache_count;
+	spin_unlock(&cluster_cache_lock);
+
+	scfs_dispose_cached_clusters(&dispose);
+	return count;
+}
+
+static struct shrinker scfs_cluster_cache_shrinker = {
+	.shrink = scfs_cluster_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 /**
  * scfs_readpage
  *
@@ -71,8 +248,10 @@ atomic_t scfs_lower_read_count = {0};
  *   (Reading in a cluster for just a single page read is inevitable, but this
  *    "amplified read" and decompressing overhead should be amortized when
  *    other pages in that same cluster is accessed later, and only incurs
- *    memcpy from the cached cluster buffer.)
- * - Recently accessed clusters ("buffer_cache") are cached for later reads.
+ *    memcpy from the cached cluster.)
+ * - The cluster is decompressed straight into a cluster cache entry, which
+ *   is kept per inode and trimmed by LRU and by the shrinker. If no entry
+ *   can be allocated, the read falls back to a mempool buffer.
  */
 
 static int scfs_readpage(struct file *file, struct page *page)
@@ -80,10 +259,9 @@ static int scfs_readpage(struct file *file, struct page *page)
 	struct scfs_inode_info *sii = SCFS_I(page->mapping->host);
 	struct scfs_sb_info *sbi = SCFS_S(page->mapping->host->i_sb);
 	struct scfs_cluster_buffer buffer = {NULL, NULL, NULL, NULL, 0};
+	struct scfs_cached_cluster *cc;
+	unsigned int cluster_idx = PAGE_TO_CLUSTER_INDEX(page, sii);
 	int ret = 0, compressed = 0;
-	int alloc_membuffer = 1;
-	int allocated_index = -1;
-	int i;
 	char *virt;
 
 	SCFS_PRINT("f:%s i:%d c:0x%x u:0x%x\n",
@@ -95,120 +273,49 @@ static int scfs_readpage(struct file *file, struct page *page)
 	scfs_readpage_total_count++;
 #endif
 
-#if MAX_BUFFER_CACHE
-	/* search buffer_cache first in case the cluster is left cached */
-	spin_lock(&buffer_cache_lock);
-	for (i = 0; i < MAX_BUFFER_CACHE; i++) {
-		if (buffer_cache[i].inode_number == sii->vfs_inode.i_ino &&
-				buffer_cache[i].cluster_number ==
-				PAGE_TO_CLUSTER_INDEX(page, sii) &&
-				atomic_read(&buffer_cache[i].is_used) != 1) {
-			atomic_set(&buffer_cache[i].is_used, 1);
-			spin_unlock(&buffer_cache_lock);
-			virt = kmap_atomic(page);
-
-			if (buffer_cache[i].is_compressed)
-				memcpy(virt, page_address(buffer_cache[i].u_page) +
-					PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE, PAGE_SIZE);
-			else
-				memcpy(virt, page_address(buffer_cache[i].c_page) +
-					PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE, PAGE_SIZE);
-
-			spin_lock(&buffer_cache_lock);
-			atomic_set(&buffer_cache[i].is_used, 0);
-			spin_unlock(&buffer_cache_lock);
-			kunmap_atomic(virt);
-			SetPageUptodate(page);
-			unlock_page(page);
-			SCFS_PRINT("%s<h> %d\n",file->f_path.dentry->d_name.name, page->index);
-
-			return 0;
-		}
-		if (i == read_buffer_index &&
-				atomic_read(&buffer_cache[i].is_used) == 1) {
-			read_buffer_index++;
-			if (read_buffer_index >= MAX_BUFFER_CACHE)
-				read_buffer_index = 0;
-		}
-	}
+	/* search the cluster cache first in case the cluster is left cached */
+	cc = scfs_get_cached_cluster(sii, cluster_idx);
+	if (cc) {
+		virt = kmap_atomic(page);
+		memcpy(virt, page_address(cc->page) +
+			PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE, PAGE_SIZE);
+		kunmap_atomic(virt);
+		scfs_put_cached_cluster(cc);
 
-	/* pick a slot in buffer_cache to use */
-	if (atomic_read(&buffer_cache[read_buffer_index].is_used) != 1) {
-		buffer.c_page = buffer_cache[read_buffer_index].c_page;
-		buffer.u_page = buffer_cache[read_buffer_index].u_page;
-		atomic_set(&buffer_cache[read_buffer_index].is_used, 1);
-		buffer_cache[read_buffer_index].inode_number = sii->vfs_inode.i_ino;
-		buffer_cache[read_buffer_index].cluster_number =
-			PAGE_TO_CLUSTER_INDEX(page, sii);
-		allocated_index = read_buffer_index++;
-
-		if (read_buffer_index >= MAX_BUFFER_CACHE)
-			read_buffer_index = 0;
-		alloc_membuffer = 0;
-	} else {
-		for (i = 0; i < MAX_BUFFER_CACHE; i++) {
-			if (atomic_read(&buffer_cache[i].is_used) != 1) {
-				buffer.c_page = buffer_cache[i].c_page;
-				buffer.u_page = buffer_cache[i].u_page;
-				atomic_set(&buffer_cache[i].is_used, 1);
-				buffer_cache[i].inode_number = sii->vfs_inode.i_ino;
-				buffer_cache[i].cluster_number =
-					PAGE_TO_CLUSTER_INDEX(page, sii);
-				allocated_index = i;
-				read_buffer_index = i + 1;
-
-				if (read_buffer_index >= MAX_BUFFER_CACHE)
-					read_buffer_index = 0;
-				alloc_membuffer = 0;
-				break;
-			}
-		}
+		SetPageUptodate(page);
+		unlock_page(page);
+		SCFS_PRINT("%s<h> %d\n",file->f_path.dentry->d_name.name, page->index);
+
+		return 0;
 	}
-	spin_unlock(&buffer_cache_lock);
-#endif
 
 #if (defined(SCFS_READ_PAGES_PROFILE) && defined(SCFS_ASYNC_READ_PAGES))
 	scfs_readpage_io_count++;
 #endif
 
-	/* sanity check & prepare buffers for scfs_read_cluster */
-	if (alloc_membuffer == 1 && (buffer.c_page || buffer.c_buffer))
-		ASSERT(0);
-
-	if (!buffer.c_page)
-		buffer.c_page = scfs_alloc_mempool_buffer(sbi);
+	/* scfs_read_cluster reads nothing for pages past EOF, don't cache those */
+	if (((loff_t)page->index << PAGE_SHIFT) < i_size_read(&sii->vfs_inode))
+		cc = scfs_alloc_cached_cluster(sii, cluster_idx);
 
+	/* prepare buffers for scfs_read_cluster */
+	buffer.c_page = scfs_alloc_mempool_buffer(sbi);
 	if (!buffer.c_page) {
 		SCFS_PRINT_ERROR("c_page malloc failed\n");
 		ret = -ENOMEM;
 		goto out;
 	}
+	buffer.c_buffer = page_address(buffer.c_page);
 
-	if (!buffer.c_buffer)
-		buffer.c_buffer = page_address(buffer.c_page);
-
-	if (!buffer.c_buffer) {
-		SCFS_PRINT_ERROR("c_buffer malloc failed\n");
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	if (!buffer.u_page)
+	if (cc) {
+		buffer.u_buffer = page_address(cc->page);
+	} else {
 		buffer.u_page = scfs_alloc_mempool_buffer(sbi);
-
-	if (!buffer.u_page) {
-		SCFS_PRINT_ERROR("u_page malloc failed\n");
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	if (!buffer.u_buffer)
+		if (!buffer.u_page) {
+			SCFS_PRINT_ERROR("u_page malloc failed\n");
+			ret = -ENOMEM;
+			goto out;
+		}
 		buffer.u_buffer = page_address(buffer.u_page);
-
-	if (!buffer.u_buffer) {
-		SCFS_PRINT_ERROR("u_buffer malloc failed\n");
-		ret = -ENOMEM;
-		goto out;
 	}
 
 	/* read cluster from lower */
@@ -225,17 +332,11 @@ static int scfs_readpage(struct file *file, struct page *page)
 		goto out;
 	}
 
-#if MAX_BUFFER_CACHE
-	/* don't need to spinlock, we have is_used=1 for this buffer */
-	if (alloc_membuffer != 1)
-		buffer_cache[allocated_index].is_compressed = compressed;
-#endif
-
 #ifdef SCFS_REMOVE_NO_COMPRESSED_UPPER_MEMCPY
 	/* fill page cache with the decompressed or original page */
 	if (compressed) {
 		virt = kmap_atomic(page);
-		memcpy(virt, page_address(buffer.u_page) + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
+		memcpy(virt, buffer.u_buffer + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
 			PAGE_SIZE);
 		kunmap_atomic(virt);
 	}
@@ -243,46 +344,39 @@ static int scfs_readpage(struct file *file, struct page *page)
 	/* fill page cache with the decompressed/original data */
 	virt = kmap_atomic(page);
 	if (compressed)
-		memcpy(virt, page_address(buffer.u_page) + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
+		memcpy(virt, buffer.u_buffer + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
 			PAGE_SIZE);
 	else
-		memcpy(virt, page_address(buffer.c_page) + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
+		memcpy(virt, buffer.c_buffer + PGOFF_IN_CLUSTER(page, sii) * PAGE_SIZE,
 			PAGE_SIZE);
 	kunmap_atomic(virt);
 #endif
 
 	SetPageUptodate(page);
 
-#if MAX_BUFFER_CACHE
-#ifndef SCFS_REMOVE_NO_COMPRESSED_UPPER_MEMCPY
-	if (alloc_membuffer != 1) {
-		spin_lock(&buffer_cache_lock);
-		atomic_set(&buffer_cache[allocated_index].is_used, 0);
-		spin_unlock(&buffer_cache_lock);
-	}
+	if (cc) {
+#ifdef SCFS_REMOVE_NO_COMPRESSED_UPPER_MEMCPY
+		/* an uncompressed cluster was read a page at a time into @page */
+		if (compressed) {
+			scfs_insert_cached_cluster(sii, cc);
+			cc = NULL;
+		}
 #else
-	if (alloc_membuffer != 1 && compressed) {
-		spin_lock(&buffer_cache_lock);
-		atomic_set(&buffer_cache[allocated_index].is_used, 0);
-		spin_unlock(&buffer_cache_lock);
-	} else if (alloc_membuffer != 1) {
-		spin_lock(&buffer_cache_lock);
-		buffer_cache[allocated_index].inode_number = -1;
-		buffer_cache[allocated_index].cluster_number = -1;
-		buffer_cache[allocated_index].is_compressed = -1;
-		atomic_set(&buffer_cache[allocated_index].is_used, -1);
-		spin_unlock(&buffer_cache_lock);
-	}
-#endif
+		if (!compressed)
+			memcpy(page_address(cc->page), buffer.c_buffer,
+				sii->cluster_size);
+		scfs_insert_cached_cluster(sii, cc);
+		cc = NULL;
 #endif
+	}
 
 out:
 	unlock_page(page);
 
-	if (alloc_membuffer == 1) {
-		scfs_free_mempool_buffer(buffer.c_page, sbi);
-		scfs_free_mempool_buffer(buffer.u_page, sbi);
-	}
+	if (cc)
+		scfs_free_cached_cluster(cc);
+	scfs_free_mempool_buffer(buffer.c_page, sbi);
+	scfs_free_mempool_buffer(buffer.u_page, sbi);
 
 	SCFS_PRINT("-f:%s i:%d c:0x%x u:0x%x\n",
 		file->f_path.dentry->d_name.name,
@@ -297,20 +391,18 @@ out:
 #include <linux/kthread.h>
 #include <linux/gfp.h>
 #include <linux/sched.h>
+#include <linux/workqueue.h>
 
-/* memory and file buffer for scfs_readpages, for queueing read requests */
-struct page *page_buffer_smb[MAX_PAGE_BUFFER_SIZE_SMB];
-struct file *file_buffer_smb[MAX_PAGE_BUFFER_SIZE_SMB];
-
-/* when page_buffer_smb and file_buffer_smb is full, then this filling_index is
-	set to MAX_PAGE_BUFFER_SIZE */
-int page_buffer_next_filling_index_smb;
-int page_buffer_next_io_index_smb;
-spinlock_t spinlock_smb;
+/* pages of one cluster, read and decompressed by one work item */
+struct scfs_read_work {
+	struct work_struct work;
+	struct file *file;
+	unsigned int cluster_idx;
+	int nr_pages;
+	struct page *pages[SCFS_CLUSTER_SIZE_MAX / PAGE_SIZE];
+};
 
-/* helper threads to process multiple read I/Os simultaneously */
-struct task_struct *smb_task[NR_CPUS] = {NULL, };
-int smb_task_status[NR_CPUS] = {0, };
+static struct workqueue_struct *scfs_read_wq;
 
 #ifdef SCFS_PRELOAD_BOOTING_CLUSTER
 int preload_booting_cluster_thread(void *nothing) {
@@ -413,163 +505,19 @@ next:
 }
 #endif
 
-int smb_init(void) {
-	int i, j;
-
-	page_buffer_next_filling_index_smb = 0;
-	page_buffer_next_io_index_smb = 0;
-	spin_lock_init(&spinlock_smb);
-
-	for (i = 0; i < NR_CPUS; i++) {
-		smb_task[i] = kthread_run(smb_thread, &smb_task_status[i], "scfs_mb%d", i);
-
-		if (IS_ERR(smb_task[i])) {
-			SCFS_PRINT_ERROR("smb_init: creating kthread failed\n");
-
-			for (j=0; j < i; j++)
-				kthread_stop(smb_task[j]);
-			return -ENOMEM;
-		}
-
-#ifdef SCFS_SMB_THREAD_CPU_AFFINITY
-		{
-			struct cpumask cpus[NR_CPUS];
-			cpumask_clear(&cpus[i]);
-			cpumask_set_cpu(i, &cpus[i]);
-
-			if (sched_setaffinity(smb_task[i]->pid, &cpus[i])) {
-				SCFS_PRINT_ERROR("smb_init: set CPU affinity failed\n");
-			}
-		}
-#endif
-	}
-
-#ifdef SCFS_PRELOAD_BOOTING_CLUSTER
-	scfs_pbc = kthread_run(preload_booting_cluster_thread, NULL, "scfs_pbc");
-	if (IS_ERR(scfs_pbc)) {
-		SCFS_PRINT_ERROR("preload_booting_cluster_thread: creating kthread failed\n");
-	} else {
-		SCFS_PRINT_ERROR("preload_booting_cluster_thread: creating kthread success\n");
-	}
-#endif
-	return 0;
-}
-
-/* scaling # of threads will be woken up, on-demand */
-void wakeup_smb_thread(void) {
-	int length = 0, io_index, filling_index;
-
-	spin_lock(&spinlock_smb);
-	io_index = page_buffer_next_io_index_smb;
-	filling_index = page_buffer_next_filling_index_smb;
-	spin_unlock(&spinlock_smb);
-	if (filling_index == MAX_PAGE_BUFFER_SIZE_SMB)
-		length = MAX_PAGE_BUFFER_SIZE_SMB;
-	else if (filling_index > io_index)
-		length = filling_index - io_index;
-	else if (filling_index < io_index)
-		length = (MAX_PAGE_BUFFER_SIZE_SMB - io_index) + filling_index;
-	else if (filling_index == io_index) 
-		length = 0;
-
-	if (length > 0 && smb_task[0] && !smb_task_status[0])
-		wake_up_process(smb_task[0]);
-#if (NR_CPUS > 1)
-	if (length >= SMB_THREAD_THRESHOLD_2 && smb_task[1] && !smb_task_status[1])
-		wake_up_process(smb_task[1]);
-#if (NR_CPUS > 2)
-	if (length >= SMB_THREAD_THRESHOLD_3 && smb_task[2] && !smb_task_status[2])
-		wake_up_process(smb_task[2]);
-#if (NR_CPUS > 3)
-	if (length >= SMB_THREAD_THRESHOLD_4 && smb_task[3] && !smb_task_status[3])
-		wake_up_process(smb_task[3]);
-#endif
-#endif
-#endif
-}
-
-int smb_thread(void *my_smb_task_status)
+static void scfs_read_work_fn(struct work_struct *work)
 {
-	int length = 0, io_index, filling_index;
-	struct page *page;
-	struct page *temp_page;
-	struct page *page_buffer[3] = {NULL, NULL, NULL};
-	struct file *file;
-	struct file *temp_file = NULL;
-	struct scfs_inode_info *sii;
-	int cluster_number = -1;
-	int page_buffer_count = 0;
+	struct scfs_read_work *rw = container_of(work, struct scfs_read_work, work);
 	int i;
 
-	set_freezable();
-
-	/* handle any queued-up read requests, or else go back to sleep */
-	while (!kthread_should_stop()) {
-		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock(&spinlock_smb);
-
-		/* calculate number of pages of page buffer */
-		io_index = page_buffer_next_io_index_smb;
-		filling_index = page_buffer_next_filling_index_smb;
-		if (filling_index == MAX_PAGE_BUFFER_SIZE_SMB) {
-			length = MAX_PAGE_BUFFER_SIZE_SMB;
-			page_buffer_next_filling_index_smb = page_buffer_next_io_index_smb;
-		}
-		else if (filling_index > io_index)
-			length = filling_index - io_index;
-		else if (filling_index < io_index)
-			length = (MAX_PAGE_BUFFER_SIZE_SMB - io_index) + filling_index;
-		else if (filling_index == io_index) 
-			length = 0;
-		page_buffer_count = 0;
-
-		/* the requested page, as well as subsequent pages in the same cluster, will be serviced,
-			in two separate readpage calls */
-		if (length > 0) {
-			__set_current_state(TASK_RUNNING);
-			page = page_buffer_smb[page_buffer_next_io_index_smb];
-			file = file_buffer_smb[page_buffer_next_io_index_smb];
-
-			page_buffer_next_io_index_smb++;
-			if (page_buffer_next_io_index_smb >= MAX_PAGE_BUFFER_SIZE_SMB)
-				page_buffer_next_io_index_smb = 0;
-
-			length--;
-			sii = SCFS_I(page->mapping->host);
-			cluster_number = PAGE_TO_CLUSTER_INDEX(page, sii);
-
-			while (length-- > 0) {
-				temp_page = page_buffer_smb[page_buffer_next_io_index_smb];
-				temp_file = file_buffer_smb[page_buffer_next_io_index_smb];
-
-				if ((temp_file == file) && (cluster_number == PAGE_TO_CLUSTER_INDEX(temp_page, sii))) {
-					page_buffer[page_buffer_count++] = temp_page;
-					page_buffer_next_io_index_smb++;
-					if (page_buffer_next_io_index_smb >= MAX_PAGE_BUFFER_SIZE_SMB)
-						page_buffer_next_io_index_smb = 0;
-				} else break;
-			}
-			spin_unlock(&spinlock_smb);
-
-			/* read first page */
-			scfs_readpage(file, page);
-			atomic_long_dec(&file->f_count);
-
-			/* read related pages with cluster of first page*/
-			for (i = 0; i < page_buffer_count; i++) {
-				scfs_readpage(file, page_buffer[i]);
-				atomic_long_dec(&file->f_count);
-			}
-		}
-		else {
-			*((int *)my_smb_task_status) = 0;
-			spin_unlock(&spinlock_smb);
-			schedule();
-			*((int *)my_smb_task_status) = 1;
-		}
+	/* the first page brings the cluster in, the rest hit the cluster cache */
+	for (i = 0; i < rw->nr_pages; i++) {
+		scfs_readpage(rw->file, rw->pages[i]);
+		page_cache_release(rw->pages[i]);
 	}
 
-	return 0;
+	fput(rw->file);
+	kfree(rw);
 }
 
 /**
@@ -585,8 +533,11 @@ int smb_thread(void *my_smb_task_status)
  * SCFS_SUCCESS if success, otherwise if error
  *
  * Description:
- * - Asynchronously read pages for readahead. A scaling number of background threads
- *   will read & decompress them in a slightly deferred but parallelized manner.
+ * - Asynchronously read pages for readahead. The lower file is read ahead over
+ *   the whole range first, so that the lower I/O goes out in one batch; then
+ *   each cluster is read & decompressed by its own work item on scfs_read_wq,
+ *   so that clusters are decompressed in parallel on all CPUs.
+ * - Pages before the readahead mark are waited for, and are read right away.
  */
 static int
 scfs_readpages(struct file *file, struct address_space *mapping,
@@ -596,8 +547,8 @@ scfs_readpages(struct file *file, struct address_space *mapping,
 	int page_idx, page_idx_readahead = 1024, ret = 0;
 	struct page *page;
 	struct file *lower_file = NULL;
+	struct scfs_read_work *rw = NULL;
 	loff_t i_size;
-	int readahead_page = 0;
 
 	i_size = i_size_read(&sii->vfs_inode);
 	if (!i_size) {
@@ -710,40 +661,77 @@ scfs_readpages(struct file *file, struct address_space *mapping,
 			continue;
 		}
 
-		/* memory buffer is full or synchronous read request - call scfs_readpage to read now */
-		if (page_buffer_next_filling_index_smb ==
-				MAX_PAGE_BUFFER_SIZE_SMB || page_idx < page_idx_readahead) {
+		/* synchronous read request - call scfs_readpage to read now */
+		if (page_idx < page_idx_readahead) {
 			scfs_readpage(file, page);
-		} else {
-			spin_lock(&spinlock_smb);
-
-			/* queue is not full so add the page into the queue. also, here we increase 
-				file->f_count to protect the file structs from multi-threaded accesses */
-			atomic_long_inc(&file->f_count);
-			page_buffer_smb[page_buffer_next_filling_index_smb] = page;
-			file_buffer_smb[page_buffer_next_filling_index_smb++] = file;
-
-			/* check whether page buffer is full and set page buffer full if needed */
-			if (((page_buffer_next_filling_index_smb == MAX_PAGE_BUFFER_SIZE_SMB) &&
-				page_buffer_next_io_index_smb == 0) ||
-				(page_buffer_next_filling_index_smb == page_buffer_next_io_index_smb))
-				page_buffer_next_filling_index_smb = MAX_PAGE_BUFFER_SIZE_SMB;
-			else if (page_buffer_next_filling_index_smb == MAX_PAGE_BUFFER_SIZE_SMB)
-				page_buffer_next_filling_index_smb = 0;
-			spin_unlock(&spinlock_smb);
-			++readahead_page;
+			page_cache_release(page);
+			continue;
 		}
 
-		page_cache_release(page);
+		/* readahead pages are handed out to scfs_read_wq one cluster each,
+			the page reference is dropped by the work item */
+		if (rw && (rw->cluster_idx != PAGE_TO_CLUSTER_INDEX(page, sii) ||
+				rw->nr_pages == ARRAY_SIZE(rw->pages))) {
+			queue_work(scfs_read_wq, &rw->work);
+			rw = NULL;
+		}
+
+		if (!rw) {
+			rw = kmalloc(sizeof(*rw), GFP_KERNEL);
+			if (!rw) {
+				scfs_readpage(file, page);
+				page_cache_release(page);
+				continue;
+			}
+			INIT_WORK(&rw->work, scfs_read_work_fn);
+			get_file(file);
+			rw->file = file;
+			rw->cluster_idx = PAGE_TO_CLUSTER_INDEX(page, sii);
+			rw->nr_pages = 0;
+		}
+		rw->pages[rw->nr_pages++] = page;
 	}
 
-	if (readahead_page > 0) wakeup_smb_thread();
+	if (rw)
+		queue_work(scfs_read_wq, &rw->work);
 	SCFS_PRINT("<e>\n");
 
 	return 0;
 }
 #endif
 
+int scfs_read_init(void)
+{
+#ifdef SCFS_ASYNC_READ_PAGES
+	/* one cluster per work item, as many in flight as there are CPUs */
+	scfs_read_wq = alloc_workqueue("scfs_read", WQ_UNBOUND,
+		num_possible_cpus());
+	if (!scfs_read_wq) {
+		SCFS_PRINT_ERROR("scfs_read_init: creating workqueue failed\n");
+		return -ENOMEM;
+	}
+
+#ifdef SCFS_PRELOAD_BOOTING_CLUSTER
+	scfs_pbc = kthread_run(preload_booting_cluster_thread, NULL, "scfs_pbc");
+	if (IS_ERR(scfs_pbc)) {
+		SCFS_PRINT_ERROR("preload_booting_cluster_thread: creating kthread failed\n");
+	} else {
+		SCFS_PRINT_ERROR("preload_booting_cluster_thread: creating kthread success\n");
+	}
+#endif
+#endif
+	register_shrinker(&scfs_cluster_cache_shrinker);
+	return 0;
+}
+
+void scfs_read_exit(void)
+{
+	unregister_shrinker(&scfs_cluster_cache_shrinker);
+#ifdef SCFS_ASYNC_READ_PAGES
+	destroy_workqueue(scfs_read_wq);
+#endif
+}
+
 /**
  * scfs_write_begin
  * @file: The scfs file
@@ -797,6 +785,10 @@ static int scfs_write_begin(struct file *file, struct address_space *mapping,
 		goto out;
 	}	
 
+	/* appending to a partial last cluster changes its cached contents */
+	if (pos & (sii->cluster_size - 1))
+		scfs_invalidate_cluster_cache(sii);
+
 	if (IS_COMPRESSABLE(sii)) {
 		struct cinfo_entry *info_entry;
 		ret = scfs_get_comp_buffer(sii);
@@ -1018,10 +1010,7 @@ static int scfs_write_end(struct file *file, struct address_space *mapping,
 					"for cluster idx %d\n", PAGE_TO_CLUSTER_INDEX(page,sii));
 				ASSERT(0);
 			}
-			ret = scfs_compress(sii->comp_type, sii->cluster_buffer.c_buffer,
-				sii->cluster_buffer.u_buffer,
-				sii->cluster_buffer.original_size,
-				&info_entry->cinfo.size);
+			ret = scfs_compress_cluster(sii, &info_entry->cinfo.size);
 			if (ret) {
 				mutex_unlock(&sii->cinfo_list_mutex);
 				ClearPageUptodate(page);
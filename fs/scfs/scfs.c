@@ -65,9 +65,14 @@ const char *tfm_names[TOTAL_TYPES] =
 	"lzo",		/* lzo */
 	"deflate", 	/* bzip2 */
 	"zlib",		/* zlib */ 
-	"fastlzo"	/* lzo */
+	"fastlzo",	/* lzo */
+	"lz4"		/* lz4 */
 };
 
+/* comp_type=auto candidates, fastest to decompress first */
+static const enum comp_type auto_comp_types[] = { LZ4, LZO, ZLIB };
+static int comp_available[TOTAL_TYPES];	/* 0 unknown, 1 yes, -1 no */
+
 void scfs_printk(const char *fmt, ...)
 {
 	va_list args;
@@ -278,6 +283,10 @@ int scfs_parse_options(struct scfs_sb_info *sbi, char *options)
 			type = args[0].from;
 			if (!strcmp(type, "lzo"))
 				sbi->options.comp_type = LZO;
+			else if (!strcmp(type, "auto"))
+				sbi->options.flags |= SCFS_MOUNT_COMP_AUTO;
+			else if (!strcmp(type, "lz4") && crypto_has_comp("lz4", 0, 0))
+				sbi->options.comp_type = LZ4;
 /* disable bzip for now, crypto_alloc_comp doesn't work for some reason */
 #if 0 //#ifdef CONFIG_CRYPTO_DEFLATE
 			else if (!strcmp(type, "bzip2"))
@@ -597,6 +606,7 @@ int scfs_decompress(enum comp_type algo, char *buf_c, char *buf_u, int len,
 			ret, len, *actual);
 			ret = -EIO;
 		}
+		tmp_len = *actual;
 	}
 	*actual = tmp_len;	
 	return ret;
@@ -668,11 +678,102 @@ int scfs_compress(enum comp_type algo, char *buf_c, char *buf_u, int len,
 			ret, len, *actual);
 			ret = -EIO;
 		}
+		tmp_len = *actual;
 	}
 	*actual = tmp_len;
 	return ret;
 }
 
+static int scfs_comp_available(enum comp_type algo)
+{
+	if (algo == LZO)
+		return 1;
+	if (!comp_available[algo])
+		comp_available[algo] =
+			crypto_has_comp(tfm_names[algo], 0, 0) ? 1 : -1;
+	return comp_available[algo] > 0;
+}
+
+/*
+ * scfs_compress_cluster
+ *
+ * Parameters:
+ * @sii: inode whose cluster_buffer holds the cluster to be compressed
+ * @*actual: OUT - compressed size
+ *
+ * Return:
+ * SCFS_SUCCESS if success, otherwise if error
+ *
+ * Description:
+ * Compress the pending cluster of a file into cluster_buffer.c_buffer.
+ * - Until a cluster of the file is written compressed, its clusters are
+ *   samples. With comp_type=auto, a sample is compressed with every
+ *   available algorithm and the file takes the fastest one to decompress,
+ *   unless a slower one saves SCFS_COMP_AUTO_GAIN percent more of the
+ *   cluster. The choice is final once a cluster is written compressed.
+ * - If SCFS_COMP_SAMPLE_CLUSTERS samples all miss comp_threshold, the file
+ *   is flagged SCFS_DATA_BYPASS and later clusters skip the compressor;
+ *   *actual is then the original size, so the caller writes them raw.
+ */
+int scfs_compress_cluster(struct scfs_inode_info *sii, int *actual)
+{
+	struct scfs_sb_info *sbi = SCFS_S(sii->vfs_inode.i_sb);
+	struct scfs_cluster_buffer *cb = &sii->cluster_buffer;
+	/* c_buffer is twice SCFS_MEMPOOL_SIZE, see scfs_get_comp_buffer */
+	int len = cb->original_size, room = SCFS_MEMPOOL_SIZE << 1;
+	enum comp_type algo, best = TOTAL_TYPES, last = TOTAL_TYPES;
+	int size, best_size = 0, ret = 0, i;
+
+	if (sii->flags & SCFS_DATA_BYPASS) {
+		*actual = len;
+		return 0;
+	}
+
+	if (sii->compressed || !(sbi->options.flags & SCFS_MOUNT_COMP_AUTO)) {
+		*actual = room;
+		ret = scfs_compress(sii->comp_type, cb->c_buffer, cb->u_buffer,
+			len, actual);
+		goto sampled;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(auto_comp_types); i++) {
+		algo = auto_comp_types[i];
+		if (!scfs_comp_available(algo))
+			continue;
+		size = room;
+		if (scfs_compress(algo, cb->c_buffer, cb->u_buffer, len, &size))
+			continue;
+		last = algo;
+		if (best == TOTAL_TYPES ||
+				best_size - size > len * SCFS_COMP_AUTO_GAIN / 100) {
+			best = algo;
+			best_size = size;
+		}
+	}
+	if (best == TOTAL_TYPES)
+		return -EIO;
+
+	sii->comp_type = best;
+	*actual = best_size;
+	if (last != best) {
+		*actual = room;
+		ret = scfs_compress(best, cb->c_buffer, cb->u_buffer, len, actual);
+	}
+
+sampled:
+	if (ret || sii->compressed ||
+			*actual < len * sbi->options.comp_threshold / 100)
+		return ret;
+
+	if (++sii->comp_sampled >= SCFS_COMP_SAMPLE_CLUSTERS) {
+		SCFS_PRINT("f:%s incompressible, bypassing compression\n",
+			sii->lower_file ?
+			sii->lower_file->f_path.dentry->d_name.name : "?");
+		sii->flags |= SCFS_DATA_BYPASS;
+	}
+	return 0;
+}
+
 struct page *scfs_alloc_mempool_buffer(struct scfs_sb_info *sbi)
 {
 	struct page *ret = mempool_alloc(sbi->mempool, 
@@ -830,10 +931,7 @@ int scfs_write_meta(struct scfs_inode_info *sii)
 	/* if last cluster exists, we should write it first. */
 	if (IS_COMPRESSABLE(sii)) {
 	 	if (sii->cluster_buffer.original_size > 0) {
-			ret = scfs_compress(sii->comp_type, sii->cluster_buffer.c_buffer
-				,sii->cluster_buffer.u_buffer
-				,sii->cluster_buffer.original_size
-				,&last->cinfo.size);
+			ret = scfs_compress_cluster(sii, &last->cinfo.size);
 			if (ret) {
 				SCFS_PRINT_ERROR("f:%s Compression failed." \
 					"So, write uncompress data.\n",
@@ -1094,6 +1192,7 @@ int scfs_truncate(struct dentry *dentry, loff_t size)
 
 	SCFS_PRINT("Truncate %s size to %lld\n", dentry->d_name.name, size);
 	truncate_setsize(inode, ia.ia_size);
+	scfs_invalidate_cluster_cache(sii);
 	mutex_lock(&sii->cinfo_list_mutex);
 
 	list_for_each_safe(cluster_info, tmp, &sii->cinfo_list) {
@@ -1127,6 +1226,9 @@ int scfs_truncate(struct dentry *dentry, loff_t size)
 	sii->cinfo_array_size = 0;
 	sii->upper_file_size = 0;
 	sii->cluster_buffer.original_size = 0;
+	sii->compressed = 0;
+	sii->comp_sampled = 0;
+	sii->flags &= ~SCFS_DATA_BYPASS;
 	clear_meta_invalid(sii);
 
 	return ret;
@@ -107,8 +107,13 @@ extern struct kmem_cache *scfs_xattr_cache;
 #define SCFS_CINFO_OVER_PAGESIZE	0x00000008
 
 #define SCFS_INVALID_META	0x00000010
+#define SCFS_DATA_BYPASS	0x00000020	/* incompressible, skip compressor */
 /* mount option flags */
 #define SCFS_MOUNT_XATTR_META 	0x00000001
+#define SCFS_MOUNT_COMP_AUTO	0x00000004	/* per-file algorithm choice */
+/* write-time sampling, see scfs_compress_cluster */
+#define SCFS_COMP_SAMPLE_CLUSTERS	4
+#define SCFS_COMP_AUTO_GAIN	10	/* % of cluster a slower algo must save */
 /* mempool for cluster buffers */
 /* i.e. flagship (16KB clusters): 32KB x 32, low-end (8KB): 16KB x 32 */
 #define SCFS_MEMPOOL_COUNT	32
@@ -119,7 +124,7 @@ extern struct kmem_cache *scfs_xattr_cache;
 #define SCFS_IO_MAX_RETRY	10
 #define IS_POW2(n)		(n != 0 && ((n & (n - 1)) == 0))
 /* read performance tuning stuff */
-#define MAX_BUFFER_CACHE	SCFS_MEMPOOL_COUNT / 2
+#define SCFS_CLUSTER_CACHE_MAX	64	/* decompressed clusters, all inodes */
 #define SCFS_ASYNC_READ_PAGES
 #define SCFS_READ_PAGES_PROFILE
 //#define SCFS_NOTIFY_RANDOM_READ
@@ -135,14 +140,6 @@ enum scfs_mode {
 };
 
 #ifdef SCFS_ASYNC_READ_PAGES
-/* max buffer size (in page) */
-#define MAX_PAGE_BUFFER_SIZE_SMB	2048
-
-/* read helper thread wakeup threshold : 2 ~ 4 smb_thread each in order */
-#define SMB_THREAD_THRESHOLD_2	MAX_PAGE_BUFFER_SIZE_SMB / 64	// 32 pages
-#define SMB_THREAD_THRESHOLD_3	MAX_PAGE_BUFFER_SIZE_SMB / 32	// 64 pages
-#define SMB_THREAD_THRESHOLD_4	MAX_PAGE_BUFFER_SIZE_SMB / 16 	// 128 pages
-
 extern u64 scfs_readpage_total_count;
 extern u64 scfs_readpage_io_count;
 extern u64 scfs_lowerpage_total_count;
@@ -150,10 +147,6 @@ extern u64 scfs_lowerpage_reclaim_count;
 extern u64 scfs_lowerpage_alloc_count;
 extern u64 scfs_op_mode;
 extern u64 scfs_sequential_page_number;
-extern struct task_struct *smb_task[NR_CPUS];
-
-int smb_init(void);
-int smb_thread(void *nothing);
 #endif
  
 #if SCFS_PROFILE_MEM
@@ -178,6 +171,7 @@ enum comp_type {
     BZIP2,
     ZLIB,
     FASTLZO,
+    LZ4,
     TOTAL_TYPES,
 };
 
@@ -274,6 +268,9 @@ struct scfs_inode_info
  	struct scfs_cluster_buffer cluster_buffer;
  	struct list_head cinfo_list;
 	unsigned char compressed;
+	unsigned char comp_sampled;
+	struct list_head cluster_cache;
+	unsigned int cluster_cache_gen;
  	struct inode vfs_inode;
 	/* DO NOT ADD FIELDS BELOW vfs_inode */
 };
@@ -302,13 +299,19 @@ struct scfs_open_req {
 	struct list_head kthread_ctl_list;
 };
 
-struct read_buffer_cache {
-	struct page *u_page;
-	struct page *c_page;
-	int inode_number;
-	int cluster_number;
-	int is_compressed;
-	atomic_t is_used;
+/*
+ * A decompressed (or raw) cluster kept for later readpage calls. Lives on
+ * its inode's cluster_cache list and on the global LRU, both protected by
+ * the cluster cache lock in mmap.c. An entry unlinked while it has users
+ * is freed by the last one of them.
+ */
+struct scfs_cached_cluster {
+	struct list_head inode_list;
+	struct list_head lru;
+	unsigned int cluster_idx;
+	unsigned int gen;
+	int users;
+	struct page *page;
 };
 
 /**************************/
@@ -528,6 +531,9 @@ scfs_decompress(enum comp_type algo, char *buf_c, char *buf_u, int len, int *act
 int
 scfs_compress(enum comp_type algo, char *buf_c, char *buf_u, int len, int *actual);
 
+int
+scfs_compress_cluster(struct scfs_inode_info *sii, int *actual);
+
 struct page *scfs_alloc_mempool_buffer(struct scfs_sb_info *sbi);
 
 void scfs_free_mempool_buffer(struct page *p, struct scfs_sb_info *sbi);
@@ -593,4 +599,8 @@ ssize_t scfs_lower_write(struct file *file, char *buf, size_t count, loff_t *pos
 void *scfs_cinfo_alloc(struct scfs_inode_info *sii, unsigned long size);
 void scfs_cinfo_free(struct scfs_inode_info *sii, const void *addr);
 
+int scfs_read_init(void);
+void scfs_read_exit(void);
+void scfs_invalidate_cluster_cache(struct scfs_inode_info *sii);
+
 #endif //SCFS_HEADER_H
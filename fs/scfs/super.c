@@ -40,11 +40,6 @@
 
 #define SCFS_VERSION "1.2"
 
-#if MAX_BUFFER_CACHE
-extern struct read_buffer_cache buffer_cache[];
-extern spinlock_t buffer_cache_lock;
-#endif
-
 static struct kobject *scfs_kobj;
 static const char * scfs_version = SCFS_VERSION;
 
@@ -125,6 +120,7 @@ static struct inode *scfs_alloc_inode(struct super_block *sb)
 	mutex_init(&sii->lower_file_mutex);
 	mutex_init(&sii->cinfo_list_mutex);
 	INIT_LIST_HEAD(&sii->cinfo_list);
+	INIT_LIST_HEAD(&sii->cluster_cache);
 	return &sii->vfs_inode;
 }
 
@@ -163,6 +159,7 @@ static void scfs_evict_inode(struct inode *inode)
 #else
 	end_writeback(inode);
 #endif
+	scfs_invalidate_cluster_cache(sii);
 	/* to conserve memory, evicted inode will throw out the cluster info */
 	if (sii->cinfo_array) {
 		scfs_cinfo_free(sii, sii->cinfo_array);
@@ -202,6 +199,11 @@ static int scfs_show_options(struct seq_file *m, struct dentry *root)
 	if (opts->comp_threshold)
 		seq_printf(m, ",comp_threshold=%u", opts->comp_threshold);
 
+	if (opts->flags & SCFS_MOUNT_COMP_AUTO) {
+		seq_printf(m, ",comp_type=auto");
+		return 0;
+	}
+
 	switch (opts->comp_type) {
 	case LZO:
 		seq_printf(m, ",comp_type=lzo");
@@ -215,6 +217,9 @@ static int scfs_show_options(struct seq_file *m, struct dentry *root)
 	case FASTLZO:
 		seq_printf(m, ",comp_type=fastlzo");
 		break;
+	case LZ4:
+		seq_printf(m, ",comp_type=lz4");
+		break;
 	default:
 		break;
 	}
@@ -230,7 +235,7 @@ static struct dentry *scfs_mount(struct file_system_type *fs_type, int flags,
 	struct scfs_dentry_info *root_info;
 	struct inode *inode;
 	struct path path;
-	int ret, i;
+	int ret;
 
 	sbi = kzalloc(sizeof(struct scfs_sb_info), GFP_KERNEL);
 	if (!sbi) {
@@ -315,25 +320,6 @@ static struct dentry *scfs_mount(struct file_system_type *fs_type, int flags,
 		goto out_pathput;
 	}
 
-#if MAX_BUFFER_CACHE
-	/* initialize read buffers */	
-	for (i = 0; i < MAX_BUFFER_CACHE; i++) {
-		buffer_cache[i].u_page = scfs_alloc_mempool_buffer(sbi);
-		buffer_cache[i].c_page = scfs_alloc_mempool_buffer(sbi);
-		if (buffer_cache[i].u_page == NULL ||
-				buffer_cache[i].c_page == NULL) {
-			SCFS_PRINT_ERROR("mempool alloc failed!\n");
-			ret = -ENOMEM;
-			goto out_pathput;
-		}
-		buffer_cache[i].inode_number = -1;
-		buffer_cache[i].cluster_number = -1;
-		buffer_cache[i].is_compressed = -1;
-		atomic_set(&buffer_cache[i].is_used, -1);
-	}
-	spin_lock_init(&buffer_cache_lock);
-#endif
-
 #ifdef SCFS_PRELOAD_BOOTING_CLUSTER
 	if (!IS_ERR(scfs_pbc))
 		wake_up_process(scfs_pbc);
@@ -644,13 +630,11 @@ static int __init scfs_init(void)
 		goto out_destroy_kthread;
 	}
 
-#ifdef SCFS_ASYNC_READ_PAGES
-	ret = smb_init();
+	ret = scfs_read_init();
 	if (ret) {
-		SCFS_PRINT_ERROR("failed to init scfs memory buffering\n");
+		SCFS_PRINT_ERROR("failed to init scfs read path\n");
 		goto out_destroy_kthread;
 	}
-#endif
 
 	ret = scfs_debugfs_init();
 	if (ret) {
@@ -672,6 +656,7 @@ out:
 
 static void __exit scfs_exit(void)
 {
+	scfs_read_exit();
 	scfs_destroy_kthread();
 	do_sysfs_unregistration();
 	unregister_filesystem(&scfs_fs_type);
@@ -20,6 +20,9 @@
 
 #include "sdcardfs.h"
 
+/* source of derived_seq values, unique across all inodes */
+static atomic_t derived_seq_counter = ATOMIC_INIT(0);
+
 /* copy derived state from parent inode */
 static void inherit_derived_state(struct inode *parent, struct inode *child)
 {
@@ -44,6 +47,36 @@ void setup_derived_state(struct inode *inode, perm_t perm,
 	info->d_uid = uid;
 	info->d_gid = gid;
 	info->d_mode = mode;
+	info->derived_seq = atomic_inc_return(&derived_seq_counter);
+}
+
+/*
+ * The derived state of a node only depends on its name, the derived state
+ * of its parent and the package list, so it can be reused as long as none
+ * of them changed since it was computed. This lets a lookup that finds a
+ * cached inode, or derives twice on the way in, skip the get_appid() calls.
+ */
+static int derived_state_valid(struct sdcardfs_sb_info *sbi,
+				struct inode *parent, struct dentry *dentry)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dentry->d_inode);
+
+	return info->derived_parent == parent &&
+		info->derived_parent_seq == SDCARDFS_I(parent)->derived_seq &&
+		info->derived_name_hash == dentry->d_name.hash &&
+		info->derived_pkgl_gen == packagelist_generation(sbi->pkgl_id);
+}
+
+static void mark_derived_state(struct sdcardfs_sb_info *sbi,
+				struct inode *parent, struct dentry *dentry)
+{
+	struct sdcardfs_inode_info *info = SDCARDFS_I(dentry->d_inode);
+
+	info->derived_seq = atomic_inc_return(&derived_seq_counter);
+	info->derived_parent = parent;
+	info->derived_parent_seq = SDCARDFS_I(parent)->derived_seq;
+	info->derived_name_hash = dentry->d_name.hash;
+	info->derived_pkgl_gen = packagelist_generation(sbi->pkgl_id);
 }
 
 void get_derived_permission(struct dentry *parent, struct dentry *dentry)
@@ -53,6 +86,9 @@ void get_derived_permission(struct dentry *parent, struct dentry *dentry)
 	struct sdcardfs_inode_info *parent_info= SDCARDFS_I(parent->d_inode);
 	appid_t appid;
 
+	if (derived_state_valid(sbi, parent->d_inode, dentry))
+		return;
+
 	/* By default, each inode inherits from its parent. 
 	 * the properties are maintained on its private fields
 	 * because the inode attributes will be modified with that of 
@@ -62,6 +98,7 @@ void get_derived_permission(struct dentry *parent, struct dentry *dentry)
 	 */
 
 	inherit_derived_state(parent->d_inode, dentry->d_inode);
+	mark_derived_state(sbi, parent->d_inode, dentry);
 	
 	//printk(KERN_INFO "sdcardfs: derived: %s, %s, %d\n", parent->d_name.name,
 	//				dentry->d_name.name, parent_info->perm);
@@ -82,6 +82,55 @@ static ssize_t sdcardfs_write(struct file *file, const char __user *buf,
 	return err;
 }
 
+static ssize_t sdcardfs_splice_read(struct file *file, loff_t *ppos,
+				struct pipe_inode_info *pipe, size_t len,
+				unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op || !lower_file->f_op->splice_read)
+		return -EINVAL;
+
+	err = lower_file->f_op->splice_read(lower_file, ppos, pipe, len, flags);
+	if (err >= 0)
+		fsstack_copy_attr_atime(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+
+	return err;
+}
+
+static ssize_t sdcardfs_splice_write(struct pipe_inode_info *pipe,
+				struct file *file, loff_t *ppos, size_t len,
+				unsigned int flags)
+{
+	ssize_t err;
+	struct file *lower_file;
+	struct dentry *dentry = file->f_path.dentry;
+
+	/* check disk space */
+	if (!check_min_free_space(dentry, len, 0)) {
+		printk(KERN_INFO "No minimum free space.\n");
+		return -ENOSPC;
+	}
+
+	lower_file = sdcardfs_lower_file(file);
+	if (!lower_file->f_op || !lower_file->f_op->splice_write)
+		return -EINVAL;
+
+	err = lower_file->f_op->splice_write(pipe, lower_file, ppos, len, flags);
+	if (err >= 0) {
+		fsstack_copy_inode_size(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+		fsstack_copy_attr_times(dentry->d_inode,
+					lower_file->f_path.dentry->d_inode);
+	}
+
+	return err;
+}
+
 static int sdcardfs_readdir(struct file *file, void *dirent, filldir_t filldir)
 {
 	int err = 0;
@@ -193,7 +242,11 @@ static int sdcardfs_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_ops = &sdcardfs_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
-	file->f_mapping->a_ops = &sdcardfs_aops; /* set our aops */
+	/*
+	 * file->f_mapping is the lower mapping (see sdcardfs_open), so the
+	 * vma is linked into the lower i_mmap and its aops must stay as
+	 * they are.
+	 */
 	if (!SDCARDFS_F(file)->lower_vm_ops) /* save for our ->fault */
 		SDCARDFS_F(file)->lower_vm_ops = saved_vm_ops;
 
@@ -253,6 +306,14 @@ static int sdcardfs_open(struct inode *inode, struct file *file)
 		}
 	} else {
 		sdcardfs_set_lower_file(file, lower_file);
+		/*
+		 * Pass the page cache through: the upper file uses the lower
+		 * inode's mapping, so readahead, fadvise, sync_file_range and
+		 * mmap all act on the pages the lower fs actually caches, and
+		 * nothing is ever cached on behalf of the upper inode.
+		 */
+		if (S_ISREG(inode->i_mode))
+			file->f_mapping = lower_file->f_mapping;
 	}
 
 	if (err)
@@ -340,6 +401,8 @@ const struct file_operations sdcardfs_main_fops = {
 	.release	= sdcardfs_file_release,
 	.fsync		= sdcardfs_fsync,
 	.fasync		= sdcardfs_fasync,
+	.splice_read	= sdcardfs_splice_read,
+	.splice_write	= sdcardfs_splice_write,
 };
 
 /* trimmed directory options */
@@ -230,6 +230,24 @@ static struct dentry *__sdcardfs_lookup(struct dentry *dentry,
 	lower_dir_dentry = lower_parent_path->dentry;
 	lower_dir_mnt = lower_parent_path->mnt;
 
+	this.name = name;
+	this.len = strlen(name);
+	this.hash = full_name_hash(this.name, this.len);
+
+	/*
+	 * A negative lower dentry left behind by an earlier lookup or unlink
+	 * already says the name does not exist; the path walk below would
+	 * just end up at it again, so reuse it directly.
+	 */
+	lower_dentry = d_lookup(lower_dir_dentry, &this);
+	if (lower_dentry) {
+		if (!lower_dentry->d_inode) {
+			err = -ENOENT;
+			goto setup_lower;
+		}
+		dput(lower_dentry);
+	}
+
 	/* Use vfs_path_lookup to check if the dentry exists or not */
 	if (sbi->options.lower_fs == LOWER_FS_EXT4) {
 		err = vfs_path_lookup(lower_dir_dentry, lower_dir_mnt, name,
@@ -281,9 +299,6 @@ static struct dentry *__sdcardfs_lookup(struct dentry *dentry,
 		goto out;
 
 	/* instatiate a new negative dentry */
-	this.name = name;
-	this.len = strlen(name);
-	this.hash = full_name_hash(this.name, this.len);
 	lower_dentry = d_lookup(lower_dir_dentry, &this);
 	if (lower_dentry)
 		goto setup_lower;
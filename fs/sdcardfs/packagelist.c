@@ -25,23 +25,39 @@
 #include <linux/kthread.h>
 #include <linux/inotify.h>
 #include <linux/delay.h>
+#include <linux/rcupdate.h>
 
 #define STRING_BUF_SIZE		(512)
+#define READ_BUF_SIZE		(PAGE_SIZE)
 
 struct hashtable_entry {
         struct hlist_node hlist;
         void *key;
 	int value;
+	struct rcu_head rcu;
 };
 
-struct packagelist_data {
+/*
+ * The tables are read locklessly under RCU on every lookup and access
+ * check. A reload parses packages.list into a private set of tables and
+ * then applies only the differences to the live ones (see
+ * apply_package_list), so readers never stall and never miss an entry
+ * that did not change.
+ */
+struct packagelist_tables {
 	DECLARE_HASHTABLE(package_to_appid,8);
 	DECLARE_HASHTABLE(appid_with_rw,7);
-	struct mutex hashtable_lock;
+};
+
+struct packagelist_data {
+	struct packagelist_tables __rcu *tables;
+	/* bumped whenever a package to appid mapping changes */
+	atomic_t generation;
+	struct mutex hashtable_lock;	/* serializes reloads */
 	struct task_struct *thread_id;
 	gid_t write_gid;
 	char *strtok_last;
-	char read_buf[STRING_BUF_SIZE];
+	char read_buf[READ_BUF_SIZE];
 	char event_buf[STRING_BUF_SIZE];
 	char app_name_buf[STRING_BUF_SIZE];
 	char gids_buf[STRING_BUF_SIZE];
@@ -66,11 +82,15 @@ static unsigned int str_hash(void *key) {
 	return h;
 }
 
+/* Must be called under rcu_read_lock() */
 static int contain_appid_key(struct packagelist_data *pkgl_dat, void *appid) {
+	struct packagelist_tables *tables = rcu_dereference(pkgl_dat->tables);
         struct hashtable_entry *hash_cur;
 	struct hlist_node *h_n;
 
-        hash_for_each_possible(pkgl_dat->appid_with_rw,	hash_cur, hlist, (unsigned int)appid, h_n)
+	if (!tables)
+		return 0;
+        hash_for_each_possible_rcu(tables->appid_with_rw, hash_cur, hlist, (unsigned int)appid, h_n)
                 if (appid == hash_cur->key)
                         return 1;
 	return 0;
@@ -88,36 +108,51 @@ int get_caller_has_rw_locked(void *pkgl_id, derive_t derive) {
 	}
 
 	appid = multiuser_get_app_id(current_fsuid());
-	mutex_lock(&pkgl_dat->hashtable_lock);
+	rcu_read_lock();
 	ret = contain_appid_key(pkgl_dat, (void *)appid);
-	mutex_unlock(&pkgl_dat->hashtable_lock);
+	rcu_read_unlock();
 	return ret;
 }
 
 appid_t get_appid(void *pkgl_id, const char *app_name)
 {
 	struct packagelist_data *pkgl_dat = (struct packagelist_data *)pkgl_id;
+	struct packagelist_tables *tables;
 	struct hashtable_entry *hash_cur;
 	struct hlist_node *h_n;
 	unsigned int hash = str_hash((void *)app_name);
 	appid_t ret_id;
 
 	//printk(KERN_INFO "sdcardfs: %s: %s, %u\n", __func__, (char *)app_name, hash);
-	mutex_lock(&pkgl_dat->hashtable_lock);
-	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, hlist, hash, h_n) {
+	rcu_read_lock();
+	tables = rcu_dereference(pkgl_dat->tables);
+	if (!tables)
+		goto out;
+	hash_for_each_possible_rcu(tables->package_to_appid, hash_cur, hlist, hash, h_n) {
 		//printk(KERN_INFO "sdcardfs: %s: %s\n", __func__, (char *)hash_cur->key);
 		if (!strcasecmp(app_name, hash_cur->key)) {
 			ret_id = (appid_t)hash_cur->value;
-			mutex_unlock(&pkgl_dat->hashtable_lock);
+			rcu_read_unlock();
 			//printk(KERN_INFO "=> app_id: %d\n", (int)ret_id);
 			return ret_id;
 		}
 	}
-	mutex_unlock(&pkgl_dat->hashtable_lock);
+out:
+	rcu_read_unlock();
 	//printk(KERN_INFO "=> app_id: %d\n", 0);
 	return 0;
 }
 
+/* Changes whenever a reload publishes new package tables. */
+unsigned int packagelist_generation(void *pkgl_id)
+{
+	struct packagelist_data *pkgl_dat = (struct packagelist_data *)pkgl_id;
+
+	if (!pkgl_dat)
+		return 0;
+	return atomic_read(&pkgl_dat->generation);
+}
+
 /* Kernel has already enforced everything we returned through
  * derive_permissions_locked(), so this is used to lock down access
  * even further, such as enforcing that apps hold sdcard_rw. */
@@ -171,25 +206,50 @@ int open_flags_to_access_mode(int open_flags) {
 	}
 }
 
-static int insert_str_to_int(struct packagelist_data *pkgl_dat, void *key, int value) {
+/* Writer side lookups, called with hashtable_lock held */
+static struct hashtable_entry *find_str_to_int(struct packagelist_tables *tables,
+						void *key) {
+	struct hashtable_entry *hash_cur;
+	struct hlist_node *h_n;
+
+	hash_for_each_possible(tables->package_to_appid, hash_cur, hlist, str_hash(key), h_n)
+		if (!strcasecmp(key, hash_cur->key))
+			return hash_cur;
+	return NULL;
+}
+
+static struct hashtable_entry *find_int_to_null(struct packagelist_tables *tables,
+						void *key) {
 	struct hashtable_entry *hash_cur;
-	struct hashtable_entry *new_entry;
 	struct hlist_node *h_n;
+
+	hash_for_each_possible(tables->appid_with_rw, hash_cur, hlist, (unsigned int)key, h_n)
+		if (key == hash_cur->key)
+			return hash_cur;
+	return NULL;
+}
+
+static int insert_str_to_int(struct packagelist_tables *tables, void *key, int value) {
+	struct hashtable_entry *hash_cur;
+	struct hashtable_entry *new_entry;
 	unsigned int hash = str_hash(key);
 
 	//printk(KERN_INFO "sdcardfs: %s: %s: %d, %u\n", __func__, (char *)key, value, hash);
-	hash_for_each_possible(pkgl_dat->package_to_appid, hash_cur, hlist, hash, h_n) {
-		if (!strcasecmp(key, hash_cur->key)) {
-			hash_cur->value = value;
-			return 0;
-		}
+	hash_cur = find_str_to_int(tables, key);
+	if (hash_cur) {
+		hash_cur->value = value;
+		return 0;
 	}
 	new_entry = kmem_cache_alloc(hashtable_entry_cachep, GFP_KERNEL);
 	if (!new_entry)
 		return -ENOMEM;
 	new_entry->key = kstrdup(key, GFP_KERNEL);
+	if (!new_entry->key) {
+		kmem_cache_free(hashtable_entry_cachep, new_entry);
+		return -ENOMEM;
+	}
 	new_entry->value = value;
-	hash_add(pkgl_dat->package_to_appid, &new_entry->hlist, hash);
+	hash_add(tables->package_to_appid, &new_entry->hlist, hash);
 	return 0;
 }
 
@@ -199,25 +259,22 @@ static void remove_str_to_int(struct hashtable_entry *h_entry) {
 	kmem_cache_free(hashtable_entry_cachep, h_entry);
 }
 
-static int insert_int_to_null(struct packagelist_data *pkgl_dat, void *key, int value) {
+static int insert_int_to_null(struct packagelist_tables *tables, void *key, int value) {
 	struct hashtable_entry *hash_cur;
 	struct hashtable_entry *new_entry;
-	struct hlist_node *h_n;
 
 	//printk(KERN_INFO "sdcardfs: %s: %d: %d\n", __func__, (int)key, value);
-	hash_for_each_possible(pkgl_dat->appid_with_rw,	hash_cur, hlist,
-					(unsigned int)key, h_n) {
-		if (key == hash_cur->key) {
-			hash_cur->value = value;
-			return 0;
-		}
+	hash_cur = find_int_to_null(tables, key);
+	if (hash_cur) {
+		hash_cur->value = value;
+		return 0;
 	}
 	new_entry = kmem_cache_alloc(hashtable_entry_cachep, GFP_KERNEL);
 	if (!new_entry)
 		return -ENOMEM;
 	new_entry->key = key;
 	new_entry->value = value;
-	hash_add(pkgl_dat->appid_with_rw, &new_entry->hlist,
+	hash_add(tables->appid_with_rw, &new_entry->hlist,
 			(unsigned int)new_entry->key);
 	return 0;
 }
@@ -227,89 +284,206 @@ static void remove_int_to_null(struct hashtable_entry *h_entry) {
 	kmem_cache_free(hashtable_entry_cachep, h_entry);
 }
 
-static void remove_all_hashentrys(struct packagelist_data *pkgl_dat)
+static void remove_str_to_int_rcu(struct rcu_head *head) {
+	remove_str_to_int(container_of(head, struct hashtable_entry, rcu));
+}
+
+static void remove_int_to_null_rcu(struct rcu_head *head) {
+	remove_int_to_null(container_of(head, struct hashtable_entry, rcu));
+}
+
+static void remove_all_hashentrys(struct packagelist_tables *tables)
 {
 	struct hashtable_entry *hash_cur;
 	struct hlist_node *h_n;
 	struct hlist_node *h_t;
 	int i;
 
-	hash_for_each_safe(pkgl_dat->package_to_appid, i, h_t, hash_cur, hlist, h_n)
+	hash_for_each_safe(tables->package_to_appid, i, h_t, hash_cur, hlist, h_n)
 		remove_str_to_int(hash_cur);
-	hash_for_each_safe(pkgl_dat->appid_with_rw, i, h_t, hash_cur, hlist, h_n)
+	hash_for_each_safe(tables->appid_with_rw, i, h_t, hash_cur, hlist, h_n)
                 remove_int_to_null(hash_cur);
 
-	hash_init(pkgl_dat->package_to_appid);
-	hash_init(pkgl_dat->appid_with_rw);
+	hash_init(tables->package_to_appid);
+	hash_init(tables->appid_with_rw);
 }
 
-static int read_package_list(struct packagelist_data *pkgl_dat) {
+static struct packagelist_tables *alloc_tables(void)
+{
+	struct packagelist_tables *tables;
+
+	tables = kmalloc(sizeof(*tables), GFP_KERNEL);
+	if (!tables)
+		return NULL;
+	hash_init(tables->package_to_appid);
+	hash_init(tables->appid_with_rw);
+	return tables;
+}
+
+static void free_tables(struct packagelist_tables *tables)
+{
+	remove_all_hashentrys(tables);
+	kfree(tables);
+}
+
+/*
+ * Bring the live tables in line with the freshly parsed @new, entry by
+ * entry. Unchanged entries are left alone; new or changed ones are moved
+ * over from @new (a changed one is added before the old one is
+ * unlinked), and vanished ones are freed after a grace period. Returns
+ * true if any package to appid mapping changed.
+ */
+static bool apply_package_list(struct packagelist_tables *live,
+				struct packagelist_tables *new)
+{
+	struct hashtable_entry *hash_cur, *hash_new;
+	struct hlist_node *h_n, *h_t;
+	bool changed = false;
+	int i;
+
+	hash_for_each_safe(live->package_to_appid, i, h_t, hash_cur, hlist, h_n) {
+		if (!find_str_to_int(new, hash_cur->key)) {
+			hash_del_rcu(&hash_cur->hlist);
+			call_rcu(&hash_cur->rcu, remove_str_to_int_rcu);
+			changed = true;
+		}
+	}
+	hash_for_each_safe(new->package_to_appid, i, h_t, hash_new, hlist, h_n) {
+		hash_cur = find_str_to_int(live, hash_new->key);
+		if (hash_cur && hash_cur->value == hash_new->value)
+			continue;
+		hash_del(&hash_new->hlist);
+		hash_add_rcu(live->package_to_appid, &hash_new->hlist,
+				str_hash(hash_new->key));
+		if (hash_cur) {
+			hash_del_rcu(&hash_cur->hlist);
+			call_rcu(&hash_cur->rcu, remove_str_to_int_rcu);
+		}
+		changed = true;
+	}
+
+	hash_for_each_safe(live->appid_with_rw, i, h_t, hash_cur, hlist, h_n) {
+		if (!find_int_to_null(new, hash_cur->key)) {
+			hash_del_rcu(&hash_cur->hlist);
+			call_rcu(&hash_cur->rcu, remove_int_to_null_rcu);
+		}
+	}
+	hash_for_each_safe(new->appid_with_rw, i, h_t, hash_new, hlist, h_n) {
+		if (find_int_to_null(live, hash_new->key))
+			continue;
+		hash_del(&hash_new->hlist);
+		hash_add_rcu(live->appid_with_rw, &hash_new->hlist,
+				(unsigned int)hash_new->key);
+	}
+
+	return changed;
+}
+
+static int parse_package_line(struct packagelist_data *pkgl_dat,
+				struct packagelist_tables *tables, char *line)
+{
+	int appid;
+	char *token;
+	unsigned long ret_gid;
 	int ret;
+
+	if (sscanf(line, "%s %d %*d %*s %*s %s",
+			pkgl_dat->app_name_buf, &appid,
+			pkgl_dat->gids_buf) != 3)
+		return 0;
+
+	ret = insert_str_to_int(tables, pkgl_dat->app_name_buf, appid);
+	if (ret)
+		return ret;
+
+	token = strtok_r(pkgl_dat->gids_buf, ",", &pkgl_dat->strtok_last);
+	while (token != NULL) {
+		if (!kstrtoul(token, 10, &ret_gid) &&
+				(ret_gid == pkgl_dat->write_gid))
+			return insert_int_to_null(tables, (void *)appid, 1);
+		token = strtok_r(NULL, ",", &pkgl_dat->strtok_last);
+	}
+	return 0;
+}
+
+static int read_package_list(struct packagelist_data *pkgl_dat) {
+	struct packagelist_tables *tables, *live;
+	char *buf = pkgl_dat->read_buf;
+	char *line, *eol;
+	int ret = 0;
 	int fd;
 	int read_amount;
+	int len = 0;
+	bool skip = false;
 
 	printk(KERN_INFO "sdcardfs: read_package_list\n");
 
-	mutex_lock(&pkgl_dat->hashtable_lock);
+	tables = alloc_tables();
+	if (!tables)
+		return -ENOMEM;
 
-	remove_all_hashentrys(pkgl_dat);
+	mutex_lock(&pkgl_dat->hashtable_lock);
 
 	fd = sys_open(kpackageslist_file, O_RDONLY, 0);
 	if (fd < 0) {
 		printk(KERN_ERR "sdcardfs: failed to open package list\n");
-		mutex_unlock(&pkgl_dat->hashtable_lock);
-		return fd;
+		ret = fd;
+		goto out_unlock;
 	}
 
-	while ((read_amount = sys_read(fd, pkgl_dat->read_buf,
-					sizeof(pkgl_dat->read_buf))) > 0) {
-		int appid;
-		char *token;
-		int one_line_len = 0;
-		int additional_read;
-		unsigned long ret_gid;
-	
-		while (one_line_len < read_amount) {
-			if (pkgl_dat->read_buf[one_line_len] == '\n') {
-				one_line_len++;
-				break;
+	/* parse whole lines out of page sized reads */
+	while ((read_amount = sys_read(fd, buf + len,
+					READ_BUF_SIZE - 1 - len)) > 0) {
+		len += read_amount;
+		buf[len] = '\0';
+
+		line = buf;
+		while ((eol = strchr(line, '\n')) != NULL) {
+			*eol = '\0';
+			if (!skip && eol - line < STRING_BUF_SIZE) {
+				ret = parse_package_line(pkgl_dat, tables, line);
+				if (ret)
+					goto out_close;
 			}
-			one_line_len++;
+			skip = false;
+			line = eol + 1;
 		}
-		additional_read = read_amount - one_line_len;
-		if (additional_read > 0)
-			sys_lseek(fd, -additional_read, SEEK_CUR);	
-
-		if (sscanf(pkgl_dat->read_buf, "%s %d %*d %*s %*s %s",
-				pkgl_dat->app_name_buf, &appid,
-				pkgl_dat->gids_buf) == 3) {
-			ret = insert_str_to_int(pkgl_dat, pkgl_dat->app_name_buf, appid);
-			if (ret) {
-				sys_close(fd);
-				mutex_unlock(&pkgl_dat->hashtable_lock);
-				return ret;
-			}
 
-			token = strtok_r(pkgl_dat->gids_buf, ",", &pkgl_dat->strtok_last);
-			while (token != NULL) {
-				if (!kstrtoul(token, 10, &ret_gid) &&
-						(ret_gid == pkgl_dat->write_gid)) {
-					ret = insert_int_to_null(pkgl_dat, (void *)appid, 1);
-					if (ret) {
-						sys_close(fd);
-						mutex_unlock(&pkgl_dat->hashtable_lock);
-						return ret;
-					}
-					break;
-				}
-				token = strtok_r(NULL, ",", &pkgl_dat->strtok_last);
-			}
+		len -= line - buf;
+		memmove(buf, line, len);
+		if (len >= STRING_BUF_SIZE) {
+			/* no valid line is that long, drop the rest of it */
+			skip = true;
+			len = 0;
 		}
 	}
+	if (len && !skip) {
+		buf[len] = '\0';
+		ret = parse_package_line(pkgl_dat, tables, buf);
+		if (ret)
+			goto out_close;
+	}
 
+	live = rcu_dereference_protected(pkgl_dat->tables,
+			lockdep_is_held(&pkgl_dat->hashtable_lock));
+	if (!live) {
+		rcu_assign_pointer(pkgl_dat->tables, tables);
+		tables = NULL;
+		atomic_inc(&pkgl_dat->generation);
+	} else if (apply_package_list(live, tables)) {
+		/* order the table updates before the new generation */
+		smp_wmb();
+		atomic_inc(&pkgl_dat->generation);
+	}
+
+out_close:
 	sys_close(fd);
+out_unlock:
 	mutex_unlock(&pkgl_dat->hashtable_lock);
-	return 0;
+	/* leftovers of the private tables; on failure the live ones stay */
+	if (tables)
+		free_tables(tables);
+	return ret;
 }
 
 static int packagelist_reader(void *thread_data)
@@ -406,8 +580,7 @@ void * packagelist_create(gid_t write_gid)
 	}
 
 	mutex_init(&pkgl_dat->hashtable_lock);
-	hash_init(pkgl_dat->package_to_appid);
-	hash_init(pkgl_dat->appid_with_rw);
+	atomic_set(&pkgl_dat->generation, 1);
 	pkgl_dat->write_gid = write_gid;
 
         packagelist_thread = kthread_run(packagelist_reader, (void *)pkgl_dat, "pkgld");
@@ -427,11 +600,17 @@ void * packagelist_create(gid_t write_gid)
 void packagelist_destroy(void *pkgl_id)
 {
 	struct packagelist_data *pkgl_dat = (struct packagelist_data *)pkgl_id;
+	struct packagelist_tables *tables;
 	pid_t pkgl_pid = pkgl_dat->thread_id->pid;
 
 	force_sig_info(SIGINT, SEND_SIG_PRIV, pkgl_dat->thread_id);
 	kthread_stop(pkgl_dat->thread_id);
-	remove_all_hashentrys(pkgl_dat);
+	/* the reader thread is gone, nobody can publish new tables now */
+	tables = rcu_dereference_protected(pkgl_dat->tables, 1);
+	if (tables) {
+		synchronize_rcu();
+		free_tables(tables);
+	}
 	printk(KERN_INFO "sdcardfs: destroyed packagelist pkgld/%d\n", (int)pkgl_pid);
 	kfree(pkgl_dat);
 }
@@ -451,6 +630,8 @@ int packagelist_init(void)
 
 void packagelist_exit(void)
 {
+	/* wait for entries still queued by apply_package_list() */
+	rcu_barrier();
 	if (hashtable_entry_cachep)
 		kmem_cache_destroy(hashtable_entry_cachep);
 }
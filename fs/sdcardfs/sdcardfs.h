@@ -194,6 +194,16 @@ struct sdcardfs_inode_info {
 	gid_t d_gid;
 	mode_t d_mode; 
 
+	/* what the derived state above was computed from, so that
+	 * get_derived_permission() can skip unchanged inodes.
+	 * derived_seq gets a new unique value on every recompute.
+	 */
+	unsigned int derived_seq;
+	unsigned int derived_pkgl_gen;
+	struct inode *derived_parent;
+	unsigned int derived_parent_seq;
+	unsigned int derived_name_hash;
+
 	struct inode vfs_inode;
 };
 
@@ -399,6 +409,7 @@ static inline void sdcardfs_put_real_lower(const struct dentry *dent,
 /* for packagelist.c */
 extern int get_caller_has_rw_locked(void *pkgl_id, derive_t derive);
 extern appid_t get_appid(void *pkgl_id, const char *app_name);
+extern unsigned int packagelist_generation(void *pkgl_id);
 extern int check_caller_access_to_name(struct inode *parent_node, const char* name,
                                         derive_t derive, int w_ok, int has_rw);
 extern int open_flags_to_access_mode(int open_flags);
@@ -0,0 +1,165 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * file_direct.c
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/pagemap.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+
+/*
+ * Read a datablock through the "data" squashfs_cache, for when it cannot
+ * be decompressed straight into the page cache.
+ */
+static int squashfs_read_cache(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *i = target_page->mapping->host;
+	struct squashfs_cache_entry *buffer = squashfs_get_datablock(i->i_sb,
+		block, bsize);
+	int res = buffer->error;
+
+	if (res)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+	else
+		squashfs_copy_cache(target_page, buffer, buffer->length, 0);
+
+	squashfs_cache_put(buffer);
+	return res;
+}
+
+/*
+ * Read separately compressed datablock directly into page cache.  All the
+ * pages the datablock covers are grabbed and mapped contiguously, and the
+ * block is decompressed into them, saving the copy out of squashfs_cache
+ * and the wait for its single-block-per-reader entries.  If any of the
+ * pages is unavailable (or already up to date) the cache is used instead.
+ */
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int i, n, pages, missing_pages, res = -ENOMEM;
+	struct page **page;
+	void **buffer;
+	void *addr = NULL;
+
+	if (end_index > file_end)
+		end_index = file_end;
+
+	pages = end_index - start_index + 1;
+
+	page = kmalloc(pages * (sizeof(*page) + sizeof(*buffer)), GFP_KERNEL);
+	if (page == NULL)
+		return res;
+	buffer = (void **) (page + pages);
+
+	/* Try to grab all the pages covered by the Squashfs block */
+	for (missing_pages = 0, i = 0, n = start_index; i < pages; i++, n++) {
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+
+		if (page[i] == NULL) {
+			missing_pages++;
+			continue;
+		}
+
+		if (PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+			missing_pages++;
+		}
+	}
+
+	if (missing_pages == 0)
+		addr = vm_map_ram(page, pages, -1, PAGE_KERNEL);
+
+	if (addr == NULL) {
+		/*
+		 * Couldn't get or map one or more pages, release the ones we
+		 * have and fall back to reading through the cache, which
+		 * grabs them again.
+		 */
+		for (i = 0; i < pages; i++) {
+			if (page[i] == NULL || page[i] == target_page)
+				continue;
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+		kfree(page);
+		return squashfs_read_cache(target_page, block, bsize);
+	}
+
+	for (i = 0; i < pages; i++)
+		buffer[i] = addr + (i << PAGE_CACHE_SHIFT);
+
+	/* Decompress directly into the page cache buffers */
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		msblk->block_size, pages);
+	if (res >= 0 && res < (pages << PAGE_CACHE_SHIFT))
+		/* Last page may have trailing bytes not filled */
+		memset(addr + res, 0, (pages << PAGE_CACHE_SHIFT) - res);
+	vm_unmap_ram(addr, pages);
+
+	if (res < 0)
+		goto mark_errored;
+
+	/* Mark pages as uptodate, unlock and release */
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+
+	kfree(page);
+	return 0;
+
+mark_errored:
+	/*
+	 * Try to be clever and set every page errored, the caller marks the
+	 * page we were called to fill.
+	 */
+	for (i = 0; i < pages; i++) {
+		if (page[i] == target_page)
+			continue;
+		flush_dcache_page(page[i]);
+		SetPageError(page[i]);
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+
+	kfree(page);
+	return res;
+}
@@ -0,0 +1,105 @@
+#ifndef BLK_SWQ_H
+#define BLK_SWQ_H
+
+#include <linux/bio.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+
+struct blk_swq;
+struct blk_swq_hw_ctx;
+
+/*
+ * Return values of blk_swq_ops->queue_bio
+ */
+enum {
+	BLK_SWQ_OK	= 0,
+	BLK_SWQ_BUSY	= 1,	/* retry later, see blk_swq_run_hw_queue() */
+};
+
+typedef int (blk_swq_queue_bio_fn)(struct blk_swq_hw_ctx *, struct bio *,
+				   int tag);
+
+struct blk_swq_ops {
+	blk_swq_queue_bio_fn	*queue_bio;
+};
+
+/*
+ * Per-cpu software staging queue. Submitters only ever touch the one of
+ * the cpu they run on.
+ */
+struct blk_swq_ctx {
+	spinlock_t		lock;
+	struct bio_list		bios;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Hardware dispatch context. Serves the software queues of the cpus with
+ * cpu % nr_hw_queues == index; only one of its run_work and pollers
+ * dispatches at a time.
+ */
+struct blk_swq_hw_ctx {
+	struct blk_swq		*swq;
+	unsigned int		index;
+	unsigned long		state;
+	struct work_struct	run_work;
+	struct bio_list		dispatch;	/* bios to retry first */
+	unsigned long		nr_dispatched;
+
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	struct bio		**tag_bios;
+
+	void			*driver_data;
+};
+
+/* blk_swq_hw_ctx->state bits */
+enum {
+	BLK_SWQ_S_TAG_WAIT	= 0,	/* ran out of tags */
+	BLK_SWQ_S_RUNNING	= 1,	/* dispatching, see blk_swq_poll() */
+};
+
+/* blk_swq->state bits */
+enum {
+	BLK_SWQ_S_QUIESCED	= 0,	/* do not dispatch */
+};
+
+struct blk_swq {
+	const struct blk_swq_ops *ops;
+	unsigned long		state;
+	unsigned int		nr_hw_queues;
+	struct blk_swq_hw_ctx	*hw_ctx;
+	struct blk_swq_ctx __percpu *ctx;
+	struct workqueue_struct	*wq;
+	atomic_t		flushing;	/* pollers stay out */
+	void			*driver_data;
+};
+
+static inline struct blk_swq_hw_ctx *blk_swq_cpu_to_hctx(struct blk_swq *swq,
+							 int cpu)
+{
+	return &swq->hw_ctx[cpu % swq->nr_hw_queues];
+}
+
+static inline struct bio *blk_swq_tag_to_bio(struct blk_swq_hw_ctx *hctx,
+					     int tag)
+{
+	return hctx->tag_bios[tag];
+}
+
+extern struct blk_swq *blk_swq_init(const struct blk_swq_ops *ops,
+				    unsigned int nr_hw_queues,
+				    unsigned int queue_depth,
+				    const char *name, void *driver_data);
+extern void blk_swq_free(struct blk_swq *swq);
+extern void blk_swq_queue_bio(struct blk_swq *swq, struct bio *bio);
+extern void blk_swq_end_bio(struct blk_swq_hw_ctx *hctx, struct bio *bio,
+			    int tag, int error);
+extern void blk_swq_run_hw_queue(struct blk_swq_hw_ctx *hctx);
+extern int blk_swq_poll(struct blk_swq *swq);
+extern int blk_swq_poll_work(struct blk_swq *swq);
+extern void blk_swq_flush(struct blk_swq *swq);
+extern void blk_swq_quiesce(struct blk_swq *swq);
+extern void blk_swq_resume(struct blk_swq *swq);
+
+#endif
@@ -216,6 +216,7 @@ typedef int (merge_bvec_fn) (struct request_queue *, struct bvec_merge_data *,
 typedef void (softirq_done_fn)(struct request *);
 typedef int (dma_drain_needed_fn)(struct request *);
 typedef int (lld_busy_fn) (struct request_queue *q);
+typedef int (poll_fn) (struct request_queue *q);
 typedef int (bsg_job_fn) (struct bsg_job *);
 
 enum blk_eh_timer_return {
@@ -226,6 +227,18 @@ enum blk_eh_timer_return {
 
 typedef enum blk_eh_timer_return (rq_timed_out_fn)(struct request *);
 
+/*
+ * Completion times seen by tasks polling a queue, see block/blk-poll.c
+ */
+struct blk_poll_stat {
+	spinlock_t		lock;
+	u64			mean_ns;	/* ewma of submit to completion */
+	unsigned long		samples;
+	unsigned long		polls;		/* waits that polled */
+	unsigned long		hits;		/* ... and found the completion */
+	unsigned long		sleeps;		/* hybrid sleeps before polling */
+};
+
 enum blk_queue_state {
 	Queue_down,
 	Queue_up,
@@ -291,6 +304,7 @@ struct request_queue {
 	rq_timed_out_fn		*rq_timed_out_fn;
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
+	poll_fn			*poll_fn;
 
 	/*
 	 * Dispatch queue sorting
@@ -375,6 +389,12 @@ struct request_queue {
 	bool			notified_urgent;
 	bool			dispatched_urgent;
 
+	/*
+	 * completion polling, see QUEUE_FLAG_POLL
+	 */
+	int			poll_delay;	/* usecs, 0 hybrid, -1 spin */
+	struct blk_poll_stat	poll_stat;
+
 	/*
 	 * sg stuff
 	 */
@@ -431,6 +451,7 @@ struct request_queue {
 #define QUEUE_FLAG_SECDISCARD  17	/* supports SECDISCARD */
 #define QUEUE_FLAG_SAME_FORCE  18	/* force complete on same CPU */
 #define QUEUE_FLAG_SANITIZE    19	/* supports SANITIZE */
+#define QUEUE_FLAG_POLL        20	/* poll for sync direct I/O completion */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -511,6 +532,7 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 	test_bit(QUEUE_FLAG_STACKABLE, &(q)->queue_flags)
 #define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
 #define blk_queue_sanitize(q)	test_bit(QUEUE_FLAG_SANITIZE, &(q)->queue_flags)
+#define blk_queue_io_poll(q)	test_bit(QUEUE_FLAG_POLL, &(q)->queue_flags)
 #define blk_queue_secdiscard(q)	(blk_queue_discard(q) && \
 	test_bit(QUEUE_FLAG_SECDISCARD, &(q)->queue_flags))
 
@@ -688,6 +710,10 @@ extern void blk_add_request_payload(struct request *rq, struct page *page,
 		unsigned int len);
 extern int blk_rq_check_limits(struct request_queue *q, struct request *rq);
 extern int blk_lld_busy(struct request_queue *q);
+extern bool blk_poll_wanted(struct request_queue *q);
+extern bool blk_poll(struct request_queue *q, ktime_t start,
+		     bool (*done)(void *), void *data);
+extern void blk_poll_account(struct request_queue *q, ktime_t start);
 extern int blk_rq_prep_clone(struct request *rq, struct request *rq_src,
 			     struct bio_set *bs, gfp_t gfp_mask,
 			     int (*bio_ctr)(struct bio *, struct bio *, void *),
@@ -866,6 +892,7 @@ extern int blk_queue_dma_drain(struct request_queue *q,
 			       dma_drain_needed_fn *dma_drain_needed,
 			       void *buf, unsigned int size);
 extern void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn);
+extern void blk_queue_poll(struct request_queue *q, poll_fn *fn);
 extern void blk_queue_segment_boundary(struct request_queue *, unsigned long);
 extern void blk_queue_prep_rq(struct request_queue *, prep_rq_fn *pfn);
 extern void blk_queue_unprep_rq(struct request_queue *, unprep_rq_fn *ufn);
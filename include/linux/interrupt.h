@@ -250,6 +250,7 @@ extern int irq_can_set_affinity(unsigned int irq);
 extern int irq_select_affinity(unsigned int irq);
 
 extern int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m);
+extern void irq_move_off_cpu(unsigned int cpu, const struct cpumask *dest);
 
 /**
  * struct irq_affinity_notify - context for notification of IRQ affinity changes
@@ -298,6 +299,9 @@ static inline int irq_set_affinity_hint(unsigned int irq,
 {
 	return -EINVAL;
 }
+
+static inline void irq_move_off_cpu(unsigned int cpu,
+				    const struct cpumask *dest) { }
 #endif /* CONFIG_SMP && CONFIG_GENERIC_HARDIRQS */
 
 #ifdef CONFIG_GENERIC_HARDIRQS
@@ -27,6 +27,7 @@ enum {
 };
 
 struct loop_func_table;
+struct blk_swq;
 
 struct loop_device {
 	int		lo_number;
@@ -56,11 +57,9 @@ struct loop_device {
 	gfp_t		old_gfp_mask;
 
 	spinlock_t		lo_lock;
-	struct bio_list		lo_bio_list;
 	int			lo_state;
 	struct mutex		lo_ctl_mutex;
-	struct task_struct	*lo_thread;
-	wait_queue_head_t	lo_event;
+	struct blk_swq		*lo_swq;
 
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
@@ -1215,6 +1215,7 @@ struct sched_statistics {
 	u64			nr_wakeups_affine_attempts;
 	u64			nr_wakeups_passive;
 	u64			nr_wakeups_idle;
+	u64			nr_wakeups_packed;
 };
 #endif
 
@@ -1231,6 +1232,16 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+#ifdef CONFIG_SMP
+	/*
+	 * Small task packing: runtime consumed per wakeup-to-wakeup
+	 * window, averaged and scaled to SCHED_POWER_SCALE.
+	 */
+	u64			pack_stamp;
+	u64			pack_exec;
+	unsigned long		pack_util;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
@@ -2076,6 +2087,7 @@ extern void sched_clock_idle_wakeup_event(u64 delta_ns);
 
 #ifdef CONFIG_HOTPLUG_CPU
 extern void idle_task_exit(void);
+extern void sched_isolate_cpu(unsigned int cpu);
 #else
 static inline void idle_task_exit(void) {}
 #endif
@@ -2090,7 +2102,11 @@ extern unsigned int sysctl_sched_latency;
 extern unsigned int sysctl_sched_min_granularity;
 extern unsigned int sysctl_sched_wakeup_granularity;
 extern unsigned int sysctl_sched_child_runs_first;
+extern int sysctl_timer_housekeeping_cpu;
 extern unsigned int sysctl_sched_wake_to_idle;
+extern unsigned int sysctl_sched_small_task_pack;
+extern unsigned int sysctl_sched_small_task_pct;
+extern unsigned int sysctl_sched_pack_capacity_pct;
 
 enum sched_tunable_scaling {
 	SCHED_TUNABLESCALING_NONE,
@@ -29,6 +29,14 @@
 #define TEST_NO_PATTERN		0xDEADBEEF
 #define BIO_U32_SIZE 1024
 
+/*
+ * Latency histogram buckets: bucket i counts test requests completed less
+ * than TEST_LAT_BUCKET_USEC << i usec after dispatch, the last bucket all
+ * the slower ones.
+ */
+#define TEST_LAT_BUCKETS	10
+#define TEST_LAT_BUCKET_USEC	250
+
 struct test_data;
 
 typedef int (prepare_test_fn) (struct test_data *);
@@ -69,6 +77,16 @@ enum req_unique_type {
 	REQ_UNIQUE_SANITIZE,
 };
 
+/**
+ * enum test_lat_class - classes test request latency is accounted in
+ */
+enum test_lat_class {
+	TEST_LAT_URGENT,
+	TEST_LAT_READ,
+	TEST_LAT_WRITE,
+	TEST_LAT_CLASSES,
+};
+
 /**
  * struct test_debug - debugfs directories
  * @debug_root:		The test-iosched debugfs root directory
@@ -79,6 +97,7 @@ enum req_unique_type {
  * @debug_test_result:	Exposes the test result to the user
  *			space
  * @start_sector:	The start sector for read/write requests
+ * @lat_hist:		Exposes the test requests latency histogram
  */
 struct test_debug {
 	struct dentry *debug_root;
@@ -86,6 +105,7 @@ struct test_debug {
 	struct dentry *debug_tests_root;
 	struct dentry *debug_test_result;
 	struct dentry *start_sector;
+	struct dentry *lat_hist;
 };
 
 /**
@@ -106,6 +126,8 @@ struct test_debug {
  *			verify the data
  * @req_id:		A unique ID to identify a test request
  *			to ease the debugging of the test cases
+ * @dispatch_time:	Time the request was dispatched to the driver
+ * @lat_class:		Latency class the request is accounted in
  */
 struct test_request {
 	struct list_head queuelist;
@@ -117,6 +139,8 @@ struct test_request {
 	int is_err_expected;
 	int wr_rd_data_pattern;
 	int req_id;
+	ktime_t dispatch_time;
+	enum test_lat_class lat_class;
 };
 
 /**
@@ -205,6 +229,8 @@ struct blk_dev_test_type {
  *			test round was disturbed by an external
  *			flush request, therefore disqualifying
  *			the results
+ * @lat_hist:		Dispatch to completion latency histogram of the
+ *			test requests, per enum test_lat_class
  */
 struct test_data {
 	struct list_head queue;
@@ -230,6 +256,7 @@ struct test_data {
 	struct test_info test_info;
 	bool fs_wr_reqs_during_test;
 	bool ignore_round;
+	unsigned int lat_hist[TEST_LAT_CLASSES][TEST_LAT_BUCKETS];
 };
 
 extern int test_iosched_start_test(struct test_info *t_info);
@@ -262,6 +289,8 @@ extern struct test_data *test_get_test_data(void);
 
 void test_iosched_add_urgent_req(struct test_request *test_rq);
 
+void test_iosched_account_latency(struct test_request *test_rq);
+
 int test_is_req_urgent(struct request *rq);
 
 void check_test_completion(void);
@@ -9,6 +9,7 @@
 #include <linux/atomic.h>
 
 extern int sysctl_stat_interval;
+extern int sysctl_stat_on_demand;
 
 #ifdef CONFIG_VM_EVENT_COUNTERS
 /*
@@ -197,7 +198,7 @@ extern void __inc_zone_state(struct zone *, enum zone_stat_item);
 extern void dec_zone_state(struct zone *, enum zone_stat_item);
 extern void __dec_zone_state(struct zone *, enum zone_stat_item);
 
-void refresh_cpu_vm_stats(int);
+int refresh_cpu_vm_stats(int);
 void refresh_zone_stat_thresholds(void);
 
 int calculate_pressure_threshold(struct zone *zone);
@@ -250,7 +251,7 @@ static inline void __dec_zone_page_state(struct page *page,
 
 #define set_pgdat_percpu_threshold(pgdat, callback) { }
 
-static inline void refresh_cpu_vm_stats(int cpu) { }
+static inline int refresh_cpu_vm_stats(int cpu) { return 0; }
 static inline void refresh_zone_stat_thresholds(void) { }
 
 #endif		/* CONFIG_SMP */
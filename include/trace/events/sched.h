@@ -242,6 +242,35 @@ TRACE_EVENT(sched_cpu_hotplug,
 		__entry->status ? "online" : "offline", __entry->error)
 );
 
+/*
+ * Tracepoint for cpu online/offline/isolate transitions and the time
+ * they took:
+ */
+TRACE_EVENT(sched_cpu_transition,
+
+	TP_PROTO(int cpu, const char *type, int error, u64 delta_ns),
+
+	TP_ARGS(cpu, type, error, delta_ns),
+
+	TP_STRUCT__entry(
+		__field(	int,	cpu			)
+		__string(	type,	type			)
+		__field(	int,	error			)
+		__field(	u64,	delta_ns		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu		= cpu;
+		__assign_str(type, type);
+		__entry->error		= error;
+		__entry->delta_ns	= delta_ns;
+	),
+
+	TP_printk("cpu %d %s error=%d time=%llu ns", __entry->cpu,
+		__get_str(type), __entry->error,
+		(unsigned long long)__entry->delta_ns)
+);
+
 /*
  * Tracepoint for load balancing:
  */
@@ -16,6 +16,8 @@
 #include <linux/mutex.h>
 #include <linux/gfp.h>
 #include <linux/suspend.h>
+#include <linux/cpuset.h>
+#include <linux/interrupt.h>
 
 #include <trace/events/sched.h>
 
@@ -270,6 +272,7 @@ static int __ref _cpu_down(unsigned int cpu, int tasks_frozen)
 		goto out_release;
 	}
 	BUG_ON(cpu_online(cpu));
+	set_cpu_isolated(cpu, false);
 
 	/*
 	 * The migration_call() CPU_DYING callback will have removed all
@@ -299,6 +302,7 @@ out_release:
 
 int __ref cpu_down(unsigned int cpu)
 {
+	u64 start = sched_clock();
 	int err;
 
 	cpu_maps_update_begin();
@@ -312,9 +316,96 @@ int __ref cpu_down(unsigned int cpu)
 
 out:
 	cpu_maps_update_done();
+	trace_sched_cpu_transition(cpu, "offline", err, sched_clock() - start);
 	return err;
 }
 EXPORT_SYMBOL(cpu_down);
+
+/*
+ * Isolating a cpu takes it out of task placement, load balancing and
+ * interrupt routing while leaving it online, so that it can sit in its
+ * deepest idle state. Unlike cpu_down() this goes through neither
+ * stop_machine nor the hotplug notifier chain; only the isolated cpu
+ * itself is briefly stopped to push its runnable tasks away and to
+ * drop it from idle load balancing. Per-cpu kthreads and per-cpu work
+ * items stay where they are. Timers and hrtimers already queued on the
+ * cpu are not migrated either; they keep firing there until they expire
+ * or are re-armed elsewhere.
+ */
+int cpu_isolate(unsigned int cpu)
+{
+	u64 start = sched_clock();
+	int err = 0;
+
+	cpu_maps_update_begin();
+
+	if (cpu_hotplug_disabled) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	if (!cpu_online(cpu)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (cpu_isolated(cpu))
+		goto out;
+
+	if (num_active_cpus() == 1) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	/* rebuild the sched domains without this cpu */
+	cpu_hotplug_begin();
+	set_cpu_isolated(cpu, true);
+	set_cpu_active(cpu, false);
+	cpuset_update_active_cpus();
+	cpu_hotplug_done();
+
+	sched_isolate_cpu(cpu);
+	irq_move_off_cpu(cpu, cpu_active_mask);
+
+out:
+	cpu_maps_update_done();
+	trace_sched_cpu_transition(cpu, "isolate", err, sched_clock() - start);
+	return err;
+}
+EXPORT_SYMBOL_GPL(cpu_isolate);
+
+/*
+ * Make an isolated cpu available to the scheduler again. Interrupts are
+ * not moved back; whoever balances them will spread them again.
+ */
+int cpu_unisolate(unsigned int cpu)
+{
+	u64 start = sched_clock();
+	int err = 0;
+
+	cpu_maps_update_begin();
+
+	if (cpu_hotplug_disabled) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	if (!cpu_isolated(cpu))
+		goto out;
+
+	cpu_hotplug_begin();
+	set_cpu_isolated(cpu, false);
+	set_cpu_active(cpu, true);
+	cpuset_update_active_cpus();
+	cpu_hotplug_done();
+
+out:
+	cpu_maps_update_done();
+	trace_sched_cpu_transition(cpu, "unisolate", err,
+				   sched_clock() - start);
+	return err;
+}
+EXPORT_SYMBOL_GPL(cpu_unisolate);
 #endif /*CONFIG_HOTPLUG_CPU*/
 
 /* Requires cpu_add_remove_lock to be held */
@@ -356,6 +447,7 @@ out_notify:
 
 int __cpuinit cpu_up(unsigned int cpu)
 {
+	u64 start = sched_clock();
 	int err = 0;
 
 #ifdef	CONFIG_MEMORY_HOTPLUG
@@ -406,6 +498,7 @@ int __cpuinit cpu_up(unsigned int cpu)
 
 out:
 	cpu_maps_update_done();
+	trace_sched_cpu_transition(cpu, "online", err, sched_clock() - start);
 	return err;
 }
 EXPORT_SYMBOL_GPL(cpu_up);
@@ -621,6 +714,10 @@ static DECLARE_BITMAP(cpu_active_bits, CONFIG_NR_CPUS) __read_mostly;
 const struct cpumask *const cpu_active_mask = to_cpumask(cpu_active_bits);
 EXPORT_SYMBOL(cpu_active_mask);
 
+static DECLARE_BITMAP(cpu_isolated_bits, CONFIG_NR_CPUS) __read_mostly;
+const struct cpumask *const cpu_isolated_mask = to_cpumask(cpu_isolated_bits);
+EXPORT_SYMBOL(cpu_isolated_mask);
+
 void set_cpu_possible(unsigned int cpu, bool possible)
 {
 	if (possible)
@@ -655,6 +752,14 @@ void set_cpu_active(unsigned int cpu, bool active)
 		cpumask_clear_cpu(cpu, to_cpumask(cpu_active_bits));
 }
 
+void set_cpu_isolated(unsigned int cpu, bool isolated)
+{
+	if (isolated)
+		cpumask_set_cpu(cpu, to_cpumask(cpu_isolated_bits));
+	else
+		cpumask_clear_cpu(cpu, to_cpumask(cpu_isolated_bits));
+}
+
 void init_cpu_present(const struct cpumask *src)
 {
 	cpumask_copy(to_cpumask(cpu_present_bits), src);
@@ -192,6 +192,42 @@ int irq_set_affinity(unsigned int irq, const struct cpumask *mask)
 	return ret;
 }
 
+/**
+ *	irq_move_off_cpu - move balanceable interrupts away from a cpu
+ *	@cpu:	cpu that should stop receiving interrupts
+ *	@dest:	cpus the interrupts may be moved to
+ *
+ *	Used when a cpu stays online but is isolated for power management.
+ *	Per-cpu interrupts and interrupts that must not be balanced are
+ *	left alone. Interrupts affine to other cpus as well keep those.
+ */
+void irq_move_off_cpu(unsigned int cpu, const struct cpumask *dest)
+{
+	struct irq_desc *desc;
+	cpumask_var_t mask;
+	unsigned long flags;
+	unsigned int irq;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return;
+
+	for_each_irq_desc(irq, desc) {
+		struct irq_data *data = irq_desc_get_irq_data(desc);
+
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		if (irqd_can_balance(data) &&
+		    cpumask_test_cpu(cpu, data->affinity)) {
+			cpumask_andnot(mask, data->affinity, cpumask_of(cpu));
+			if (!cpumask_and(mask, mask, dest))
+				cpumask_copy(mask, dest);
+			__irq_set_affinity_locked(data, mask);
+		}
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+	}
+
+	free_cpumask_var(mask);
+}
+
 int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m)
 {
 	unsigned long flags;
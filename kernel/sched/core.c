@@ -558,13 +558,22 @@ void resched_cpu(int cpu)
  * We don't do similar optimization for completely idle system, as
  * selecting an idle cpu will add more delays to the timers than intended
  * (as that cpu's timer base may not be uptodate wrt jiffies etc).
+ *
+ * If a housekeeping cpu has been nominated and it is busy, it gets the
+ * timers, so that they pile up on one cpu instead of keeping the first
+ * busy cpu of every domain awake.
  */
 int get_nohz_timer_target(void)
 {
 	int cpu = smp_processor_id();
+	int hk_cpu = ACCESS_ONCE(sysctl_timer_housekeeping_cpu);
 	int i;
 	struct sched_domain *sd;
 
+	if (hk_cpu >= 0 && hk_cpu < nr_cpu_ids && cpu_active(hk_cpu) &&
+	    !idle_cpu(hk_cpu))
+		return hk_cpu;
+
 	rcu_read_lock();
 	for_each_domain(cpu, sd) {
 		for_each_cpu(i, sched_domain_span(sd)) {
@@ -1366,6 +1375,14 @@ int select_task_rq(struct task_struct *p, int sd_flags, int wake_flags)
 	if (unlikely(!cpumask_test_cpu(cpu, tsk_cpus_allowed(p)) ||
 		     !cpu_online(cpu)))
 		cpu = select_fallback_rq(task_cpu(p), p);
+	/*
+	 * An isolated cpu is online but inactive: keep tasks away from it
+	 * unless they are not allowed to run anywhere else.
+	 */
+	else if (unlikely(cpu_isolated(cpu) &&
+			  cpumask_intersects(tsk_cpus_allowed(p),
+					     cpu_active_mask)))
+		cpu = select_fallback_rq(task_cpu(p), p);
 
 	return cpu;
 }
@@ -1750,6 +1767,13 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	/* treat new tasks as busy until they have slept at least once */
+	p->se.pack_stamp		= 0;
+	p->se.pack_exec			= 0;
+	p->se.pack_util			= SCHED_POWER_SCALE;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -5387,6 +5411,56 @@ void idle_task_exit(void)
 	mmdrop(mm);
 }
 
+/*
+ * Executed by the stopper of an isolated cpu: push the fair tasks queued
+ * on its runqueue that may run on an active cpu away. Tasks bound to
+ * this cpu stay. Tasks of other classes are moved by select_task_rq()
+ * the next time they wake up.
+ */
+static int isolate_cpu_stop(void *data)
+{
+	unsigned int cpu = smp_processor_id();
+	struct rq *rq = cpu_rq(cpu);
+	struct task_struct *p;
+	int dest_cpu;
+
+	nohz_balance_isolate_cpu(cpu);
+
+	raw_spin_lock_irq(&rq->lock);
+	for ( ; ; ) {
+		dest_cpu = nr_cpu_ids;
+		list_for_each_entry(p, &rq->cfs_tasks, se.group_node) {
+			if (task_running(rq, p))
+				continue;
+			dest_cpu = cpumask_any_and(cpu_active_mask,
+						   tsk_cpus_allowed(p));
+			if (dest_cpu < nr_cpu_ids)
+				break;
+		}
+		if (dest_cpu >= nr_cpu_ids)
+			break;
+
+		get_task_struct(p);
+		raw_spin_unlock(&rq->lock);
+		__migrate_task(p, cpu, dest_cpu);
+		put_task_struct(p);
+		raw_spin_lock(&rq->lock);
+	}
+	raw_spin_unlock_irq(&rq->lock);
+
+	return 0;
+}
+
+/*
+ * Move the runnable tasks off a cpu that has just been marked inactive
+ * by cpu_isolate(). Only @cpu is stopped for this. Sleeping tasks are
+ * placed elsewhere by select_task_rq() when they wake up.
+ */
+void sched_isolate_cpu(unsigned int cpu)
+{
+	stop_one_cpu(cpu, isolate_cpu_stop, NULL);
+}
+
 /*
  * While a dead CPU has no uninterruptible tasks queued at this point,
  * it might still have a nonzero ->nr_uninterruptible counter, because
@@ -7193,6 +7267,9 @@ void __init sched_init_smp(void)
 
 const_debug unsigned int sysctl_timer_migration = 1;
 
+/* Busy cpu that receives timers migrated away from idle cpus, or -1 */
+int sysctl_timer_housekeeping_cpu = -1;
+
 int in_sched_functions(unsigned long addr)
 {
 	return in_lock_functions(addr) ||
@@ -84,6 +84,17 @@ unsigned int sysctl_sched_child_runs_first __read_mostly;
  */
 unsigned int __read_mostly sysctl_sched_wake_to_idle;
 
+/*
+ * Small task packing. When enabled, a waking task whose utilization is
+ * below sched_small_task_pct percent of a CPU is placed on an already
+ * busy CPU of the same cache domain, as long as the combined utilization
+ * stays below sched_pack_capacity_pct. This keeps light periodic tasks
+ * from pulling idle CPUs out of their deep idle states.
+ */
+unsigned int __read_mostly sysctl_sched_small_task_pack;
+unsigned int __read_mostly sysctl_sched_small_task_pct = 10;
+unsigned int __read_mostly sysctl_sched_pack_capacity_pct = 80;
+
 /*
  * SCHED_OTHER wake-up granularity.
  * (default: 1 msec * (1 + ilog(ncpus)), units: nanoseconds)
@@ -2711,6 +2722,99 @@ done:
 	return target;
 }
 
+/*
+ * Utilization of @p over the window since its last wakeup, scaled to
+ * SCHED_POWER_SCALE. The runtime of a task that is not running is
+ * stable, and for a running task an unlocked read is good enough here.
+ */
+static unsigned long task_pack_window_util(struct task_struct *p, u64 now)
+{
+	u64 window = now - p->se.pack_stamp;
+	u64 ran = p->se.sum_exec_runtime - p->se.pack_exec;
+
+	if ((s64)window <= 0)
+		return 0;
+	if (ran >= window)
+		return SCHED_POWER_SCALE;
+
+	return (unsigned long)div64_u64(ran << SCHED_POWER_SHIFT, window);
+}
+
+/*
+ * Fold the last wakeup-to-wakeup window of @p into its average.
+ */
+static void update_task_pack_util(struct task_struct *p, u64 now)
+{
+	unsigned long util = task_pack_window_util(p, now);
+
+	p->se.pack_util = (3 * p->se.pack_util + util) >> 2;
+	p->se.pack_stamp = now;
+	p->se.pack_exec = p->se.sum_exec_runtime;
+}
+
+/*
+ * Current utilization of the task running on @cpu: the larger of its
+ * average and what it has consumed since its last wakeup, so that a
+ * task that turned into a CPU hog is not mistaken for a small one.
+ */
+static unsigned long cpu_pack_util(int cpu, u64 now)
+{
+	struct task_struct *curr = ACCESS_ONCE(cpu_rq(cpu)->curr);
+
+	if (curr->sched_class != &fair_sched_class)
+		return SCHED_POWER_SCALE;
+
+	return max(curr->se.pack_util, task_pack_window_util(curr, now));
+}
+
+/*
+ * Find a busy cpu in the LLC domain of @target that can absorb the small
+ * task @p. Returns -1 if @p is not small or no such cpu exists.
+ *
+ * Must be called with rcu_read_lock() held.
+ */
+static int select_packing_cpu(struct task_struct *p, int target, u64 now)
+{
+	unsigned long small, capacity, util, best_util = ULONG_MAX;
+	struct sched_domain *sd;
+	int i, best_cpu = -1;
+
+	if (sysctl_sched_wake_to_idle ||
+	    (current->flags & PF_WAKE_UP_IDLE) ||
+	    (p->flags & PF_WAKE_UP_IDLE))
+		return -1;
+
+	small = (SCHED_POWER_SCALE * sysctl_sched_small_task_pct) / 100;
+	if (p->se.pack_util >= small)
+		return -1;
+
+	sd = rcu_dereference(per_cpu(sd_llc, target));
+	if (!sd)
+		return -1;
+
+	capacity = (SCHED_POWER_SCALE * sysctl_sched_pack_capacity_pct) / 100;
+
+	for_each_cpu_and(i, sched_domain_span(sd), tsk_cpus_allowed(p)) {
+		/*
+		 * Only consider cpus that are running exactly one task, so
+		 * the load we can see is all the load there is.
+		 */
+		if (idle_cpu(i) || cpu_rq(i)->nr_running != 1)
+			continue;
+
+		util = cpu_pack_util(i, now) + p->se.pack_util;
+		if (util > capacity)
+			continue;
+
+		if (util < best_util || (util == best_util && i == target)) {
+			best_util = util;
+			best_cpu = i;
+		}
+	}
+
+	return best_cpu;
+}
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -2743,6 +2847,19 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 	}
 
 	rcu_read_lock();
+	if ((sd_flag & SD_BALANCE_WAKE) && sysctl_sched_small_task_pack) {
+		u64 now = local_clock();
+		int pack_cpu;
+
+		update_task_pack_util(p, now);
+		pack_cpu = select_packing_cpu(p, prev_cpu, now);
+		if (pack_cpu >= 0) {
+			schedstat_inc(p, se.statistics.nr_wakeups_packed);
+			new_cpu = pack_cpu;
+			goto unlock;
+		}
+	}
+
 	for_each_domain(cpu, tmp) {
 		if (!(tmp->flags & SD_LOAD_BALANCE))
 			continue;
@@ -4896,6 +5013,16 @@ static inline void clear_nohz_tick_stopped(int cpu)
 	}
 }
 
+/*
+ * Called on a cpu that has just been isolated: drop it from the idle load
+ * balancing bookkeeping, like CPU_DYING does. select_nohz_load_balancer()
+ * won't add it back while it is inactive, so it is never picked as ilb.
+ */
+void nohz_balance_isolate_cpu(int cpu)
+{
+	clear_nohz_tick_stopped(cpu);
+}
+
 static inline void set_cpu_sd_state_busy(void)
 {
 	struct sched_domain *sd;
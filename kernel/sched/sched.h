@@ -1163,4 +1163,8 @@ enum rq_nohz_flag_bits {
 };
 
 #define nohz_flags(cpu)	(&cpu_rq(cpu)->nohz_flags)
+
+extern void nohz_balance_isolate_cpu(int cpu);
+#else
+static inline void nohz_balance_isolate_cpu(int cpu) { }
 #endif
@@ -436,11 +436,15 @@ EXPORT_SYMBOL(dec_zone_page_state);
  * statistics in the remote zone struct as well as the global cachelines
  * with the global counters. These could cause remote node cache line
  * bouncing and will have to be only done when necessary.
+ *
+ * Returns the number of counters folded, plus one for every remote
+ * pageset that still waits to be drained.
  */
-void refresh_cpu_vm_stats(int cpu)
+int refresh_cpu_vm_stats(int cpu)
 {
 	struct zone *zone;
 	int i;
+	int changes = 0;
 	int global_diff[NR_VM_ZONE_STAT_ITEMS] = { 0, };
 
 	for_each_populated_zone(zone) {
@@ -459,6 +463,7 @@ void refresh_cpu_vm_stats(int cpu)
 				local_irq_restore(flags);
 				atomic_long_add(v, &zone->vm_stat[i]);
 				global_diff[i] += v;
+				changes++;
 #ifdef CONFIG_NUMA
 				/* 3 seconds idle till flush */
 				p->expire = 3;
@@ -485,8 +490,10 @@ void refresh_cpu_vm_stats(int cpu)
 		}
 
 		p->expire--;
-		if (p->expire)
+		if (p->expire) {
+			changes++;
 			continue;
+		}
 
 		if (p->pcp.count)
 			drain_zone_pages(zone, &p->pcp);
@@ -496,6 +503,8 @@ void refresh_cpu_vm_stats(int cpu)
 	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
 		if (global_diff[i])
 			atomic_long_add(global_diff[i], &vm_stat[i]);
+
+	return changes;
 }
 
 #endif
@@ -1160,17 +1169,68 @@ static const struct file_operations proc_vmstat_file_operations = {
 static DEFINE_PER_CPU(struct delayed_work, vmstat_work);
 int sysctl_stat_interval __read_mostly = HZ;
 
+/*
+ * In on-demand mode the per-cpu worker of a cpu that had nothing to fold
+ * is not re-armed, so an idle cpu is not woken just to find out there is
+ * nothing to do. The shepherd, running on whichever cpu is busy, restarts
+ * the worker once the cpu has accumulated differentials again.
+ */
+int sysctl_stat_on_demand __read_mostly = 1;
+static struct cpumask vmstat_off_cpus;
+static struct delayed_work vmstat_shepherd_work;
+
 static void vmstat_update(struct work_struct *w)
 {
-	refresh_cpu_vm_stats(smp_processor_id());
+	int cpu = smp_processor_id();
+
+	if (!refresh_cpu_vm_stats(cpu) && sysctl_stat_on_demand) {
+		cpumask_set_cpu(cpu, &vmstat_off_cpus);
+		return;
+	}
+
 	schedule_delayed_work(&__get_cpu_var(vmstat_work),
 		round_jiffies_relative(sysctl_stat_interval));
 }
 
+/* Does @cpu hold differentials that have not been folded yet? */
+static bool need_update(int cpu)
+{
+	struct zone *zone;
+
+	for_each_populated_zone(zone) {
+		struct per_cpu_pageset *p = per_cpu_ptr(zone->pageset, cpu);
+		int i;
+
+		for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
+			if (p->vm_stat_diff[i])
+				return true;
+	}
+	return false;
+}
+
+static void vmstat_shepherd(struct work_struct *w)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_cpu(cpu, &vmstat_off_cpus) {
+		if (sysctl_stat_on_demand && !need_update(cpu))
+			continue;
+
+		cpumask_clear_cpu(cpu, &vmstat_off_cpus);
+		schedule_delayed_work_on(cpu, &per_cpu(vmstat_work, cpu), 0);
+	}
+	put_online_cpus();
+
+	schedule_delayed_work(&vmstat_shepherd_work,
+		round_jiffies_relative(sysctl_stat_interval));
+}
+
 static void __cpuinit start_cpu_timer(int cpu)
 {
 	struct delayed_work *work = &per_cpu(vmstat_work, cpu);
 
+	cpumask_clear_cpu(cpu, &vmstat_off_cpus);
 	INIT_DELAYED_WORK_DEFERRABLE(work, vmstat_update);
 	schedule_delayed_work_on(cpu, work, __round_jiffies_relative(HZ, cpu));
 }
@@ -1196,6 +1256,7 @@ static int __cpuinit vmstat_cpuup_callback(struct notifier_block *nfb,
 	case CPU_DOWN_PREPARE_FROZEN:
 		cancel_delayed_work_sync(&per_cpu(vmstat_work, cpu));
 		per_cpu(vmstat_work, cpu).work.func = NULL;
+		cpumask_clear_cpu(cpu, &vmstat_off_cpus);
 		break;
 	case CPU_DOWN_FAILED:
 	case CPU_DOWN_FAILED_FROZEN:
@@ -1224,6 +1285,10 @@ static int __init setup_vmstat(void)
 
 	for_each_online_cpu(cpu)
 		start_cpu_timer(cpu);
+
+	INIT_DELAYED_WORK_DEFERRABLE(&vmstat_shepherd_work, vmstat_shepherd);
+	schedule_delayed_work(&vmstat_shepherd_work,
+		round_jiffies_relative(sysctl_stat_interval));
 #endif
 #ifdef CONFIG_PROC_FS
 	proc_create("buddyinfo", S_IRUGO, NULL, &fragmentation_file_operations);
@@ -0,0 +1,270 @@
+/*
+ * fuse_wb_mtime:
+ *
+ * Checks that a FUSE mount running in writeback cache mode reports the
+ * mtime of buffered writes back to the filesystem.  A minimal server is
+ * run in a thread straight on top of /dev/fuse; it exports a single
+ * regular file, offers FUSE_WRITEBACK_CACHE in its INIT reply and records
+ * the last mtime it is sent with SETATTR.  The test writes to the file,
+ * closes it and expects the server to have seen an mtime at least as new
+ * as the write.
+ *
+ * Needs root and the exported headers of the kernel under test
+ * (make headers_install).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <linux/fuse.h>
+
+#define FILE_INO	2
+#define FILE_NAME	"file"
+#define MAX_WRITE	(64 * 1024)
+#define BUF_SIZE	(MAX_WRITE + 4096)
+
+static int fuse_fd;
+static int wb_negotiated;
+static time_t srv_mtime = 1;
+static unsigned int srv_mtimensec;
+static unsigned long long srv_size;
+static int srv_setattr_mtime;
+
+static void fill_attr(unsigned long long ino, struct fuse_attr *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	attr->nlink = 1;
+	attr->blksize = 4096;
+	if (ino == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+		attr->nlink = 2;
+		return;
+	}
+	attr->mode = S_IFREG | 0644;
+	attr->size = srv_size;
+	attr->blocks = (srv_size + 511) / 512;
+	attr->mtime = srv_mtime;
+	attr->mtimensec = srv_mtimensec;
+	attr->ctime = srv_mtime;
+	attr->ctimensec = srv_mtimensec;
+}
+
+static void reply(struct fuse_in_header *in, int error, void *arg, size_t size)
+{
+	char buf[sizeof(struct fuse_out_header) + 256];
+	struct fuse_out_header *out = (struct fuse_out_header *)buf;
+
+	out->len = sizeof(*out) + size;
+	out->error = error;
+	out->unique = in->unique;
+	if (size)
+		memcpy(out + 1, arg, size);
+	if (write(fuse_fd, buf, out->len) != (ssize_t)out->len && errno != ENOENT)
+		perror("reply");
+}
+
+static void handle(struct fuse_in_header *in, void *arg)
+{
+	switch (in->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_in *init = arg;
+		struct fuse_init_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.major = FUSE_KERNEL_VERSION;
+		out.minor = FUSE_KERNEL_MINOR_VERSION;
+		out.max_readahead = init->max_readahead;
+		out.flags = init->flags & (FUSE_BIG_WRITES | FUSE_WRITEBACK_CACHE);
+		out.max_write = MAX_WRITE;
+		wb_negotiated = !!(out.flags & FUSE_WRITEBACK_CACHE);
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_LOOKUP: {
+		struct fuse_entry_out out;
+
+		if (in->nodeid != FUSE_ROOT_ID || strcmp(arg, FILE_NAME)) {
+			reply(in, -ENOENT, NULL, 0);
+			break;
+		}
+		memset(&out, 0, sizeof(out));
+		out.nodeid = FILE_INO;
+		out.entry_valid = 1;
+		out.attr_valid = 1;
+		fill_attr(FILE_INO, &out.attr);
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 1;
+		fill_attr(in->nodeid, &out.attr);
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_SETATTR: {
+		struct fuse_setattr_in *sa = arg;
+		struct fuse_attr_out out;
+
+		if (sa->valid & FATTR_SIZE)
+			srv_size = sa->size;
+		if (sa->valid & FATTR_MTIME) {
+			srv_mtime = sa->mtime;
+			srv_mtimensec = sa->mtimensec;
+			srv_setattr_mtime = 1;
+		}
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 1;
+		fill_attr(in->nodeid, &out.attr);
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_OPEN: {
+		struct fuse_open_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.fh = 1;
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_WRITE: {
+		struct fuse_write_in *wr = arg;
+		struct fuse_write_out out;
+
+		if (wr->offset + wr->size > srv_size)
+			srv_size = wr->offset + wr->size;
+		memset(&out, 0, sizeof(out));
+		out.size = wr->size;
+		reply(in, 0, &out, sizeof(out));
+		break;
+	}
+	case FUSE_FLUSH:
+	case FUSE_RELEASE:
+	case FUSE_FSYNC:
+		reply(in, 0, NULL, 0);
+		break;
+	case FUSE_FORGET:
+	case FUSE_BATCH_FORGET:
+		break;
+	default:
+		reply(in, -ENOSYS, NULL, 0);
+		break;
+	}
+}
+
+static void *server(void *arg)
+{
+	char *buf = arg;
+	ssize_t len;
+
+	for (;;) {
+		len = read(fuse_fd, buf, BUF_SIZE);
+		if (len < 0) {
+			if (errno == EINTR || errno == ENOENT)
+				continue;
+			break;
+		}
+		if ((size_t)len < sizeof(struct fuse_in_header))
+			break;
+		handle((struct fuse_in_header *)buf,
+		       buf + sizeof(struct fuse_in_header));
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	char mnt[] = "/tmp/fuse_wb_mtime.XXXXXX";
+	char path[sizeof(mnt) + sizeof(FILE_NAME) + 1];
+	char opts[128];
+	char data[4096];
+	char *buf;
+	pthread_t thread;
+	struct stat st;
+	time_t start;
+	int fd, ret = 1;
+
+	fuse_fd = open("/dev/fuse", O_RDWR);
+	if (fuse_fd < 0) {
+		perror("open /dev/fuse");
+		return 1;
+	}
+	if (!mkdtemp(mnt)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/%s", mnt, FILE_NAME);
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0", fuse_fd);
+
+	if (mount("fuse_wb_mtime", mnt, "fuse", MS_NOSUID | MS_NODEV, opts)) {
+		perror("mount");
+		goto out_rmdir;
+	}
+	buf = malloc(BUF_SIZE);
+	if (!buf || pthread_create(&thread, NULL, server, buf)) {
+		perror("pthread_create");
+		goto out_umount;
+	}
+
+	/* the first lookup waits for INIT to complete */
+	if (stat(path, &st)) {
+		perror("stat");
+		goto out_umount;
+	}
+	if (!wb_negotiated) {
+		printf("[FAIL]\tkernel did not offer FUSE_WRITEBACK_CACHE\n");
+		goto out_umount;
+	}
+
+	start = time(NULL);
+	sleep(1);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror("open");
+		goto out_umount;
+	}
+	memset(data, 0xa5, sizeof(data));
+	if (write(fd, data, sizeof(data)) != sizeof(data)) {
+		perror("write");
+		close(fd);
+		goto out_umount;
+	}
+	/* ->flush writes back dirty pages and the inode times */
+	if (close(fd)) {
+		perror("close");
+		goto out_umount;
+	}
+
+	if (!srv_setattr_mtime) {
+		printf("[FAIL]\tserver was never sent an mtime\n");
+	} else if (srv_mtime <= start) {
+		printf("[FAIL]\tserver mtime %ld is not newer than %ld\n",
+		       (long)srv_mtime, (long)start);
+	} else if (srv_size != sizeof(data)) {
+		printf("[FAIL]\tserver size %llu, expected %zu\n",
+		       srv_size, sizeof(data));
+	} else {
+		printf("[OK]\twriteback cache mtime reached the server\n");
+		ret = 0;
+	}
+
+out_umount:
+	umount2(mnt, MNT_DETACH);
+	close(fuse_fd);
+out_rmdir:
+	rmdir(mnt);
+	return ret;
+}